@@ -0,0 +1,581 @@
+#include "aot2.h"
+#include <climits>
+#include <cstdio>
+#include <stdexcept>
+
+namespace
+{
+
+// What the generated code needs besides the program, in its own namespace.
+// Reads follow std::istream, which the interpreters read with: numbers in
+// decimal, bools as 0 or 1, strings up to a space, and every read after a
+// failed one gives 0, false or an empty string.
+const char* const c_runtime = R"(#include <cctype>
+#include <climits>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+namespace
+{
+
+char g_output[1 << 16];
+// a read failed, as the failbit of std::cin
+bool g_failed;
+
+void Fail(const char* message)
+{
+    std::fflush(stdout);
+    std::fprintf(stderr, "error: %s\n", message);
+    std::exit(EXIT_FAILURE);
+}
+
+// Arithmetic wraps around and division traps as in the interpreters.
+long long Add(long long lhs, long long rhs)
+{
+    return static_cast<long long>(static_cast<unsigned long long>(lhs) + static_cast<unsigned long long>(rhs));
+}
+
+long long Subtract(long long lhs, long long rhs)
+{
+    return static_cast<long long>(static_cast<unsigned long long>(lhs) - static_cast<unsigned long long>(rhs));
+}
+
+long long Multiply(long long lhs, long long rhs)
+{
+    return static_cast<long long>(static_cast<unsigned long long>(lhs) * static_cast<unsigned long long>(rhs));
+}
+
+long long Divide(long long lhs, long long rhs)
+{
+    if (rhs == 0 || (rhs == -1 && lhs == LLONG_MIN))
+    {
+        std::fflush(stdout);
+        std::raise(SIGFPE);
+    }
+    return lhs / rhs;
+}
+
+long long Negate(long long value)
+{
+    return static_cast<long long>(0 - static_cast<unsigned long long>(value));
+}
+
+int SkipSpace()
+{
+    std::fflush(stdout);
+    int c = std::getchar();
+    while (c != EOF && std::isspace(c))
+    {
+        c = std::getchar();
+    }
+    return c;
+}
+
+// 0 if there is no number, the nearest one if it does not fit
+long long ReadNumber()
+{
+    if (g_failed)
+    {
+        return 0;
+    }
+    int c = SkipSpace();
+    const bool negative = c == '-';
+    if (c == '-' || c == '+')
+    {
+        c = std::getchar();
+    }
+    const unsigned long long limit = negative ? 0ULL - LLONG_MIN : LLONG_MAX;
+    unsigned long long magnitude = 0;
+    bool digits = false;
+    for (; c >= '0' && c <= '9'; c = std::getchar())
+    {
+        const unsigned digit = c - '0';
+        if (magnitude > (limit - digit) / 10)
+        {
+            g_failed = true;
+            magnitude = limit;
+        }
+        else if (!g_failed)
+        {
+            magnitude = magnitude * 10 + digit;
+        }
+        digits = true;
+    }
+    if (c != EOF)
+    {
+        std::ungetc(c, stdin);
+    }
+    if (!digits)
+    {
+        g_failed = true;
+        return 0;
+    }
+    return negative ? static_cast<long long>(0 - magnitude) : static_cast<long long>(magnitude);
+}
+
+void Read(long long& value)
+{
+    value = ReadNumber();
+}
+
+void Read(bool& value)
+{
+    const auto number = ReadNumber();
+    if (number != 0 && number != 1)
+    {
+        g_failed = true;
+    }
+    value = number != 0;
+}
+
+void Read(std::string& value)
+{
+    value.clear();
+    if (g_failed)
+    {
+        return;
+    }
+    int c = SkipSpace();
+    if (c == EOF)
+    {
+        g_failed = true;
+        return;
+    }
+    for (; c != EOF && !std::isspace(c); c = std::getchar())
+    {
+        value += static_cast<char>(c);
+    }
+    if (c != EOF)
+    {
+        std::ungetc(c, stdin);
+    }
+}
+
+void Write(long long value)
+{
+    std::printf("%lld ", value);
+}
+
+void Write(bool value)
+{
+    std::fputs(value ? "true " : "false ", stdout);
+}
+
+void Write(const std::string& value)
+{
+    std::fwrite(value.data(), 1, value.size(), stdout);
+    std::putchar(' ');
+}
+
+}
+)";
+
+// Type of a register at an instruction: not written yet or one of ValueType.
+using RegisterType = int8_t;
+constexpr RegisterType c_unset = -1;
+
+bool IsJump(RegisterOp op)
+{
+    return op == RegisterOp::Jump || op == RegisterOp::JumpIfFalse || op >= RegisterOp::JumpUnlessLessInt;
+}
+
+// Whether the instruction writes register a, and the type it writes.
+bool Writes(const RegisterInstruction& instruction, const std::vector<RegisterType>& types, RegisterType& type)
+{
+    switch (instruction.op)
+    {
+    case RegisterOp::Move:
+        type = types[instruction.b];
+        return true;
+    case RegisterOp::AddInt:
+    case RegisterOp::SubtractInt:
+    case RegisterOp::MultiplyInt:
+    case RegisterOp::DivideInt:
+    case RegisterOp::NegateInt:
+    case RegisterOp::PlusInt:
+        type = static_cast<RegisterType>(ValueType::Int);
+        return true;
+    case RegisterOp::Concatenate:
+        type = static_cast<RegisterType>(ValueType::String);
+        return true;
+    case RegisterOp::LessInt:
+    case RegisterOp::GreaterInt:
+    case RegisterOp::NotLessInt:
+    case RegisterOp::NotGreaterInt:
+    case RegisterOp::EqualInt:
+    case RegisterOp::NotEqualInt:
+    case RegisterOp::LessString:
+    case RegisterOp::GreaterString:
+    case RegisterOp::NotLessString:
+    case RegisterOp::NotGreaterString:
+    case RegisterOp::EqualString:
+    case RegisterOp::NotEqualString:
+    case RegisterOp::Not:
+        type = static_cast<RegisterType>(ValueType::Bool);
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Instructions that some path from the start runs.
+std::vector<bool> FindReached(const RegisterCode& program)
+{
+    const auto& code = program.GetCode();
+    std::vector<bool> reached(code.size());
+    std::vector<size_t> work;
+    const auto reach = [&reached, &work](size_t target)
+    {
+        if (target < reached.size() && !reached[target])
+        {
+            reached[target] = true;
+            work.push_back(target);
+        }
+    };
+
+    reach(0);
+    while (!work.empty())
+    {
+        const auto i = work.back();
+        work.pop_back();
+        const auto& instruction = code[i];
+        if (IsJump(instruction.op))
+        {
+            reach(instruction.a);
+        }
+        if (instruction.op != RegisterOp::Jump && instruction.op != RegisterOp::Fail)
+        {
+            reach(i + 1);
+        }
+    }
+    return reached;
+}
+
+const char* GetTypeName(RegisterType type)
+{
+    switch (static_cast<ValueType>(type))
+    {
+    case ValueType::Bool:
+        return "bool";
+    case ValueType::Int:
+        return "long long";
+    default:
+        return "std::string";
+    }
+}
+
+void WriteLiteral(std::ostream& os, const TaggedValue& value)
+{
+    switch (value.GetType())
+    {
+    case ValueType::Bool:
+        os << (value.GetBool() ? "true" : "false");
+        break;
+
+    case ValueType::Int:
+        if (value.GetInt() == LLONG_MIN)
+        {
+            os << "LLONG_MIN";
+        }
+        else
+        {
+            os << value.GetInt() << "LL";
+        }
+        break;
+
+    case ValueType::String:
+    {
+        os << '"';
+        for (const char c: value.GetString())
+        {
+            if (c == '"' || c == '\\')
+            {
+                os << '\\' << c;
+            }
+            else if (c >= ' ' && c <= '~' && c != '?')
+            {
+                os << c;
+            }
+            else
+            {
+                // octal, which unlike hex takes at most three digits
+                const auto byte = static_cast<unsigned char>(c);
+                os << '\\' << static_cast<char>('0' + (byte >> 6)) << static_cast<char>('0' + (byte >> 3 & 7))
+                   << static_cast<char>('0' + (byte & 7));
+            }
+        }
+        os << '"';
+        break;
+    }
+    }
+}
+
+class Writer
+{
+public:
+    Writer(const RegisterCode& program, const std::vector<TaggedValue>& variables,
+           const std::vector<std::string>& names, std::ostream& os)
+        : m_program{program}
+        , m_variables{variables}
+        , m_names{names}
+        , m_os{os}
+        , m_reached{FindReached(program)}
+        , m_temporaries(program.GetFrameSize())
+    {
+    }
+
+    void Run()
+    {
+        const auto& code = m_program.GetCode();
+        // labels and the temporaries of each type first, so that the
+        // declarations come before any goto
+        std::vector<bool> targets(code.size() + 1);
+        Start();
+        for (size_t i = 0; i < code.size(); ++i)
+        {
+            if (!m_reached[i])
+            {
+                continue;
+            }
+            const auto& instruction = code[i];
+            if (IsJump(instruction.op))
+            {
+                targets[instruction.a] = true;
+            }
+            RegisterType type;
+            if (Writes(instruction, m_types, type) && IsTemporary(instruction.a))
+            {
+                m_temporaries[instruction.a] |= 1 << Check(type);
+            }
+            Advance(i);
+        }
+
+        m_os << "// Generated by aot. Each statement is an instruction of `poliz --registers`.\n"
+             << c_runtime << "\nint main()\n{\n"
+             << "    std::setvbuf(stdout, g_output, _IOFBF, sizeof(g_output));\n";
+        for (size_t r = 0; r < m_variables.size(); ++r)
+        {
+            m_os << "    " << GetTypeName(static_cast<RegisterType>(m_variables[r].GetType())) << ' ' << 'v' << r
+                 << " = ";
+            WriteLiteral(m_os, m_variables[r]);
+            m_os << ";";
+            if (r < m_names.size())
+            {
+                m_os << " // " << m_names[r];
+            }
+            m_os << '\n';
+        }
+        const auto& constants = m_program.GetConstants();
+        for (size_t k = 0; k < constants.size(); ++k)
+        {
+            m_os << "    const " << GetTypeName(static_cast<RegisterType>(constants[k].GetType())) << " c" << k
+                 << " = ";
+            WriteLiteral(m_os, constants[k]);
+            m_os << ";\n";
+        }
+        for (size_t r = 0; r < m_temporaries.size(); ++r)
+        {
+            for (RegisterType type = 0; type <= static_cast<RegisterType>(ValueType::String); ++type)
+            {
+                if (m_temporaries[r] & 1 << type)
+                {
+                    m_os << "    " << GetTypeName(type) << ' ' << GetName(r, type) << "{};\n";
+                }
+            }
+        }
+
+        Start();
+        for (size_t i = 0; i < code.size(); ++i)
+        {
+            if (targets[i])
+            {
+                m_os << "L" << i << ":\n";
+            }
+            if (m_reached[i])
+            {
+                WriteInstruction(i);
+                Advance(i);
+            }
+        }
+        if (targets[code.size()])
+        {
+            m_os << "L" << code.size() << ":\n";
+        }
+        m_os << "    return EXIT_SUCCESS;\n}\n";
+    }
+
+private:
+    // Types of the registers before the first instruction. Variables and
+    // constants keep theirs.
+    void Start()
+    {
+        m_types.assign(m_program.GetFrameSize(), c_unset);
+        for (size_t i = 0; i < m_variables.size(); ++i)
+        {
+            m_types[i] = static_cast<RegisterType>(m_variables[i].GetType());
+        }
+        const auto& constants = m_program.GetConstants();
+        for (size_t i = 0; i < constants.size(); ++i)
+        {
+            m_types[m_variables.size() + i] = static_cast<RegisterType>(constants[i].GetType());
+        }
+    }
+
+    // Types of the registers after instruction i. A temporary takes the
+    // type last written to it in the order of the code: the parser has
+    // checked that the operands where paths meet have one type, and a
+    // temporary is written on every path into a meeting before it is read
+    // after it, so one running set of types serves the whole program.
+    void Advance(size_t i)
+    {
+        const auto& instruction = m_program.GetCode()[i];
+        RegisterType type;
+        if (Writes(instruction, m_types, type))
+        {
+            m_types[instruction.a] = type;
+        }
+    }
+
+    bool IsTemporary(uint32_t r) const
+    {
+        return r >= m_variables.size() + m_program.GetConstants().size();
+    }
+
+    RegisterType Check(RegisterType type) const
+    {
+        if (type == c_unset)
+        {
+            throw std::runtime_error("register of unknown type");
+        }
+        return type;
+    }
+
+    std::string GetName(uint32_t r, RegisterType type) const
+    {
+        if (r < m_variables.size())
+        {
+            return "v" + std::to_string(r);
+        }
+        if (!IsTemporary(r))
+        {
+            return "c" + std::to_string(r - m_variables.size());
+        }
+        static const char suffixes[] = {'b', 'i', 's'};
+        return "t" + std::to_string(r - m_variables.size() - m_program.GetConstants().size()) + "_"
+            + suffixes[type];
+    }
+
+    // Name of register r as read by the instruction being written.
+    std::string Get(uint32_t r) const
+    {
+        return GetName(r, Check(m_types[r]));
+    }
+
+    void WriteInstruction(size_t i)
+    {
+        const auto& instruction = m_program.GetCode()[i];
+        // from AddInt to NotEqualString
+        static const char* const c_operators[] = {
+            "Add", "Subtract", "Multiply", "Divide", "<", ">", ">=", "<=", "==", "!=",
+            "+", "<", ">", ">=", "<=", "==", "!=",
+        };
+        const auto operator_ = [&instruction]
+        {
+            const auto op = static_cast<size_t>(instruction.op);
+            if (instruction.op >= RegisterOp::JumpUnlessLessInt)
+            {
+                return c_operators[op - static_cast<size_t>(RegisterOp::JumpUnlessLessInt)
+                                   + static_cast<size_t>(RegisterOp::LessInt) - static_cast<size_t>(RegisterOp::AddInt)];
+            }
+            return c_operators[op - static_cast<size_t>(RegisterOp::AddInt)];
+        };
+        const auto destination = [this, &instruction]
+        {
+            RegisterType type;
+            Writes(instruction, m_types, type);
+            return GetName(instruction.a, Check(type));
+        };
+
+        m_os << "    ";
+        switch (instruction.op)
+        {
+        case RegisterOp::Move:
+        case RegisterOp::PlusInt:
+            m_os << destination() << " = " << Get(instruction.b) << ";\n";
+            break;
+
+        case RegisterOp::Read:
+            m_os << "Read(" << Get(instruction.a) << ");\n";
+            break;
+
+        case RegisterOp::Write:
+            for (uint32_t k = 0; k < instruction.b; ++k)
+            {
+                m_os << "Write(" << Get(m_program.GetOperands()[instruction.a + k]) << "); ";
+            }
+            m_os << "std::putchar('\\n');\n";
+            break;
+
+        case RegisterOp::Jump:
+            m_os << "goto L" << instruction.a << ";\n";
+            break;
+
+        case RegisterOp::JumpIfFalse:
+            m_os << "if (!" << Get(instruction.b) << ") goto L" << instruction.a << ";\n";
+            break;
+
+        case RegisterOp::Fail:
+            m_os << "Fail(\"" << GetErrorMessage(instruction.a) << "\");\n";
+            break;
+
+        case RegisterOp::AddInt:
+        case RegisterOp::SubtractInt:
+        case RegisterOp::MultiplyInt:
+        case RegisterOp::DivideInt:
+            m_os << destination() << " = " << operator_() << '(' << Get(instruction.b) << ", "
+                 << Get(instruction.c) << ");\n";
+            break;
+
+        case RegisterOp::Not:
+            m_os << destination() << " = !" << Get(instruction.b) << ";\n";
+            break;
+
+        case RegisterOp::NegateInt:
+            m_os << destination() << " = Negate(" << Get(instruction.b) << ");\n";
+            break;
+
+        default:
+            if (instruction.op >= RegisterOp::JumpUnlessLessInt)
+            {
+                m_os << "if (!(" << Get(instruction.b) << ' ' << operator_()
+                     << ' ' << Get(instruction.c) << ")) goto L" << instruction.a << ";\n";
+            }
+            else
+            {
+                m_os << destination() << " = " << Get(instruction.b) << ' ' << operator_()
+                     << ' ' << Get(instruction.c) << ";\n";
+            }
+            break;
+        }
+    }
+
+    const RegisterCode& m_program;
+    const std::vector<TaggedValue>& m_variables;
+    const std::vector<std::string>& m_names;
+    std::ostream& m_os;
+    std::vector<bool> m_reached;
+    // of the registers before the instruction being looked at
+    std::vector<RegisterType> m_types;
+    // bit per type a temporary is written with
+    std::vector<uint8_t> m_temporaries;
+};
+
+}
+
+void Transpile(const RegisterCode& program, const std::vector<TaggedValue>& variables,
+               const std::vector<std::string>& names, std::ostream& os)
+{
+    Writer{program, variables, names, os}.Run();
+}
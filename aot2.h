@@ -0,0 +1,15 @@
+#pragma once
+#include "registers2.h"
+#include "value2.h"
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Writes a program lowered to registers as a standalone C++ translation
+// unit that runs as `int` does, for `aot PROGRAM > program.cpp` and any C++
+// compiler. Variables and the temporaries of each type become locals,
+// jumps become gotos and write() goes through buffered stdio. `names` are
+// the names of the variables, for comments. Throws if a register is read
+// where its type depends on the path taken to it.
+void Transpile(const RegisterCode& program, const std::vector<TaggedValue>& variables,
+               const std::vector<std::string>& names, std::ostream& os);
@@ -0,0 +1,1453 @@
+#include <iostream>
+#include <sstream>
+#include <chrono>
+#include <ctime>
+#include <functional>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <memory_resource>
+#include <filesystem>
+#include <fstream>
+#include <csignal>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "lexical2.h"
+#include "keywords2.h"
+#include "skip2.h"
+#include "symbols2.h"
+#include "tokens2.h"
+#include "threads2.h"
+#include "syntax2.h"
+#include "poliz2.h"
+#include "source2.h"
+#include "cache2.h"
+#include "server2.h"
+#include "incremental2.h"
+#include "stream2.h"
+#include "value2.h"
+#include "registers2.h"
+#include "jit2.h"
+#include "aot2.h"
+#include <random>
+#include <tuple>
+
+// Microbenchmarks of the interpreter pipeline, run as `bench <name> [scale]`.
+
+class Stopwatch
+{
+public:
+    double Seconds() const
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+    }
+
+private:
+    std::chrono::steady_clock::time_point m_start{std::chrono::steady_clock::now()};
+};
+
+// Processor time of this process, for runs long enough that a busy machine
+// skews wall time.
+class CpuStopwatch
+{
+public:
+    double Seconds() const
+    {
+        return static_cast<double>(std::clock() - m_start) / CLOCKS_PER_SEC;
+    }
+
+private:
+    std::clock_t m_start{std::clock()};
+};
+
+// Keeps measured results alive so the optimizer cannot drop the loops.
+static volatile size_t g_sink;
+
+// Every allocation of the process goes through these.
+static std::atomic<size_t> g_allocations;
+static std::atomic<size_t> g_allocatedBytes;
+
+void* operator new(size_t size)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    g_allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    if (const auto p = std::malloc(size ? size : 1))
+    {
+        return p;
+    }
+    throw std::bad_alloc{};
+}
+
+// std::pmr::new_delete_resource() asks for an alignment
+void* operator new(size_t size, std::align_val_t align)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    g_allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    const auto alignment = static_cast<size_t>(align);
+    if (const auto p = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment))
+    {
+        return p;
+    }
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, size_t, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+// Set by the benchmarks that check their results when one is wrong.
+static bool g_failed{false};
+
+static void Report(const char* name, double count, const char* unit, double seconds)
+{
+    std::cout << name << ": " << count / seconds / 1e6 << " M" << unit << "/s"
+              << " (" << seconds * 1e3 << " ms)" << std::endl;
+}
+
+// Keyword lookup as it was done before the perfect hash table: one compare
+// per keyword until a match.
+static LexemeType ClassifyLinear(std::string_view word)
+{
+    const char* words[] = {"program", "int", "string", "boolean", "true", "false", "if",
+                           "else", "while", "not", "read", "write", "and", "or", "break"};
+    for (size_t i = 0; i < std::size(words); ++i)
+    {
+        if (word == words[i])
+        {
+            return c_keywords[i].type;
+        }
+    }
+    return LexemeType::Identifier;
+}
+
+static LexemeType ClassifyTable(std::string_view word)
+{
+    const auto index = c_keywordTable.Find(word);
+    return index == KeywordTable::c_empty ? LexemeType::Identifier : c_keywords[index].type;
+}
+
+static std::string GenerateWords(size_t count, bool keywords)
+{
+    const char* identifiers[] = {"counter", "i", "value", "total", "x1", "result", "idx",
+                                 "buffer", "ab", "temporary", "n", "sum", "whilst", "iffy"};
+    std::string text;
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (keywords)
+        {
+            text += c_keywords[(i * 7) % c_keywords.size()].word;
+        }
+        else
+        {
+            text += identifiers[(i * 5) % std::size(identifiers)];
+        }
+        text += (i % 16 == 15) ? '\n' : ' ';
+    }
+    return text + ";";
+}
+
+static void BenchLexer(size_t scale)
+{
+    for (const bool keywords: {true, false})
+    {
+        const auto source = GenerateWords(scale, keywords);
+        std::cout << (keywords ? "keyword-heavy" : "identifier-heavy") << " input, "
+                  << scale << " words" << std::endl;
+
+        std::vector<std::string_view> words;
+        for (size_t pos = 0; pos < source.size();)
+        {
+            const auto end = source.find_first_of(" \n;", pos);
+            words.push_back(std::string_view{source}.substr(pos, end - pos));
+            pos = end + 1;
+        }
+
+        for (const auto& [name, classify]: {
+                 std::pair{"  classify, linear compares", &ClassifyLinear},
+                 std::pair{"  classify, perfect hash   ", &ClassifyTable}})
+        {
+            size_t keywordCount{};
+            Stopwatch watch;
+            for (const auto& word: words)
+            {
+                keywordCount += classify(word) != LexemeType::Identifier;
+            }
+            Report(name, words.size(), "words", watch.Seconds());
+            g_sink = keywordCount;
+        }
+
+        {
+            SymbolTable symbols;
+            Scanner scanner(source, symbols);
+            size_t tokens{};
+            Stopwatch watch;
+            while (scanner.GetLexeme().type != LexemeType::Eof)
+            {
+                tokens += 1;
+            }
+            Report("  scanner, buffer           ", tokens, "tokens", watch.Seconds());
+        }
+        {
+            std::istringstream input{source};
+            SymbolTable symbols;
+            Scanner scanner(input, symbols);
+            size_t tokens{};
+            Stopwatch watch;
+            while (scanner.GetLexeme().type != LexemeType::Eof)
+            {
+                tokens += 1;
+            }
+            Report("  scanner, istream          ", tokens, "tokens", watch.Seconds());
+        }
+    }
+}
+
+// Generated programs with large comment banners, indentation and long strings.
+static std::string GenerateBanners(size_t count)
+{
+    const std::string banner = "/" + std::string(78, '*') + "\n"
+        + " * generated section, do not edit" + std::string(40, ' ') + "\n"
+        + " " + std::string(77, '*') + "/\n";
+    const std::string text = "\"" + std::string(120, 'x') + "\n" + std::string(60, 'y') + "\"";
+    std::string source;
+    for (size_t i = 0; i < count; ++i)
+    {
+        source += banner;
+        source += "        write(" + text + ");\n\n";
+    }
+    return source;
+}
+
+static void BenchSkip(size_t scale)
+{
+    const auto source = GenerateBanners(scale / 10);
+    std::cout << "comment and string heavy input, " << source.size() / 1e6 << " MB" << std::endl;
+    for (const auto kernel: {SkipKernel::Scalar, SkipKernel::Sse2, SkipKernel::Avx2})
+    {
+        if (!SetSkipKernel(kernel))
+        {
+            continue;
+        }
+        SymbolTable symbols;
+        Scanner scanner(source, symbols);
+        Stopwatch watch;
+        while (scanner.GetLexeme().type != LexemeType::Eof)
+        {
+        }
+        const auto name = std::string{"  "} + GetSkipKernels().name;
+        Report(name.c_str(), source.size(), "B", watch.Seconds());
+        g_sink = scanner.GetCurrentLine();
+    }
+    SetSkipKernel(SkipKernel::Auto);
+}
+
+// A valid program of roughly `statements` statements with loops, strings
+// and comments, as our generators emit them.
+static std::string GenerateProgram(size_t statements)
+{
+    std::string source = "program\n{\n    int i = 0, total = 0, limit = 3;\n    string s = \"\";\n";
+    for (size_t i = 0; i < statements / 8; ++i)
+    {
+        source +=
+            "    /* block " + std::to_string(i) + " */\n"
+            "    i = 0;\n"
+            "    while (i < limit)\n"
+            "    {\n"
+            "        total = total + i * 2 - (i + 1) / 3;\n"
+            "        if (total > 1000 or i == 7)\n"
+            "            total = total - 1000;\n"
+            "        i = i + 1;\n"
+            "    }\n"
+            "    s = \"step " + std::to_string(i % 100) + "\";\n";
+    }
+    return source + "    write(total, s);\n}\n";
+}
+
+static void BenchTokenize(size_t scale)
+{
+    const auto source = GenerateProgram(scale / 4);
+    std::cout << "program of " << source.size() / 1e6 << " MB, "
+              << std::thread::hardware_concurrency() << " hardware threads" << std::endl;
+
+    SymbolTable serialSymbols;
+    Scanner scanner(source, serialSymbols);
+    Stopwatch watch;
+    const auto serial = Tokenize(scanner);
+    Report("  serial     ", source.size(), "B", watch.Seconds());
+
+    for (const size_t threads: {2, 4, 8})
+    {
+        ThreadPool pool(threads);
+        SymbolTable symbols;
+        Stopwatch watch;
+        const auto parallel = TokenizeParallel(source, symbols, pool);
+        const auto name = "  " + std::to_string(threads) + " threads  ";
+        Report(name.c_str(), source.size(), "B", watch.Seconds());
+        if (parallel.tokens.size() != serial.tokens.size()
+            || parallel.strings.size() != serial.strings.size()
+            || parallel.tokens.back().line != serial.tokens.back().line)
+        {
+            std::cout << "  token streams differ!" << std::endl;
+        }
+    }
+}
+
+static void BenchParse(size_t scale)
+{
+    const auto source = GenerateProgram(scale);
+    std::cout << "program of " << source.size() / 1e6 << " MB" << std::endl;
+
+    for (int round = 0; round < 3; ++round)
+    {
+        SymbolTable symbols;
+        Scanner scanner(source, symbols);
+        Stopwatch lexing;
+        auto tokens = Tokenize(scanner);
+        const auto lexSeconds = lexing.Seconds();
+
+        Poliz poliz;
+        Parser parser(std::move(tokens), symbols, poliz);
+        Stopwatch parsing;
+        parser.Analize();
+        const auto parseSeconds = parsing.Seconds();
+
+        SymbolTable scannerSymbols;
+        Scanner pullScanner(source, scannerSymbols);
+        Poliz scannerPoliz;
+        Stopwatch compiling;
+        Parser scannerParser(pullScanner, scannerPoliz);
+        scannerParser.Analize();
+        const auto compileSeconds = compiling.Seconds();
+
+        std::cout << "  lex " << lexSeconds * 1e3 << " ms, parse " << parseSeconds * 1e3
+                  << " ms, lex + parse from scanner " << compileSeconds * 1e3 << " ms, "
+                  << poliz.GetProgram().size() << " instructions" << std::endl;
+    }
+}
+
+// Starts `program` with `args`, `input` as stdin and stdout to `output`,
+// returns its pid.
+static pid_t Spawn(const std::string& program, const std::vector<std::string>& args,
+                   const std::string& input = "/dev/null", const std::string& output = "/dev/null")
+{
+    const auto pid = ::fork();
+    if (pid == 0)
+    {
+        std::freopen(output.c_str(), "w", stdout);
+        std::freopen(input.c_str(), "r", stdin);
+        std::vector<char*> argv{const_cast<char*>(program.c_str())};
+        for (const auto& arg: args)
+        {
+            argv.push_back(const_cast<char*>(arg.c_str()));
+        }
+        argv.push_back(nullptr);
+        ::execv(program.c_str(), argv.data());
+        std::_Exit(127);
+    }
+    return pid;
+}
+
+// Machine generated expressions nested `depth` levels deep, each of which
+// adds up to `depth` when run.
+static std::vector<std::pair<const char*, std::string>> GenerateNested(size_t depth)
+{
+    std::vector<std::pair<const char*, std::string>> cases;
+    cases.emplace_back("parentheses", std::string(depth, '(') + std::to_string(depth) + std::string(depth, ')'));
+
+    std::string sum;
+    for (size_t i = 1; i < depth; ++i)
+    {
+        sum += "1 + (";
+    }
+    cases.emplace_back("right nested sums", sum + "1" + std::string(depth - 1, ')'));
+
+    std::string negations;
+    for (size_t i = 0; i < depth; ++i)
+    {
+        negations += "-(";
+    }
+    // an even depth makes the negations cancel out
+    cases.emplace_back("unary minus", negations + std::to_string(depth) + std::string(depth, ')'));
+
+    std::string assignments;
+    for (size_t i = 0; i < depth; ++i)
+    {
+        assignments += "x = ";
+    }
+    cases.emplace_back("assignment chain", assignments + std::to_string(depth));
+    return cases;
+}
+
+static void BenchNesting(size_t scale)
+{
+    const size_t depth = std::max<size_t>(scale / 10 / 2 * 2, 2);
+    std::cout << "expressions nested " << depth << " levels deep" << std::endl;
+    for (const auto& [name, expression]: GenerateNested(depth))
+    {
+        const auto source = "program { int x; x = " + expression + "; write(x); }";
+        SymbolTable symbols;
+        Scanner scanner(source, symbols);
+        auto tokens = Tokenize(scanner);
+
+        Poliz poliz;
+        Parser parser(std::move(tokens), symbols, poliz);
+        Stopwatch watch;
+        parser.Analize();
+        const auto seconds = watch.Seconds();
+
+        std::cout << "  " << name << ", " << poliz.GetProgram().size() << " instructions in "
+                  << seconds * 1e3 << " ms, prints ";
+        poliz.CreateInterpreter().Run(false);
+    }
+
+    // The same programs through int itself, which verifies the bytecode
+    // before it runs it, with the JIT and without.
+    constexpr double c_limit = 60;
+    const auto binaries = std::filesystem::read_symlink("/proc/self/exe").parent_path();
+    const auto interpreter = (binaries / "int").string();
+    const auto directory = std::filesystem::temp_directory_path();
+    const auto path = (directory / ("bench-nesting-" + std::to_string(::getpid()) + ".txt")).string();
+    const auto outputPath = path + ".out";
+    const auto expected = std::to_string(depth) + " \n";
+    for (const auto& [name, expression]: GenerateNested(depth))
+    {
+        std::ofstream(path) << "program { int x; x = " << expression << "; write(x); }";
+        for (const auto& options: {std::vector<std::string>{}, std::vector<std::string>{"--no-jit"}})
+        {
+            auto args = options;
+            args.push_back(path);
+            Stopwatch watch;
+            const auto pid = Spawn(interpreter, args, "/dev/null", outputPath);
+            int status{};
+            while (::waitpid(pid, &status, WNOHANG) == 0)
+            {
+                if (watch.Seconds() > c_limit)
+                {
+                    ::kill(pid, SIGKILL);
+                    ::waitpid(pid, &status, 0);
+                    break;
+                }
+                ::usleep(1000);
+            }
+            const auto seconds = watch.Seconds();
+            std::ifstream file(outputPath);
+            const std::string output{std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+            const bool passed = WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS && output == expected;
+            g_failed = g_failed || !passed;
+            std::cout << "  int" << (options.empty() ? "" : " " + options.front()) << ", " << name << ": "
+                      << seconds * 1e3 << " ms" << (passed ? "" : ", output differs!") << std::endl;
+        }
+    }
+    std::filesystem::remove(path);
+    std::filesystem::remove(outputPath);
+}
+
+// Many long names and string literals, none of which fit std::string's
+// inline buffer.
+static std::string GenerateDeclarations(size_t count)
+{
+    std::string source = "program\n{\n";
+    for (size_t i = 0; i < count; ++i)
+    {
+        const auto name = "generatedVariable" + std::to_string(i);
+        source += "    string " + name + " = \"initial value of " + name + "\";\n";
+    }
+    source += "    string message;\n";
+    for (size_t i = 0; i < count; ++i)
+    {
+        source += "    message = \"assigned from statement " + std::to_string(i) + "\";\n";
+    }
+    return source + "    write(message);\n}\n";
+}
+
+static void BenchArena(size_t scale)
+{
+    for (const auto& [name, source]: {
+             std::pair{"expressions and loops", GenerateProgram(scale / 4)},
+             std::pair{"long names and strings", GenerateDeclarations(scale / 20)}})
+    {
+        std::cout << name << ", " << source.size() / 1e6 << " MB" << std::endl;
+        for (const bool useArena: {false, true})
+        {
+            const size_t allocations = g_allocations;
+            const size_t bytes = g_allocatedBytes;
+            Poliz poliz;
+            Stopwatch watch;
+            {
+                std::pmr::monotonic_buffer_resource arena;
+                const auto resource = useArena ? &arena : std::pmr::new_delete_resource();
+                SymbolTable symbols{resource};
+                Scanner scanner(source, symbols);
+                Parser parser(Tokenize(scanner, resource), symbols, poliz);
+                parser.Analize();
+            }
+            const auto seconds = watch.Seconds();
+            std::cout << (useArena ? "  arena" : "  heap ") << ": "
+                      << g_allocations - allocations << " allocations of "
+                      << (g_allocatedBytes - bytes) / 1e6 << " MB, compile and free "
+                      << seconds * 1e3 << " ms, " << poliz.GetProgram().size() << " instructions"
+                      << std::endl;
+        }
+    }
+}
+
+// Time from reading the source file to an interpreter ready to run, as int
+// does it without a cache, on a cache miss and on a cache hit.
+static double StartUp(const std::string& path, const std::string& cachePath, bool cache)
+{
+    Stopwatch watch;
+    SourceBuffer source(path.c_str());
+    const auto key = cache ? GetCacheKey(source.GetView()) : CacheKey{};
+    Poliz poliz;
+    if (!cache || !LoadCache(cachePath, key, poliz))
+    {
+        Compile(source.GetView(), poliz);
+        if (cache)
+        {
+            SaveCache(cachePath, key, poliz);
+        }
+    }
+    auto interpreter = poliz.CreateInterpreter();
+    return watch.Seconds();
+}
+
+static void BenchCache(size_t scale)
+{
+    const auto directory = std::filesystem::temp_directory_path();
+    const auto path = (directory / ("bench-cache-" + std::to_string(::getpid()) + ".txt")).string();
+    const auto cachePath = path + ".polizc";
+    for (const size_t statements: {scale / 10000, scale / 100, scale})
+    {
+        std::ofstream(path) << GenerateProgram(statements);
+        std::filesystem::remove(cachePath);
+
+        const auto compile = StartUp(path, cachePath, false);
+        const auto cold = StartUp(path, cachePath, true);
+        auto warm = StartUp(path, cachePath, true);
+        for (int round = 0; round < 4; ++round)
+        {
+            warm = std::min(warm, StartUp(path, cachePath, true));
+        }
+        std::cout << "program of " << std::filesystem::file_size(path) / 1e3 << " KB, cache of "
+                  << std::filesystem::file_size(cachePath) / 1e3 << " KB: no cache "
+                  << compile * 1e3 << " ms, cold " << cold * 1e3 << " ms, warm "
+                  << warm * 1e3 << " ms" << std::endl;
+    }
+    std::filesystem::remove(path);
+    std::filesystem::remove(cachePath);
+}
+
+// Per request cost of a short script: a fresh int process each time against
+// a resident `int --serve` that has the program compiled already.
+static void BenchDaemon(size_t scale)
+{
+    const auto binaries = std::filesystem::read_symlink("/proc/self/exe").parent_path();
+    const auto interpreter = (binaries / "int").string();
+    const auto directory = std::filesystem::temp_directory_path();
+    const auto path = (directory / ("bench-daemon-" + std::to_string(::getpid()) + ".txt")).string();
+    const auto socketPath = path + ".sock";
+    const std::string source = GenerateProgram(80);
+    std::ofstream(path) << source;
+    const size_t requests = std::max<size_t>(scale / 5000, 10);
+    std::cout << "program of " << source.size() / 1e3 << " KB, " << requests << " requests" << std::endl;
+
+    {
+        Stopwatch watch;
+        for (size_t i = 0; i < requests; ++i)
+        {
+            int status{};
+            ::waitpid(Spawn(interpreter, {path}), &status, 0);
+        }
+        std::cout << "  fork/exec int       : " << watch.Seconds() / requests * 1e6
+                  << " us per request" << std::endl;
+    }
+
+    const auto server = Spawn(interpreter, {"--serve=" + socketPath, "--workers=2"});
+    for (int attempt = 0; attempt < 100 && !std::filesystem::exists(socketPath); ++attempt)
+    {
+        ::usleep(10000);
+    }
+    for (const auto kind: {Request::Text, Request::Path})
+    {
+        const Request request{kind, kind == Request::Text ? source : path, {}};
+        std::ostringstream output;
+        std::ostringstream errors;
+        SendRequest(socketPath.c_str(), request, output, errors);
+
+        Stopwatch watch;
+        for (size_t i = 0; i < requests; ++i)
+        {
+            SendRequest(socketPath.c_str(), request, output, errors);
+        }
+        std::cout << (kind == Request::Text ? "  daemon, program text" : "  daemon, program path")
+                  << ": " << watch.Seconds() / requests * 1e6 << " us per request" << std::endl;
+    }
+    ::kill(server, SIGTERM);
+    ::waitpid(server, nullptr, 0);
+    std::filesystem::remove(path);
+    std::filesystem::remove(socketPath);
+}
+
+// Instructions with their constants and with the lexeme positions jumps go
+// to. Constants are numbered in the order they were first added, so after
+// edits they differ, and so do operand sizes and code offsets.
+static void DescribeCode(std::ostream& out, const Bytecode& code)
+{
+    for (size_t offset = 0; offset < code.GetCode().size(); )
+    {
+        offset = code.Print(out, offset, true);
+        out << ';';
+    }
+    out << '\n';
+}
+
+// Compiles `source` in full as the reference for IncrementalCompiler. The
+// result is the error text, or the program, variables and symbol names.
+static std::string Describe(std::string_view source)
+{
+    std::ostringstream out;
+    try
+    {
+        SymbolTable symbols;
+        Scanner scanner(source, symbols);
+        Poliz poliz;
+        Parser parser(Tokenize(scanner), symbols, poliz);
+        parser.Analize();
+        for (SymbolId id = 0; id < symbols.GetSize(); ++id)
+        {
+            out << symbols.GetName(id) << ' ';
+        }
+        out << '\n';
+        for (const auto& lexeme: poliz.GetProgram())
+        {
+            out << lexeme << ' ';
+        }
+        out << '\n';
+        DescribeCode(out, poliz.GetBytecode());
+        const auto& variables = poliz.GetVariables();
+        for (size_t slot = 0; slot < variables.size(); ++slot)
+        {
+            out << poliz.GetIdentifiers()[slot] << '=' << Lexeme{LexemeType::Literal, variables[slot].ToValue()} << ' ';
+        }
+    }
+    catch (const lexical_exception& e)
+    {
+        out << "error: " << e.what() << ' ' << e.DebugInfo();
+    }
+    catch (const syntax_exception& e)
+    {
+        out << "error: " << e.what() << ' ' << e.DebugInfo();
+    }
+    return out.str();
+}
+
+static std::string Describe(const IncrementalCompiler& compiler)
+{
+    std::ostringstream out;
+    const auto& symbols = compiler.GetSymbols();
+    for (SymbolId id = 0; id < symbols.GetSize(); ++id)
+    {
+        out << symbols.GetName(id) << ' ';
+    }
+    out << '\n';
+    const auto& poliz = compiler.GetPoliz();
+    for (const auto& lexeme: poliz.GetProgram())
+    {
+        out << lexeme << ' ';
+    }
+    out << '\n';
+    DescribeCode(out, poliz.GetBytecode());
+    const auto& variables = poliz.GetVariables();
+    for (size_t slot = 0; slot < variables.size(); ++slot)
+    {
+        out << poliz.GetIdentifiers()[slot] << '=' << Lexeme{LexemeType::Literal, variables[slot].ToValue()} << ' ';
+    }
+    return out.str();
+}
+
+// Applies an edit, returns what Describe() would give for the new source
+// and adds the time the edit took to `seconds`.
+static std::string ApplyEdit(IncrementalCompiler& compiler, size_t offset, size_t length, std::string_view text,
+                             double& seconds)
+{
+    Stopwatch watch;
+    try
+    {
+        compiler.Edit(offset, length, text);
+        seconds += watch.Seconds();
+        return Describe(compiler);
+    }
+    catch (const lexical_exception& e)
+    {
+        seconds += watch.Seconds();
+        return std::string{"error: "} + e.what() + ' ' + e.DebugInfo();
+    }
+    catch (const syntax_exception& e)
+    {
+        seconds += watch.Seconds();
+        return std::string{"error: "} + e.what() + ' ' + e.DebugInfo();
+    }
+}
+
+// Random edits of a program, the way one is typed: each result is checked
+// against a full compile of the edited text, and edits that break the
+// program are undone again.
+static void BenchIncremental(size_t scale)
+{
+    IncrementalCompiler compiler{GenerateProgram(scale / 40)};
+    std::cout << "program of " << compiler.GetSource().size() / 1e3 << " KB" << std::endl;
+
+    std::mt19937 random{11};
+    const auto pick = [&random](size_t size) { return std::uniform_int_distribution<size_t>{0, size - 1}(random); };
+    // somewhere in the text, at the first `what` from there on
+    const auto find = [&](std::string_view what)
+    {
+        const auto& source = compiler.GetSource();
+        const auto position = source.find_first_of(what, pick(source.size()));
+        return position == std::string::npos ? source.find_first_of(what) : position;
+    };
+    const std::string statements[] = {
+        "    total = total + 1;\n",
+        "    if (i > 2) write(i); else { s = s + \"x\"; }\n",
+        "    while (i < 3) i = i + 1;\n",
+        "    write(fresh);\n",
+    };
+
+    size_t edits{0};
+    size_t mismatches{0};
+    size_t broken{0};
+    double editSeconds{0};
+    double partialSeconds{0};
+    double compileSeconds{0};
+    const auto check = [&](size_t offset, size_t length, std::string_view text)
+    {
+        const auto partial = compiler.GetPartialEdits();
+        double seconds{0};
+        const auto result = ApplyEdit(compiler, offset, length, text, seconds);
+        editSeconds += seconds;
+        partialSeconds += compiler.GetPartialEdits() != partial ? seconds : 0;
+        const auto expected = Describe(compiler.GetSource());
+        Poliz poliz;
+        Stopwatch compile;
+        try
+        {
+            Compile(compiler.GetSource(), poliz);
+        }
+        catch (const std::exception&)
+        {
+        }
+        compileSeconds += compile.Seconds();
+        edits += 1;
+        if (result != expected)
+        {
+            mismatches += 1;
+            std::cout << "  mismatch after replacing " << length << " bytes at " << offset
+                      << " with \"" << text << "\"" << std::endl;
+        }
+        return result.compare(0, 6, "error:") != 0;
+    };
+
+    for (int round = 0; round < 200; ++round)
+    {
+        const auto& source = compiler.GetSource();
+        size_t offset{};
+        size_t length{};
+        std::string text;
+        switch (pick(6))
+        {
+        case 0:
+            offset = find("0123456789");
+            length = 1;
+            text = std::to_string(pick(1000));
+            break;
+        case 1:
+            offset = find("+-<>");
+            length = 1;
+            text = std::string(1, "+-<>"[pick(4)]);
+            break;
+        case 2:
+            offset = find("\n") + 1;
+            text = statements[pick(std::size(statements))];
+            break;
+        case 3:
+            // a whole simple statement; an unbalanced '}' would end the
+            // program early and leave the rest as ignored text
+            offset = source.rfind('\n', find(";")) + 1;
+            length = source.find('\n', offset) + 1 - offset;
+            break;
+        case 4:
+            offset = source.find(";\n") + 2;
+            text = "    int fresh" + std::to_string(round) + " = 1;\n";
+            break;
+        default:
+            offset = pick(source.size());
+            text = std::string(1, "(){;+ a1\"*"[pick(10)]);
+            break;
+        }
+        const std::string removed = source.substr(offset, length);
+        if (!check(offset, length, text))
+        {
+            broken += 1;
+            check(offset, text.size(), removed);
+        }
+    }
+
+    std::cout << "  " << edits << " edits (" << broken << " undone), " << compiler.GetPartialEdits()
+              << " compiled in part, " << mismatches << " mismatches" << std::endl;
+    std::cout << "  edit " << editSeconds / edits * 1e3 << " ms, compiled in part "
+              << partialSeconds / std::max<size_t>(compiler.GetPartialEdits(), 1) * 1e3
+              << " ms, full compile " << compileSeconds / edits * 1e3 << " ms on average" << std::endl;
+}
+
+// A program that picks one of `branches` large branches to run, as a
+// generated dispatcher would.
+static std::string GenerateBranches(size_t branches, size_t statements)
+{
+    std::string source = "program\n{\n    int mode = 1, i = 0, total = 0, limit = 3;\n    string s = \"\";\n";
+    for (size_t branch = 0; branch < branches; ++branch)
+    {
+        source += "    if (mode == " + std::to_string(branch) + ")\n    {\n";
+        for (size_t i = 0; i < statements / 8; ++i)
+        {
+            source +=
+                "        i = 0;\n"
+                "        while (i < limit)\n"
+                "        {\n"
+                "            total = total + i * 2 - (i + 1) / 3;\n"
+                "            if (total > 1000 or i == 7)\n"
+                "            {\n"
+                "                total = total - 1000;\n"
+                "                break;\n"
+                "            }\n"
+                "            i = i + 1;\n"
+                "        }\n"
+                "        s = \"step " + std::to_string(i % 100) + "\";\n";
+        }
+        source += "    }\n";
+    }
+    return source + "    write(total, s);\n}\n";
+}
+
+// Time from source text to the first instruction, and to the end of the run,
+// compiling all blocks up front or each as it first runs.
+static void BenchLazy(size_t scale)
+{
+    const auto source = GenerateBranches(20, scale / 200);
+    std::cout << "20 branches, one of them run, " << source.size() / 1e6 << " MB" << std::endl;
+
+    std::string expected;
+    for (const auto& [name, lazy, check]: {
+             std::tuple{"  eager        ", false, false},
+             std::tuple{"  lazy         ", true, false},
+             std::tuple{"  lazy, checked", true, true}})
+    {
+        double start{1e9};
+        double total{1e9};
+        std::string output;
+        size_t instructions{};
+        for (int round = 0; round < 3; ++round)
+        {
+            std::ostringstream out;
+            Stopwatch watch;
+            Poliz poliz;
+            if (lazy)
+            {
+                CompileLazy(source, poliz, check);
+            }
+            else
+            {
+                Compile(source, poliz);
+            }
+            auto interpreter = lazy ? poliz.CreateLazyInterpreter(std::cin, out) : poliz.CreateInterpreter(std::cin, out);
+            start = std::min(start, watch.Seconds());
+            interpreter.Run();
+            total = std::min(total, watch.Seconds());
+            output = out.str();
+            instructions = poliz.GetProgram().size();
+        }
+        expected = expected.empty() ? output : expected;
+        std::cout << name << ": first instruction after " << start * 1e3 << " ms, done after "
+                  << total * 1e3 << " ms, " << instructions << " instructions compiled"
+                  << (output == expected ? "" : ", output differs!") << std::endl;
+    }
+}
+
+// Discards output, noting when the first of it came.
+class FirstOutput
+    : public std::streambuf
+{
+public:
+    double Seconds() const
+    {
+        return m_seconds;
+    }
+
+protected:
+    int overflow(int ch) override
+    {
+        Note();
+        return ch;
+    }
+
+    std::streamsize xsputn(const char*, std::streamsize count) override
+    {
+        Note();
+        return count;
+    }
+
+private:
+    void Note()
+    {
+        if (m_seconds < 0)
+        {
+            m_seconds = m_watch.Seconds();
+        }
+    }
+
+    Stopwatch m_watch;
+    double m_seconds{-1};
+};
+
+// Time to the first output of a program that writes right away, run after
+// compiling it in full or while it is compiled.
+static void BenchStream(size_t scale)
+{
+    auto source = GenerateProgram(scale);
+    source.insert(source.find("    /*"), "    write(\"started\");\n");
+    std::cout << "program of " << source.size() / 1e6 << " MB" << std::endl;
+
+    for (const bool streaming: {false, true})
+    {
+        FirstOutput first;
+        std::ostream out{&first};
+        Stopwatch watch;
+        if (streaming)
+        {
+            RunStreaming(source, std::cin, out);
+        }
+        else
+        {
+            Poliz poliz;
+            Compile(source, poliz);
+            poliz.CreateInterpreter(std::cin, out).Run();
+        }
+        std::cout << (streaming ? "  streaming" : "  compiled ") << ": first output after "
+                  << first.Seconds() * 1e3 << " ms, done after " << watch.Seconds() * 1e3 << " ms"
+                  << std::endl;
+    }
+}
+
+// Tight loops, where nearly every instruction reads or writes a variable.
+static void BenchSlots(size_t scale)
+{
+    const auto iterations = scale * 10;
+    const auto source = "program\n{\n    int i = 0, j, sum = 0;\n"
+        "    while (i < " + std::to_string(iterations) + ")\n    {\n"
+        "        j = 0;\n"
+        "        while (j < 4)\n        {\n            sum = sum + i * j - (sum / 3);\n            j = j + 1;\n        }\n"
+        "        i = i + 1;\n    }\n    write(sum);\n}\n";
+
+    Poliz poliz;
+    Compile(source, poliz);
+    std::ostringstream out;
+    auto interpreter = poliz.CreateInterpreter(std::cin, out);
+    Stopwatch watch;
+    interpreter.Run();
+    Report("inner iterations", iterations * 4.0, "", watch.Seconds());
+    std::cout << "sum: " << out.str() << std::endl;
+}
+
+// Counts the lines of a debug trace, one per instruction run.
+class LineCounter
+    : public std::streambuf
+{
+public:
+    size_t GetLines() const
+    {
+        return m_lines;
+    }
+
+protected:
+    int overflow(int ch) override
+    {
+        m_lines += ch == '\n';
+        return ch;
+    }
+
+    std::streamsize xsputn(const char* text, std::streamsize count) override
+    {
+        m_lines += std::count(text, text + count, '\n');
+        return count;
+    }
+
+private:
+    size_t m_lines{0};
+};
+
+// Instructions run, on the register machine if `registers` is set.
+static size_t CountInstructions(const std::string& source, const std::string& input, bool registers = false)
+{
+    Poliz poliz;
+    Compile(source, poliz);
+    RegisterCode code;
+    if (registers && !code.Lower(poliz.GetProgram(), poliz.GetVariables().size()))
+    {
+        throw std::runtime_error("program not lowered");
+    }
+    std::istringstream in{input};
+    FirstOutput discard;
+    std::ostream out{&discard};
+    LineCounter counter;
+    const auto trace = std::cerr.rdbuf(&counter);
+    if (registers)
+    {
+        RegisterInterpreter{code, poliz.GetVariables(), in, out}.Run(true);
+    }
+    else
+    {
+        poliz.CreateInterpreter(in, out).Run(true);
+    }
+    std::cerr.rdbuf(trace);
+    return counter.GetLines();
+}
+
+// Loop-heavy programs: tests/test4.txt and tests/test8.txt with more rounds
+// and the loop of `bench slots`, as source and input for a number of rounds.
+static const std::pair<const char*, std::function<std::pair<std::string, std::string>(size_t)>> c_loopPrograms[] = {
+    {"test4", [](size_t rounds)
+    {
+        return std::pair{std::string{
+            "program\n{\n  int i = 0, counter;\n\n"
+            "  write(\"enter number: \");\n  read(counter);\n  write(\"count up to\", counter);\n\n"
+            "  while (i <= counter)\n  {\n    write(i * i);\n    i = i + 1;\n  }\n}\n"},
+            std::to_string(rounds)};
+    }},
+    {"test8", [](size_t rounds)
+    {
+        return std::pair{
+            "program\n{\n    int i = 0, n = " + std::to_string(rounds) + ";\n\n"
+            "    while (true)\n    {\n        while (true)\n        {\n"
+            "            if (i > n)\n                break;\n            i = i + 1;\n            write(i);\n"
+            "        }\n        if (i > n)\n            break;\n    }\n}\n",
+            std::string{}};
+    }},
+    {"slots", [](size_t rounds)
+    {
+        return std::pair{
+            "program\n{\n    int i = 0, j, sum = 0;\n    while (i < " + std::to_string(rounds) + ")\n    {\n"
+            "        j = 0;\n"
+            "        while (j < 4)\n        {\n            sum = sum + i * j - (sum / 3);\n            j = j + 1;\n        }\n"
+            "        i = i + 1;\n    }\n    write(sum);\n}\n",
+            std::string{}};
+    }},
+};
+
+// The loop programs under either dispatch. Instruction counts grow linearly
+// with the rounds, so they come from two short traced runs.
+static void BenchDispatch(size_t scale)
+{
+    for (const auto& [name, generate]: c_loopPrograms)
+    {
+        const auto rounds = std::max<size_t>(scale, 2000);
+        const auto [source, input] = generate(rounds);
+        const auto first = CountInstructions(generate(1000).first, generate(1000).second);
+        const auto second = CountInstructions(generate(2000).first, generate(2000).second);
+        const auto instructions = first + (second - first) * (rounds - 1000) / 1000.0;
+        std::cout << name << ", " << rounds << " rounds, " << instructions / 1e6 << " M instructions" << std::endl;
+
+        for (const auto& [dispatch, label]: {
+                 std::pair{Dispatch::Switch, "  switch  "},
+                 std::pair{Dispatch::Threaded, "  threaded"}})
+        {
+            if (!SetDispatch(dispatch))
+            {
+                continue;
+            }
+            Poliz poliz;
+            Compile(source, poliz);
+            double seconds{1e9};
+            for (int round = 0; round < 3; ++round)
+            {
+                std::istringstream in{input};
+                FirstOutput discard;
+                std::ostream out{&discard};
+                auto interpreter = poliz.CreateInterpreter(in, out);
+                CpuStopwatch watch;
+                interpreter.Run();
+                seconds = std::min(seconds, watch.Seconds());
+            }
+            Report(label, instructions, " instructions", seconds);
+        }
+    }
+    SetDispatch(Dispatch::Auto);
+}
+
+// The loop programs on the stack machine and lowered to registers, under
+// threaded dispatch. Dispatches are counted as in `bench dispatch`.
+static void BenchRegisters(size_t scale)
+{
+    for (const auto& [name, generate]: c_loopPrograms)
+    {
+        const auto rounds = std::max<size_t>(scale, 2000);
+        const auto [source, input] = generate(rounds);
+        std::cout << name << ", " << rounds << " rounds" << std::endl;
+
+        Poliz poliz;
+        Compile(source, poliz);
+        RegisterCode code;
+        code.Lower(poliz.GetProgram(), poliz.GetVariables().size());
+        for (const bool registers: {false, true})
+        {
+            const auto first = CountInstructions(generate(1000).first, generate(1000).second, registers);
+            const auto second = CountInstructions(generate(2000).first, generate(2000).second, registers);
+            const auto dispatches = first + (second - first) * (rounds - 1000) / 1000.0;
+
+            double seconds{1e9};
+            for (int round = 0; round < 3; ++round)
+            {
+                std::istringstream in{input};
+                FirstOutput discard;
+                std::ostream out{&discard};
+                CpuStopwatch watch;
+                if (registers)
+                {
+                    RegisterInterpreter{code, poliz.GetVariables(), in, out}.Run();
+                }
+                else
+                {
+                    poliz.CreateInterpreter(in, out).Run();
+                }
+                seconds = std::min(seconds, watch.Seconds());
+            }
+            std::cout << (registers ? "  registers: " : "  stack    : ") << dispatches / 1e6 << " M dispatches, "
+                      << seconds * 1e3 << " ms" << std::endl;
+        }
+    }
+}
+
+// The loop programs on the stack machine, on the register machine and
+// compiled from the registers to native code.
+static void BenchJit(size_t scale)
+{
+    for (const auto& [name, generate]: c_loopPrograms)
+    {
+        const auto rounds = std::max<size_t>(scale, 2000);
+        const auto [source, input] = generate(rounds);
+        std::cout << name << ", " << rounds << " rounds" << std::endl;
+
+        Poliz poliz;
+        Compile(source, poliz);
+        RegisterCode code;
+        code.Lower(poliz.GetProgram(), poliz.GetVariables().size());
+        JitCode native;
+        if (!native.Compile(code, poliz.GetVariables()))
+        {
+            std::cout << "  no JIT in this build" << std::endl;
+        }
+        for (const auto& [tier, label]: {
+                 std::pair{0, "  stack    "},
+                 std::pair{1, "  registers"},
+                 std::pair{2, "  native   "}})
+        {
+            if (tier == 2 && native.GetSize() == 0)
+            {
+                continue;
+            }
+            double seconds{1e9};
+            for (int round = 0; round < 3; ++round)
+            {
+                std::istringstream in{input};
+                FirstOutput discard;
+                std::ostream out{&discard};
+                CpuStopwatch watch;
+                if (tier == 0)
+                {
+                    poliz.CreateInterpreter(in, out).Run();
+                }
+                else if (tier == 1)
+                {
+                    RegisterInterpreter{code, poliz.GetVariables(), in, out}.Run();
+                }
+                else
+                {
+                    RegisterInterpreter{code, poliz.GetVariables(), in, out}.Run(native);
+                }
+                seconds = std::min(seconds, watch.Seconds());
+            }
+            std::cout << label << ": " << seconds * 1e3 << " ms" << std::endl;
+        }
+        std::cout << "  " << code.GetCode().size() << " instructions, " << native.GetSize()
+                  << " bytes of native code" << std::endl;
+    }
+}
+
+// The loop programs built with aot and g++ -O2 against int with and
+// without the JIT, each a process of its own, best of three wall times.
+static void BenchAot(size_t scale)
+{
+    const auto binaries = std::filesystem::read_symlink("/proc/self/exe").parent_path();
+    const auto interpreter = (binaries / "int").string();
+    const auto base = (std::filesystem::temp_directory_path() / ("bench-aot-" + std::to_string(::getpid()))).string();
+    for (const auto& [name, generate]: c_loopPrograms)
+    {
+        const auto rounds = std::max<size_t>(scale, 2000);
+        const auto [source, input] = generate(rounds);
+        std::ofstream(base + ".txt") << source;
+        std::ofstream(base + ".in") << input;
+
+        Poliz poliz;
+        Compile(source, poliz);
+        RegisterCode code;
+        code.Lower(poliz.GetProgram(), poliz.GetVariables().size());
+        {
+            std::ofstream cpp(base + ".cpp");
+            Transpile(code, poliz.GetVariables(), {}, cpp);
+        }
+        Stopwatch build;
+        const auto command = "g++ -O2 -o " + base + " " + base + ".cpp";
+        if (std::system(command.c_str()) != 0)
+        {
+            std::cout << "cannot build " << base << ".cpp" << std::endl;
+            continue;
+        }
+        std::cout << name << ", " << rounds << " rounds, built in " << build.Seconds() * 1e3 << " ms" << std::endl;
+
+        for (const auto& [program, args, label]: {
+                 std::tuple{interpreter, std::vector<std::string>{"--no-jit", base + ".txt"}, "  int --no-jit"},
+                 std::tuple{interpreter, std::vector<std::string>{base + ".txt"}, "  int         "},
+                 std::tuple{base, std::vector<std::string>{}, "  aot         "}})
+        {
+            double seconds{1e9};
+            for (int round = 0; round < 3; ++round)
+            {
+                Stopwatch watch;
+                ::waitpid(Spawn(program, args, base + ".in"), nullptr, 0);
+                seconds = std::min(seconds, watch.Seconds());
+            }
+            std::cout << label << ": " << seconds * 1e3 << " ms" << std::endl;
+        }
+    }
+    for (const char* suffix: {"", ".txt", ".in", ".cpp"})
+    {
+        std::filesystem::remove(base + suffix);
+    }
+}
+
+// Tiered against up-front compilation: a long program of short loops, which
+// never get hot, and the loop programs, which do after `threshold` jumps
+// back. Up front includes lowering and compiling the whole program.
+static void BenchTiers(size_t scale)
+{
+    const size_t threshold = 1000;
+    const auto brief = GenerateProgram(std::max<size_t>(scale / 100, 80));
+    std::vector<std::tuple<std::string, std::string, std::string>> programs{
+        {"short loops", brief, std::string{}}};
+    for (const auto& [name, generate]: c_loopPrograms)
+    {
+        const auto [source, input] = generate(std::max<size_t>(scale, 2000));
+        programs.emplace_back(name, source, input);
+    }
+
+    for (const auto& [name, source, input]: programs)
+    {
+        std::cout << name << ", " << source.size() / 1e3 << " KB" << std::endl;
+        Poliz poliz;
+        Compile(source, poliz);
+        for (const auto& [tier, label]: {
+                 std::pair{0, "  stack   "},
+                 std::pair{1, "  tiered  "},
+                 std::pair{2, "  up front"}})
+        {
+            double seconds{1e9};
+            std::ostringstream tiers;
+            for (int round = 0; round < 3; ++round)
+            {
+                std::istringstream in{input};
+                FirstOutput discard;
+                std::ostream out{&discard};
+                CpuStopwatch watch;
+                if (tier == 2)
+                {
+                    RegisterCode code;
+                    JitCode native;
+                    if (code.Lower(poliz.GetProgram(), poliz.GetVariables().size())
+                        && native.Compile(code, poliz.GetVariables()))
+                    {
+                        RegisterInterpreter{code, poliz.GetVariables(), in, out}.Run(native);
+                    }
+                }
+                else
+                {
+                    auto interpreter = poliz.CreateInterpreter(in, out);
+                    if (tier == 1)
+                    {
+                        interpreter.EnableTiering(poliz.GetProgram(), threshold, true);
+                    }
+                    interpreter.Run();
+                    if (tier == 1 && round == 0)
+                    {
+                        interpreter.PrintTiers(tiers);
+                    }
+                }
+                seconds = std::min(seconds, watch.Seconds());
+            }
+            std::cout << label << ": " << seconds * 1e3 << " ms" << std::endl;
+            if (!tiers.str().empty())
+            {
+                std::cout << tiers.str();
+            }
+        }
+    }
+}
+
+// The loop programs on the stack machine with its checks and verified
+// without them, and what verification takes on a long program.
+static void BenchVerify(size_t scale)
+{
+    {
+        const auto source = GenerateProgram(std::max<size_t>(scale / 100, 80));
+        Poliz poliz;
+        Compile(source, poliz);
+        CpuStopwatch watch;
+        const auto verification = poliz.GetBytecode().Verify(poliz.GetVariables());
+        std::cout << "verifying " << poliz.GetBytecode().GetCode().size() / 1e3 << " KB of code: "
+                  << watch.Seconds() * 1e3 << " ms, " << (verification.verified ? "verified" : verification.error)
+                  << std::endl;
+    }
+
+    for (const auto& [name, generate]: c_loopPrograms)
+    {
+        const auto rounds = std::max<size_t>(scale, 2000);
+        const auto [source, input] = generate(rounds);
+        std::cout << name << ", " << rounds << " rounds" << std::endl;
+        Poliz poliz;
+        Compile(source, poliz);
+        for (const bool verify: {false, true})
+        {
+            double seconds{1e9};
+            size_t stackSize{};
+            for (int round = 0; round < 3; ++round)
+            {
+                std::istringstream in{input};
+                FirstOutput discard;
+                std::ostream out{&discard};
+                auto interpreter = poliz.CreateInterpreter(in, out);
+                if (verify)
+                {
+                    stackSize = interpreter.Verify().stackSize;
+                }
+                CpuStopwatch watch;
+                interpreter.Run();
+                seconds = std::min(seconds, watch.Seconds());
+            }
+            if (verify)
+            {
+                std::cout << "  verified: " << seconds * 1e3 << " ms, stack of " << stackSize << " (estimated "
+                          << poliz.GetBytecode().GetStackSize() << ")" << std::endl;
+            }
+            else
+            {
+                std::cout << "  checked : " << seconds * 1e3 << " ms" << std::endl;
+            }
+        }
+    }
+}
+
+// An integer loop and a string loop: run time and the allocations made
+// while running, which is where the value representation shows.
+static void BenchValues(size_t scale)
+{
+    std::cout << "value: " << sizeof(Value) << " bytes, tagged value: " << sizeof(TaggedValue) << " bytes" << std::endl;
+    const auto rounds = std::to_string(scale);
+    const std::pair<const char*, std::string> programs[] = {
+        {"integers",
+            "program\n{\n    int i = 0, j, sum = 0;\n    while (i < " + rounds + ")\n    {\n"
+            "        j = 0;\n"
+            "        while (j < 4)\n        {\n            sum = sum + i * j - (sum / 3);\n            j = j + 1;\n        }\n"
+            "        i = i + 1;\n    }\n    write(sum);\n}\n"},
+        {"strings",
+            "program\n{\n    int i = 0, n = 0;\n    string s = \"a longer string than fits inline\", t;\n"
+            "    while (i < " + rounds + ")\n    {\n"
+            "        t = s + \"!\";\n"
+            "        if (t != s and s < t)\n            n = n + 1;\n"
+            "        s = t;\n        t = \"a longer string than fits inline\";\n"
+            "        s = t;\n        i = i + 1;\n    }\n    write(s, n);\n}\n"},
+    };
+
+    for (const auto& [name, source]: programs)
+    {
+        Poliz poliz;
+        Compile(source, poliz);
+        double seconds{1e9};
+        size_t allocations{};
+        size_t bytes{};
+        for (int round = 0; round < 3; ++round)
+        {
+            std::ostringstream out;
+            auto interpreter = poliz.CreateInterpreter(std::cin, out);
+            const auto allocationsBefore = g_allocations.load();
+            const auto bytesBefore = g_allocatedBytes.load();
+            CpuStopwatch watch;
+            interpreter.Run();
+            seconds = std::min(seconds, watch.Seconds());
+            allocations = g_allocations.load() - allocationsBefore;
+            bytes = g_allocatedBytes.load() - bytesBefore;
+        }
+        Report(name, static_cast<double>(scale), " rounds", seconds);
+        std::cout << "  " << static_cast<double>(allocations) / scale << " allocations, "
+                  << static_cast<double>(bytes) / scale << " bytes a round" << std::endl;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const std::pair<const char*, std::function<void(size_t)>> benchmarks[] = {
+        {"lexer", BenchLexer},
+        {"skip", BenchSkip},
+        {"tokenize", BenchTokenize},
+        {"parse", BenchParse},
+        {"nesting", BenchNesting},
+        {"arena", BenchArena},
+        {"cache", BenchCache},
+        {"daemon", BenchDaemon},
+        {"incremental", BenchIncremental},
+        {"lazy", BenchLazy},
+        {"stream", BenchStream},
+        {"slots", BenchSlots},
+        {"dispatch", BenchDispatch},
+        {"values", BenchValues},
+        {"registers", BenchRegisters},
+        {"jit", BenchJit},
+        {"aot", BenchAot},
+        {"tiers", BenchTiers},
+        {"verify", BenchVerify},
+    };
+
+    const size_t scale = argc > 2 ? std::stoull(argv[2]) : 1000000;
+    for (const auto& [name, run]: benchmarks)
+    {
+        if (argc < 2 || std::strcmp(argv[1], name) == 0)
+        {
+            run(scale);
+        }
+    }
+    return g_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,1090 @@
+#include "bytecode2.h"
+#include <algorithm>
+#include <iomanip>
+#include <stdexcept>
+#include <utility>
+
+// Operands follow the opcode in the order of the format: 'c' a varint
+// constant, 's' a varint slot or count, 'j' a jump and 'b' a block.
+struct OpcodeInfo
+{
+    const char* name;
+    const char* operands;
+};
+
+static const OpcodeInfo c_info[] = {
+    {"push false", ""},
+    {"push true", ""},
+    {"push", "c"},
+    {"load", "s"},
+    {"store", "s"},
+    {"store unknown", ""},
+    {"read", ""},
+    {"write", "s"},
+    {"jump", "j"},
+    {"jump if false", "j"},
+    {"clear", ""},
+    {"stub", "b"},
+    {"add", ""},
+    {"sub", ""},
+    {"mul", ""},
+    {"div", ""},
+    {"lt", ""},
+    {"gt", ""},
+    {"ge", ""},
+    {"le", ""},
+    {"eq", ""},
+    {"ne", ""},
+    {"concat", ""},
+    {"lt str", ""},
+    {"gt str", ""},
+    {"ge str", ""},
+    {"le str", ""},
+    {"eq str", ""},
+    {"ne str", ""},
+    {"not", ""},
+    {"neg", ""},
+    {"pos", ""},
+    {"assign", "s"},
+    {"inc", "sc"},
+    {"add var const", "sc"},
+    {"sub var const", "sc"},
+    {"mul var const", "sc"},
+    {"div var const", "sc"},
+    {"add var var", "ss"},
+    {"sub var var", "ss"},
+    {"mul var var", "ss"},
+    {"div var var", "ss"},
+    {"jump unless lt", "ssj"},
+    {"jump unless gt", "ssj"},
+    {"jump unless ge", "ssj"},
+    {"jump unless le", "ssj"},
+    {"jump unless eq", "ssj"},
+    {"jump unless ne", "ssj"},
+    {"jump unless lt const", "scj"},
+    {"jump unless gt const", "scj"},
+    {"jump unless ge const", "scj"},
+    {"jump unless le const", "scj"},
+    {"jump unless eq const", "scj"},
+    {"jump unless ne const", "scj"},
+};
+static_assert(sizeof(c_info) / sizeof(c_info[0]) == c_opcodes, "a name per opcode");
+
+// Operators by the type of their operands. They have no operand in the code.
+struct TypedOperator
+{
+    LexemeType type;
+    ValueType operands;
+    Opcode op;
+};
+
+static const TypedOperator c_operators[] = {
+    {LexemeType::Plus, ValueType::Int, Opcode::AddInt},
+    {LexemeType::Minus, ValueType::Int, Opcode::SubtractInt},
+    {LexemeType::Multiply, ValueType::Int, Opcode::MultiplyInt},
+    {LexemeType::Divide, ValueType::Int, Opcode::DivideInt},
+    {LexemeType::Less, ValueType::Int, Opcode::LessInt},
+    {LexemeType::Greater, ValueType::Int, Opcode::GreaterInt},
+    {LexemeType::NotLess, ValueType::Int, Opcode::NotLessInt},
+    {LexemeType::NotGreater, ValueType::Int, Opcode::NotGreaterInt},
+    {LexemeType::Equal, ValueType::Int, Opcode::EqualInt},
+    {LexemeType::NotEqual, ValueType::Int, Opcode::NotEqualInt},
+    {LexemeType::Plus, ValueType::String, Opcode::Concatenate},
+    {LexemeType::Less, ValueType::String, Opcode::LessString},
+    {LexemeType::Greater, ValueType::String, Opcode::GreaterString},
+    {LexemeType::NotLess, ValueType::String, Opcode::NotLessString},
+    {LexemeType::NotGreater, ValueType::String, Opcode::NotGreaterString},
+    {LexemeType::Equal, ValueType::String, Opcode::EqualString},
+    {LexemeType::NotEqual, ValueType::String, Opcode::NotEqualString},
+    {LexemeType::Not, ValueType::Bool, Opcode::Not},
+    {LexemeType::UnaryMinus, ValueType::Int, Opcode::NegateInt},
+    {LexemeType::UnaryPlus, ValueType::Int, Opcode::PlusInt},
+};
+
+bool FindOperator(LexemeType type, ValueType operands, Opcode& op)
+{
+    for (const auto& entry: c_operators)
+    {
+        if (entry.type == type && entry.operands == operands)
+        {
+            op = entry.op;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool IsJump(Opcode op)
+{
+    return op == Opcode::Jump || op == Opcode::JumpIfFalse;
+}
+
+// Whether the instruction ends in a jump, plain or fused.
+static bool HasJump(Opcode op)
+{
+    const auto operands = c_info[static_cast<size_t>(op)].operands;
+    return *operands && operands[std::strlen(operands) - 1] == 'j';
+}
+
+// Opcode of a fused operator or comparison by the plain one it replaces,
+// Opcode::Clear if there is none.
+static Opcode FindFused(Opcode op, bool constant)
+{
+    static const Opcode c_fused[][3] = {
+        {Opcode::AddInt, Opcode::AddVarVar, Opcode::AddVarConst},
+        {Opcode::SubtractInt, Opcode::SubtractVarVar, Opcode::SubtractVarConst},
+        {Opcode::MultiplyInt, Opcode::MultiplyVarVar, Opcode::MultiplyVarConst},
+        {Opcode::DivideInt, Opcode::DivideVarVar, Opcode::DivideVarConst},
+        {Opcode::LessInt, Opcode::JumpUnlessLessVarVar, Opcode::JumpUnlessLessVarConst},
+        {Opcode::GreaterInt, Opcode::JumpUnlessGreaterVarVar, Opcode::JumpUnlessGreaterVarConst},
+        {Opcode::NotLessInt, Opcode::JumpUnlessNotLessVarVar, Opcode::JumpUnlessNotLessVarConst},
+        {Opcode::NotGreaterInt, Opcode::JumpUnlessNotGreaterVarVar, Opcode::JumpUnlessNotGreaterVarConst},
+        {Opcode::EqualInt, Opcode::JumpUnlessEqualVarVar, Opcode::JumpUnlessEqualVarConst},
+        {Opcode::NotEqualInt, Opcode::JumpUnlessNotEqualVarVar, Opcode::JumpUnlessNotEqualVarConst},
+    };
+    for (const auto& entry: c_fused)
+    {
+        if (entry[0] == op)
+        {
+            return entry[constant ? 2 : 1];
+        }
+    }
+    return Opcode::Clear;
+}
+
+static long long int GetOperand(const Lexeme& lexeme)
+{
+    const auto value = std::get_if<long long int>(&lexeme.value);
+    if (!value)
+    {
+        throw std::runtime_error("invalid instruction");
+    }
+    return *value;
+}
+
+static void AddVarint(size_t value, std::vector<uint8_t>& code)
+{
+    for (; value >= 0x80; value >>= 7)
+    {
+        code.push_back(static_cast<uint8_t>(value | 0x80));
+    }
+    code.push_back(static_cast<uint8_t>(value));
+}
+
+static void AddInt32(int32_t value, std::vector<uint8_t>& code)
+{
+    uint8_t bytes[sizeof(value)];
+    std::memcpy(bytes, &value, sizeof(value));
+    code.insert(code.end(), bytes, bytes + sizeof(value));
+}
+
+static void PrintValue(std::ostream& os, const TaggedValue& value)
+{
+    if (value.IsString())
+    {
+        os << '"' << value << '"';
+    }
+    else
+    {
+        os << value;
+    }
+}
+
+Opcode GetOpcode(const Lexeme& lexeme)
+{
+    switch (lexeme.type)
+    {
+    case LexemeType::Literal:
+        if (const auto flag = std::get_if<bool>(&lexeme.value))
+        {
+            return *flag ? Opcode::PushTrue : Opcode::PushFalse;
+        }
+        return Opcode::PushConstant;
+
+    case LexemeType::LoadSlot:
+    case LexemeType::Write:
+        if (GetOperand(lexeme) < 0)
+        {
+            throw std::runtime_error("invalid instruction");
+        }
+        return lexeme.type == LexemeType::LoadSlot ? Opcode::Load : Opcode::Write;
+
+    case LexemeType::StoreSlot:
+        return GetOperand(lexeme) < 0 ? Opcode::StoreUnknown : Opcode::Store;
+
+    case LexemeType::Goto:
+    case LexemeType::ConditionalGoto:
+        GetOperand(lexeme);
+        return lexeme.type == LexemeType::Goto ? Opcode::Jump : Opcode::JumpIfFalse;
+
+    case LexemeType::Stub:
+        GetOperand(lexeme);
+        return Opcode::Stub;
+
+    case LexemeType::Read:
+        return Opcode::Read;
+
+    case LexemeType::Clear:
+        return Opcode::Clear;
+
+    default:
+    {
+        const auto operands = GetOperand(lexeme);
+        Opcode op{};
+        if (operands < 0 || operands > static_cast<long long int>(ValueType::String)
+            || !FindOperator(lexeme.type, static_cast<ValueType>(operands), op))
+        {
+            throw std::runtime_error("invalid instruction");
+        }
+        return op;
+    }
+    }
+}
+
+const char* GetName(Opcode op)
+{
+    return c_info[static_cast<size_t>(op)].name;
+}
+
+void Bytecode::Add(const Lexeme& lexeme)
+{
+    const auto position = m_offsets.size();
+    m_offsets.push_back(m_code.size());
+    Encode(lexeme, m_code);
+    const auto op = static_cast<Opcode>(m_code[m_offsets[position]]);
+    if (IsJump(op))
+    {
+        SetJump(position, GetOperand(lexeme));
+    }
+    UpdateDepth(op, op == Opcode::Write ? GetOperand(lexeme) : 0);
+
+    long long int operand = 0;
+    if (IsJump(op))
+    {
+        operand = GetOperand(lexeme);
+    }
+    else if (op == Opcode::PushConstant || op == Opcode::Load || op == Opcode::Store)
+    {
+        size_t offset = m_offsets[position] + 1;
+        operand = static_cast<long long int>(ReadVarint(m_code.data(), offset));
+    }
+    if (m_recent.size() == 5)
+    {
+        m_recent.erase(m_recent.begin());
+    }
+    m_recent.push_back({op, operand, position});
+    Fuse();
+
+    // jumps to the next lexeme know their target now
+    if (!m_fixups.empty() && m_fixups.begin()->first == GetCount())
+    {
+        const auto end = m_fixups.upper_bound(GetCount());
+        for (auto it = m_fixups.begin(); it != end; ++it)
+        {
+            SetJump(it->second, GetCount());
+        }
+        m_fixups.erase(m_fixups.begin(), end);
+    }
+}
+
+void Bytecode::Patch(size_t position, const Lexeme& lexeme)
+{
+    const auto offset = m_offsets[position];
+    const auto old = static_cast<Opcode>(m_code[offset]);
+    const auto op = lexeme.type == LexemeType::Goto ? Opcode::Jump
+        : lexeme.type == LexemeType::ConditionalGoto ? Opcode::JumpIfFalse
+        : Opcode::Stub;
+    if ((!HasJump(old) && old != Opcode::Stub) || (op == Opcode::Stub && lexeme.type != LexemeType::Stub))
+    {
+        throw std::runtime_error("instruction cannot be patched");
+    }
+    const auto operand = GetOperand(lexeme);
+    for (auto it = m_fixups.begin(); it != m_fixups.end(); )
+    {
+        it = it->second == position ? m_fixups.erase(it) : std::next(it);
+    }
+
+    // a fused conditional jump keeps its condition, only the target changes
+    if (HasJump(old) && !IsJump(old))
+    {
+        if (op != Opcode::JumpIfFalse)
+        {
+            throw std::runtime_error("instruction cannot be patched");
+        }
+        SetJump(position, operand);
+        return;
+    }
+
+    m_code[offset] = static_cast<uint8_t>(op);
+    if (IsJump(op))
+    {
+        std::memset(&m_code[offset + 1], 0, sizeof(int32_t));
+        SetJump(position, operand);
+    }
+    else
+    {
+        const auto block = static_cast<int32_t>(operand);
+        std::memcpy(&m_code[offset + 1], &block, sizeof(block));
+    }
+}
+
+void Bytecode::Replace(size_t begin, size_t end, const Lexeme* lexemes, size_t count)
+{
+    const std::vector<uint8_t> tail(m_code.begin() + GetOffset(end), m_code.end());
+    const std::vector<uint32_t> offsets(m_offsets.begin() + std::min(end, GetCount()), m_offsets.end());
+    const auto oldBegin = GetOffset(end);
+
+    Truncate(begin);
+    for (size_t i = 0; i < count; ++i)
+    {
+        Add(lexemes[i]);
+    }
+
+    const auto newBegin = m_code.size();
+    m_code.insert(m_code.end(), tail.begin(), tail.end());
+    for (const auto offset: offsets)
+    {
+        m_offsets.push_back(offset - oldBegin + newBegin);
+    }
+    for (auto it = m_fixups.begin(); it != m_fixups.end() && it->first <= GetCount(); )
+    {
+        SetJump(it->second, it->first);
+        it = m_fixups.erase(it);
+    }
+    // the code moved along is never fused with what comes after it
+    m_recent.clear();
+    m_barrier = GetCount();
+}
+
+void Bytecode::Truncate(size_t position)
+{
+    if (position >= GetCount())
+    {
+        return;
+    }
+    if (position > 0 && m_offsets[position - 1] == m_offsets[position])
+    {
+        throw std::runtime_error("cannot truncate a fused instruction");
+    }
+    m_code.resize(m_offsets[position]);
+    m_offsets.resize(position);
+    for (auto it = m_fixups.begin(); it != m_fixups.end(); )
+    {
+        it = it->second >= position ? m_fixups.erase(it) : std::next(it);
+    }
+    m_recent.clear();
+    m_barrier = position;
+}
+
+const std::vector<uint8_t>& Bytecode::GetCode() const
+{
+    return m_code;
+}
+
+const std::vector<TaggedValue>& Bytecode::GetConstants() const
+{
+    return m_constants;
+}
+
+size_t Bytecode::GetCount() const
+{
+    return m_offsets.size();
+}
+
+size_t Bytecode::GetOffset(size_t position) const
+{
+    return position < m_offsets.size() ? m_offsets[position] : m_code.size();
+}
+
+size_t Bytecode::GetPosition(size_t offset) const
+{
+    return std::lower_bound(m_offsets.begin(), m_offsets.end(), offset) - m_offsets.begin();
+}
+
+size_t Bytecode::GetStackSize() const
+{
+    return m_stackSize;
+}
+
+namespace
+{
+
+// An operand on the stack as Verify() sees it: the variable of a load or
+// an assignment, a value, or either on different paths, and its type.
+struct Operand
+{
+    enum Kind : uint8_t
+    {
+        Value,
+        Slot,
+        Either,
+    };
+
+    Kind kind;
+    ValueType type;
+};
+
+// The stack at the start of a block, `reached` once a path gets there.
+struct State
+{
+    bool reached{false};
+    std::vector<Operand> stack;
+};
+
+class Verifier
+{
+public:
+    Verifier(const std::vector<uint8_t>& code, const std::vector<TaggedValue>& constants,
+             const std::vector<TaggedValue>& variables)
+        : m_code{code}
+        , m_constants{constants}
+        , m_variables{variables}
+        , m_states(code.size() + 1)
+        , m_starts(code.size() + 1)
+        , m_leaders(code.size() + 1)
+    {
+    }
+
+    Verification Run()
+    {
+        Verification result;
+        try
+        {
+            for (size_t offset = 0; offset < m_code.size(); )
+            {
+                m_starts[offset] = true;
+                m_offset = offset;
+                const auto op = ReadOpcode(offset);
+                long long int target = -1;
+                for (auto format = c_info[static_cast<size_t>(op)].operands; *format; ++format)
+                {
+                    if (*format == 'c' || *format == 's')
+                    {
+                        ReadVarint(offset);
+                    }
+                    else if (*format == 'j')
+                    {
+                        target = ReadInt32(offset);
+                        target += static_cast<long long int>(offset);
+                    }
+                    else
+                    {
+                        ReadInt32(offset);
+                    }
+                }
+                // a block starts at every target and after every jump
+                if (target >= 0 && static_cast<size_t>(target) <= m_code.size())
+                {
+                    m_leaders[target] = true;
+                }
+                if (HasJump(op))
+                {
+                    m_leaders[offset] = true;
+                }
+            }
+            m_starts[m_code.size()] = true;
+
+            Merge(0, {});
+            while (!m_work.empty())
+            {
+                const auto offset = m_work.back();
+                m_work.pop_back();
+                Walk(offset);
+            }
+            result.verified = true;
+            result.stackSize = m_stackSize;
+        }
+        catch (const std::runtime_error& e)
+        {
+            result.error = "at " + std::to_string(m_offset) + ": " + e.what();
+        }
+        return result;
+    }
+
+private:
+    Opcode ReadOpcode(size_t& offset)
+    {
+        if (m_code[offset] >= c_opcodes)
+        {
+            throw std::runtime_error("no such opcode");
+        }
+        return static_cast<Opcode>(m_code[offset++]);
+    }
+
+    size_t ReadVarint(size_t& offset)
+    {
+        size_t value = 0;
+        for (int shift = 0; ; shift += 7)
+        {
+            if (offset == m_code.size() || shift > 63)
+            {
+                throw std::runtime_error("operand past the end of the code");
+            }
+            const size_t byte = m_code[offset++];
+            value |= (byte & 0x7f) << shift;
+            if (byte < 0x80)
+            {
+                return value;
+            }
+        }
+    }
+
+    int32_t ReadInt32(size_t& offset)
+    {
+        if (m_code.size() - offset < sizeof(int32_t))
+        {
+            throw std::runtime_error("operand past the end of the code");
+        }
+        return ::ReadInt32(m_code.data(), offset);
+    }
+
+    // The block from `offset` on the stack that reaches it, an instruction
+    // at a time on one stack, then the stack on to the blocks that can come
+    // next. Only the starts of blocks keep a stack of their own, so a long
+    // run of code without jumps costs its length, not its length times the
+    // depth of its stack.
+    void Walk(size_t offset)
+    {
+        auto stack = m_states[offset].stack;
+        while (Step(offset, stack))
+        {
+            if (offset == m_code.size())
+            {
+                return;
+            }
+            if (m_leaders[offset])
+            {
+                Merge(offset, stack);
+                return;
+            }
+        }
+    }
+
+    // The instruction at `offset` on `stack`; moves `offset` past it.
+    // Returns whether the next instruction can come after it.
+    bool Step(size_t& offset, std::vector<Operand>& stack)
+    {
+        m_offset = offset;
+        const auto op = ReadOpcode(offset);
+        switch (op)
+        {
+        case Opcode::PushFalse:
+        case Opcode::PushTrue:
+            stack.push_back({Operand::Value, ValueType::Bool});
+            break;
+
+        case Opcode::PushConstant:
+            stack.push_back({Operand::Value, GetConstant(offset)});
+            break;
+
+        case Opcode::Load:
+            stack.push_back({Operand::Slot, GetVariable(offset)});
+            break;
+
+        case Opcode::Store:
+        {
+            const auto type = GetVariable(offset);
+            Pop(stack, type);
+            stack.push_back({Operand::Slot, type});
+            break;
+        }
+
+        case Opcode::Read:
+            Take(stack, 1);
+            if (stack.back().kind != Operand::Slot)
+            {
+                throw std::runtime_error("read of a value, not a variable");
+            }
+            stack.pop_back();
+            break;
+
+        case Opcode::Write:
+        {
+            const auto count = ReadVarint(offset);
+            Take(stack, count);
+            stack.resize(stack.size() - count);
+            break;
+        }
+
+        case Opcode::Jump:
+            Merge(GetTarget(offset), stack);
+            return false;
+
+        case Opcode::JumpIfFalse:
+        {
+            Pop(stack, ValueType::Bool);
+            Merge(GetTarget(offset), stack);
+            break;
+        }
+
+        case Opcode::Clear:
+            stack.clear();
+            break;
+
+        case Opcode::StoreUnknown:
+            throw std::runtime_error("assignment to an undeclared name");
+
+        case Opcode::Stub:
+            throw std::runtime_error("block not compiled");
+
+        case Opcode::AddInt:
+        case Opcode::SubtractInt:
+        case Opcode::MultiplyInt:
+        case Opcode::DivideInt:
+            Pop(stack, ValueType::Int);
+            Pop(stack, ValueType::Int);
+            stack.push_back({Operand::Value, ValueType::Int});
+            break;
+
+        case Opcode::LessInt:
+        case Opcode::GreaterInt:
+        case Opcode::NotLessInt:
+        case Opcode::NotGreaterInt:
+        case Opcode::EqualInt:
+        case Opcode::NotEqualInt:
+            Pop(stack, ValueType::Int);
+            Pop(stack, ValueType::Int);
+            stack.push_back({Operand::Value, ValueType::Bool});
+            break;
+
+        case Opcode::Concatenate:
+            Pop(stack, ValueType::String);
+            Pop(stack, ValueType::String);
+            stack.push_back({Operand::Value, ValueType::String});
+            break;
+
+        case Opcode::LessString:
+        case Opcode::GreaterString:
+        case Opcode::NotLessString:
+        case Opcode::NotGreaterString:
+        case Opcode::EqualString:
+        case Opcode::NotEqualString:
+            Pop(stack, ValueType::String);
+            Pop(stack, ValueType::String);
+            stack.push_back({Operand::Value, ValueType::Bool});
+            break;
+
+        case Opcode::Not:
+            Pop(stack, ValueType::Bool);
+            stack.push_back({Operand::Value, ValueType::Bool});
+            break;
+
+        case Opcode::NegateInt:
+        case Opcode::PlusInt:
+            Pop(stack, ValueType::Int);
+            stack.push_back({Operand::Value, ValueType::Int});
+            break;
+
+        case Opcode::Assign:
+            Pop(stack, GetVariable(offset));
+            stack.clear();
+            break;
+
+        case Opcode::Increment:
+            GetInt(offset, false);
+            GetInt(offset, true);
+            break;
+
+        case Opcode::AddVarConst:
+        case Opcode::SubtractVarConst:
+        case Opcode::MultiplyVarConst:
+        case Opcode::DivideVarConst:
+        case Opcode::AddVarVar:
+        case Opcode::SubtractVarVar:
+        case Opcode::MultiplyVarVar:
+        case Opcode::DivideVarVar:
+            GetInt(offset, false);
+            GetInt(offset, op <= Opcode::DivideVarConst);
+            stack.push_back({Operand::Value, ValueType::Int});
+            break;
+
+        default:
+            // fused comparisons and their jump
+            GetInt(offset, false);
+            GetInt(offset, op >= Opcode::JumpUnlessLessVarConst);
+            Merge(GetTarget(offset), stack);
+            break;
+        }
+        m_stackSize = std::max(m_stackSize, stack.size());
+        return true;
+    }
+
+    ValueType GetConstant(size_t& offset)
+    {
+        const auto index = ReadVarint(offset);
+        if (index >= m_constants.size())
+        {
+            throw std::runtime_error("no such constant");
+        }
+        return m_constants[index].GetType();
+    }
+
+    ValueType GetVariable(size_t& offset)
+    {
+        const auto slot = ReadVarint(offset);
+        if (slot >= m_variables.size())
+        {
+            throw std::runtime_error("no such variable");
+        }
+        return m_variables[slot].GetType();
+    }
+
+    // an int variable or constant operand of a fused instruction
+    void GetInt(size_t& offset, bool constant)
+    {
+        if ((constant ? GetConstant(offset) : GetVariable(offset)) != ValueType::Int)
+        {
+            throw std::runtime_error("operand is not an int");
+        }
+    }
+
+    size_t GetTarget(size_t& offset)
+    {
+        const auto relative = ReadInt32(offset);
+        const auto target = static_cast<long long int>(offset) + relative;
+        if (target < 0 || static_cast<size_t>(target) > m_code.size() || !m_starts[target])
+        {
+            throw std::runtime_error("jump to " + std::to_string(target) + ", not an instruction");
+        }
+        return static_cast<size_t>(target);
+    }
+
+    void Take(const std::vector<Operand>& stack, size_t count)
+    {
+        if (stack.size() < count)
+        {
+            throw std::runtime_error("stack underflow");
+        }
+    }
+
+    void Pop(std::vector<Operand>& stack, ValueType type)
+    {
+        Take(stack, 1);
+        if (stack.back().type != type)
+        {
+            throw std::runtime_error("operand of the wrong type");
+        }
+        stack.pop_back();
+    }
+
+    // Paths meet at `offset` with the same depth and types; an operand
+    // that is a variable on one and a value on another is either.
+    void Merge(size_t offset, const std::vector<Operand>& stack)
+    {
+        if (offset == m_code.size())
+        {
+            return;
+        }
+        auto& state = m_states[offset];
+        if (!state.reached)
+        {
+            state.reached = true;
+            state.stack = stack;
+            m_work.push_back(offset);
+            return;
+        }
+        if (state.stack.size() != stack.size())
+        {
+            throw std::runtime_error("stack of " + std::to_string(stack.size()) + " operands where "
+                                     + std::to_string(offset) + " has " + std::to_string(state.stack.size()));
+        }
+        bool changed = false;
+        for (size_t i = 0; i < stack.size(); ++i)
+        {
+            if (state.stack[i].type != stack[i].type)
+            {
+                throw std::runtime_error("operand types differ where paths meet at " + std::to_string(offset));
+            }
+            if (state.stack[i].kind != stack[i].kind && state.stack[i].kind != Operand::Either)
+            {
+                state.stack[i].kind = Operand::Either;
+                changed = true;
+            }
+        }
+        if (changed)
+        {
+            m_work.push_back(offset);
+        }
+    }
+
+    const std::vector<uint8_t>& m_code;
+    const std::vector<TaggedValue>& m_constants;
+    const std::vector<TaggedValue>& m_variables;
+    std::vector<State> m_states;
+    // offsets where an instruction starts, and the end
+    std::vector<bool> m_starts;
+    // offsets where a block starts: jump targets and the instructions after
+    // jumps
+    std::vector<bool> m_leaders;
+    std::vector<size_t> m_work;
+    size_t m_stackSize{0};
+    // of the instruction being checked, for errors
+    size_t m_offset{0};
+};
+
+}
+
+Verification Bytecode::Verify(const std::vector<TaggedValue>& variables) const
+{
+    return Verifier{m_code, m_constants, variables}.Run();
+}
+
+size_t Bytecode::Print(std::ostream& os, size_t offset, bool positions) const
+{
+    const auto op = static_cast<Opcode>(m_code[offset++]);
+    const auto& info = c_info[static_cast<size_t>(op)];
+    os << info.name;
+    for (auto format = info.operands; *format; ++format)
+    {
+        os << ' ';
+        switch (*format)
+        {
+        case 'c':
+            PrintValue(os, m_constants[ReadVarint(m_code.data(), offset)]);
+            break;
+
+        case 's':
+            os << ReadVarint(m_code.data(), offset);
+            break;
+
+        case 'j':
+        {
+            const auto relative = ReadInt32(m_code.data(), offset);
+            const auto target = static_cast<long long int>(offset) + relative;
+            if (!positions)
+            {
+                os << target;
+                break;
+            }
+            const auto position = GetPosition(target);
+            os << position << (GetOffset(position) == static_cast<size_t>(target) ? "" : " (inside)");
+            break;
+        }
+
+        default:
+            os << ReadInt32(m_code.data(), offset);
+            break;
+        }
+    }
+    return offset;
+}
+
+void Bytecode::Disassemble(std::ostream& os) const
+{
+    for (size_t offset = 0; offset < m_code.size(); )
+    {
+        os << std::setw(6) << offset << "  ";
+        offset = Print(os, offset);
+        os << '\n';
+    }
+    os << "constants:\n";
+    for (size_t i = 0; i < m_constants.size(); ++i)
+    {
+        os << std::setw(6) << i << "  ";
+        PrintValue(os, m_constants[i]);
+        os << '\n';
+    }
+}
+
+void Bytecode::Encode(const Lexeme& lexeme, std::vector<uint8_t>& code)
+{
+    const auto op = GetOpcode(lexeme);
+    code.push_back(static_cast<uint8_t>(op));
+    switch (op)
+    {
+    case Opcode::PushConstant:
+        AddVarint(AddConstant(lexeme.value), code);
+        break;
+
+    case Opcode::Load:
+    case Opcode::Store:
+    case Opcode::Write:
+        AddVarint(GetOperand(lexeme), code);
+        break;
+
+    case Opcode::Jump:
+    case Opcode::JumpIfFalse:
+        AddInt32(0, code);
+        break;
+
+    case Opcode::Stub:
+        AddInt32(static_cast<int32_t>(GetOperand(lexeme)), code);
+        break;
+
+    default:
+        break;
+    }
+}
+
+void Bytecode::SetJump(size_t position, long long int target)
+{
+    if (target < 0)
+    {
+        // the label is not set yet
+        return;
+    }
+    if (static_cast<size_t>(target) > GetCount())
+    {
+        m_fixups.insert({target, position});
+        return;
+    }
+    if (target > 0 && static_cast<size_t>(target) < GetCount() && m_offsets[target - 1] == m_offsets[target])
+    {
+        throw std::runtime_error("jump into a fused instruction");
+    }
+    m_barrier = std::max(m_barrier, static_cast<size_t>(target));
+
+    // the jump ends the instruction, fused or not
+    const auto end = GetOffset(position + 1);
+    const auto relative = static_cast<int32_t>(static_cast<long long int>(GetOffset(target)) - static_cast<long long int>(end));
+    std::memcpy(&m_code[end - sizeof(relative)], &relative, sizeof(relative));
+}
+
+// The sequences are those that `patterns` finds most often in loops. A
+// longer sequence may take in a shorter one fused before it, as
+// `x = x + 1;` takes in `x + 1`, since the instructions are kept as added.
+void Bytecode::Fuse()
+{
+    const auto size = m_recent.size();
+    const auto at = [this, size](size_t back) -> const Recent&
+    {
+        return m_recent[size - back];
+    };
+
+    // x = x + c;
+    if (size >= 5 && at(1).op == Opcode::Clear && at(2).op == Opcode::Store
+        && at(3).op == Opcode::AddInt && at(4).op == Opcode::PushConstant
+        && at(5).op == Opcode::Load && at(5).operand == at(2).operand && CanFuse(5))
+    {
+        Rewrite(5, Opcode::Increment, {static_cast<size_t>(at(5).operand), static_cast<size_t>(at(4).operand)});
+        return;
+    }
+
+    // a < b, a < c and the like as a condition
+    if (size >= 4 && at(1).op == Opcode::JumpIfFalse && at(4).op == Opcode::Load
+        && (at(3).op == Opcode::Load || at(3).op == Opcode::PushConstant) && CanFuse(4))
+    {
+        const auto fused = FindFused(at(2).op, at(3).op == Opcode::PushConstant);
+        if (HasJump(fused))
+        {
+            Rewrite(4, fused, {static_cast<size_t>(at(4).operand), static_cast<size_t>(at(3).operand)});
+            return;
+        }
+    }
+
+    // a + b, a + c and the like
+    if (size >= 3 && at(3).op == Opcode::Load
+        && (at(2).op == Opcode::Load || at(2).op == Opcode::PushConstant) && CanFuse(3))
+    {
+        const auto fused = FindFused(at(1).op, at(2).op == Opcode::PushConstant);
+        if (fused != Opcode::Clear && !HasJump(fused))
+        {
+            Rewrite(3, fused, {static_cast<size_t>(at(3).operand), static_cast<size_t>(at(2).operand)});
+            return;
+        }
+    }
+
+    // x = ...;
+    if (size >= 2 && at(1).op == Opcode::Clear && at(2).op == Opcode::Store && CanFuse(2))
+    {
+        Rewrite(2, Opcode::Assign, {static_cast<size_t>(at(2).operand)});
+    }
+}
+
+bool Bytecode::CanFuse(size_t count) const
+{
+    const auto first = m_recent[m_recent.size() - count].position;
+    return first >= m_barrier && (first == 0 || m_offsets[first - 1] != m_offsets[first]);
+}
+
+void Bytecode::Rewrite(size_t count, Opcode op, std::initializer_list<size_t> operands)
+{
+    const auto& last = m_recent.back();
+    const auto first = last.position + 1 - count;
+    const auto offset = m_offsets[first];
+    m_code.resize(offset);
+    m_code.push_back(static_cast<uint8_t>(op));
+    for (const auto operand: operands)
+    {
+        AddVarint(operand, m_code);
+    }
+    std::fill(m_offsets.begin() + first, m_offsets.end(), offset);
+
+    if (HasJump(op))
+    {
+        AddInt32(0, m_code);
+        // a target past the code is still among the fixups
+        if (last.operand >= 0 && static_cast<size_t>(last.operand) <= GetCount())
+        {
+            SetJump(last.position, last.operand);
+        }
+    }
+}
+
+// The code that Replace() moves along was counted where it was first
+// added. Statements start on an empty stack, so that count still holds.
+void Bytecode::UpdateDepth(Opcode op, long long int operand)
+{
+    switch (op)
+    {
+    case Opcode::PushFalse:
+    case Opcode::PushTrue:
+    case Opcode::PushConstant:
+    case Opcode::Load:
+        m_depth += 1;
+        m_stackSize = std::max(m_stackSize, m_depth);
+        break;
+
+    case Opcode::Clear:
+        m_depth = 0;
+        break;
+
+    case Opcode::Write:
+        m_depth -= std::min<size_t>(m_depth, operand);
+        break;
+
+    case Opcode::Read:
+    case Opcode::JumpIfFalse:
+        m_depth -= m_depth > 0;
+        break;
+
+    case Opcode::Store:
+    case Opcode::StoreUnknown:
+    case Opcode::Jump:
+    case Opcode::Stub:
+    case Opcode::Not:
+    case Opcode::NegateInt:
+    case Opcode::PlusInt:
+        break;
+
+    default:
+        // binary operators take two operands and leave one
+        m_depth -= m_depth > 0;
+        break;
+    }
+}
+
+size_t Bytecode::AddConstant(const Value& value)
+{
+    if (const auto number = std::get_if<long long int>(&value))
+    {
+        const auto it = m_numbers.find(*number);
+        if (it != m_numbers.end())
+        {
+            return it->second;
+        }
+        m_numbers.insert({*number, m_constants.size()});
+    }
+    else
+    {
+        const auto& text = std::get<std::string>(value);
+        const auto it = m_strings.find(text);
+        if (it != m_strings.end())
+        {
+            return it->second;
+        }
+        m_strings.insert({text, m_constants.size()});
+    }
+    m_constants.emplace_back(value);
+    return m_constants.size() - 1;
+}
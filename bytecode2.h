@@ -0,0 +1,233 @@
+#pragma once
+#include "lexical2.h"
+#include "value2.h"
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <iostream>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Instructions of the bytecode. An opcode takes one byte and is followed by
+// its operand, if any: a varint (7 bits a byte, low bits first) for
+// constants, slots and counts, a 32-bit little endian offset for jumps,
+// relative to the end of the jump, and a 32-bit block index for stubs, so
+// that a stub can be patched into a jump in place.
+enum class Opcode : uint8_t
+{
+    PushFalse = 0,
+    PushTrue,
+    // varint index into the constant pool
+    PushConstant,
+    // varint slot
+    Load,
+    Store,
+    // assignment to an undeclared name, fails once it runs
+    StoreUnknown,
+    Read,
+    // varint count of the values written
+    Write,
+    Jump,
+    JumpIfFalse,
+    Clear,
+    Stub,
+    // Operators are specialized by the type of their operands, which the
+    // parser has checked, so they never look at type tags.
+    AddInt,
+    SubtractInt,
+    MultiplyInt,
+    DivideInt,
+    LessInt,
+    GreaterInt,
+    NotLessInt,
+    NotGreaterInt,
+    EqualInt,
+    NotEqualInt,
+    Concatenate,
+    LessString,
+    GreaterString,
+    NotLessString,
+    NotGreaterString,
+    EqualString,
+    NotEqualString,
+    Not,
+    NegateInt,
+    PlusInt,
+    // Fused instructions, each in place of a sequence of the ones above
+    // (see `patterns`), run in one dispatch without the stack in between.
+    // varint slot: store and clear, `x = ...;`
+    Assign,
+    // varint slot, varint constant: `x = x + c;`
+    Increment,
+    // varint slot, varint constant: load, push and the operator
+    AddVarConst,
+    SubtractVarConst,
+    MultiplyVarConst,
+    DivideVarConst,
+    // varint slot, varint slot: two loads and the operator
+    AddVarVar,
+    SubtractVarVar,
+    MultiplyVarVar,
+    DivideVarVar,
+    // varint slot, varint slot, jump: two loads, the comparison and a jump
+    // if it is false
+    JumpUnlessLessVarVar,
+    JumpUnlessGreaterVarVar,
+    JumpUnlessNotLessVarVar,
+    JumpUnlessNotGreaterVarVar,
+    JumpUnlessEqualVarVar,
+    JumpUnlessNotEqualVarVar,
+    // varint slot, varint constant, jump: the same with a load and a push
+    JumpUnlessLessVarConst,
+    JumpUnlessGreaterVarConst,
+    JumpUnlessNotLessVarConst,
+    JumpUnlessNotGreaterVarConst,
+    JumpUnlessEqualVarConst,
+    JumpUnlessNotEqualVarConst,
+};
+
+constexpr size_t c_opcodes = static_cast<size_t>(Opcode::JumpUnlessNotEqualVarConst) + 1;
+
+// Finds the opcode of operator `type` on operands of type `operands`.
+// Returns false if the operator does not take them.
+bool FindOperator(LexemeType type, ValueType operands, Opcode& op);
+// Opcode of the instruction of a lexeme. Throws for a lexeme that has none.
+Opcode GetOpcode(const Lexeme& lexeme);
+// Mnemonic of an opcode, as the disassembly shows it.
+const char* GetName(Opcode op);
+
+inline size_t ReadVarint(const uint8_t* code, size_t& ip)
+{
+    size_t value = code[ip++];
+    if (value < 0x80)
+    {
+        return value;
+    }
+    value &= 0x7f;
+    for (int shift = 7; ; shift += 7)
+    {
+        const size_t byte = code[ip++];
+        value |= (byte & 0x7f) << shift;
+        if (byte < 0x80)
+        {
+            return value;
+        }
+    }
+}
+
+inline int32_t ReadInt32(const uint8_t* code, size_t& ip)
+{
+    int32_t value;
+    std::memcpy(&value, &code[ip], sizeof(value));
+    ip += sizeof(value);
+    return value;
+}
+
+// What Bytecode::Verify() proves about a program.
+struct Verification
+{
+    // whether the program runs without the checks of the interpreter
+    bool verified{false};
+    // most operands on the stack at once, on any path
+    size_t stackSize{0};
+    // the first problem found otherwise, at the offset of its instruction
+    std::string error;
+};
+
+// Program in the form the interpreter runs, built a lexeme of the Poliz at
+// a time. Lexemes keep their positions: jumps name the position of their
+// target lexeme, and a jump past the lexemes added so far is patched once
+// its target is added.
+//
+// Frequent sequences of instructions are fused as their last lexeme is
+// added; the lexemes of a fused instruction share its offset. A sequence
+// is fused only if no jump lands inside it so far, and only the last of
+// its lexemes can be a jump or end a statement, so neither later jumps
+// (which go to statements and conditions) nor running code that is still
+// growing ever get inside one.
+class Bytecode
+{
+public:
+    // Appends the instruction of the lexeme at position GetCount().
+    void Add(const Lexeme& lexeme);
+    // Puts the instruction of `lexeme` in place of the one at `position`.
+    // Only a jump or a stub can be replaced, by a jump or a stub.
+    void Patch(size_t position, const Lexeme& lexeme);
+    // Puts the instructions of `count` lexemes, at positions from `begin`
+    // on, in place of those of [begin, end). The code after `end` is moved
+    // as it is, so its jumps must not point before `end`.
+    void Replace(size_t begin, size_t end, const Lexeme* lexemes, size_t count);
+    // Drops the instructions from `position` on.
+    void Truncate(size_t position);
+
+    const std::vector<uint8_t>& GetCode() const;
+    const std::vector<TaggedValue>& GetConstants() const;
+    // Lexemes added so far.
+    size_t GetCount() const;
+    // Offset of the instruction of the lexeme at `position`, the end of the
+    // code for GetCount().
+    size_t GetOffset(size_t position) const;
+    // Position of the lexeme whose instruction starts at `offset`.
+    size_t GetPosition(size_t offset) const;
+    // Most operands the code can have on the stack at once. Worked out
+    // along the code in order: statements leave the stack empty and only
+    // jumps within an expression skip code, so it is never short of the
+    // real depth.
+    size_t GetStackSize() const;
+    // Follows every path through the finished code with the depth, and the
+    // kind and type of each operand, of the stack of the interpreter, as it
+    // runs with `variables`. The program is verified if jumps land on
+    // instructions, paths meet with the same stack, the stack never runs
+    // out of operands, slots and constants exist, operators get operands
+    // of their type and read() gets a variable. Programs with stubs or
+    // assignments to undeclared names are not.
+    Verification Verify(const std::vector<TaggedValue>& variables) const;
+
+    // Prints the instruction at `offset` and returns the offset of the next.
+    // Jump targets are offsets, or lexeme positions if `positions` is set.
+    size_t Print(std::ostream& os, size_t offset, bool positions = false) const;
+    // Prints every instruction and the constant pool.
+    void Disassemble(std::ostream& os) const;
+
+private:
+    // Jumps are encoded with offset 0 and set by SetJump().
+    void Encode(const Lexeme& lexeme, std::vector<uint8_t>& code);
+    void SetJump(size_t position, long long int target);
+    size_t AddConstant(const Value& value);
+
+    // An instruction as it was added, before fusion.
+    struct Recent
+    {
+        Opcode op;
+        // slot, constant or jump target
+        long long int operand;
+        size_t position;
+    };
+
+    // Fuses the last instructions if they make one of the sequences.
+    void Fuse();
+    // Whether the last `count` instructions can be fused.
+    bool CanFuse(size_t count) const;
+    // Puts `op` with varint operands in place of the last `count`
+    // instructions, followed by the jump of the last if it is one.
+    void Rewrite(size_t count, Opcode op, std::initializer_list<size_t> operands);
+
+    void UpdateDepth(Opcode op, long long int operand);
+
+    std::vector<uint8_t> m_code;
+    std::vector<uint32_t> m_offsets;
+    // stack depth after the last instruction and the most so far
+    size_t m_depth{0};
+    size_t m_stackSize{0};
+    std::vector<TaggedValue> m_constants;
+    std::unordered_map<long long int, size_t> m_numbers;
+    std::unordered_map<std::string, size_t> m_strings;
+    // position of a jump target not added yet -> position of the jump
+    std::multimap<size_t, size_t> m_fixups;
+    // the last instructions, the longest sequence at most
+    std::vector<Recent> m_recent;
+    // no jump lands after this position, so fusion can start from it
+    size_t m_barrier{0};
+};
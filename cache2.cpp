@@ -0,0 +1,270 @@
+#include "cache2.h"
+#include "poliz2.h"
+#include "source2.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include <unistd.h>
+
+// Bump whenever the layout below or the meaning of an opcode changes.
+static constexpr uint32_t c_version = 4;
+static constexpr char c_magic[8] = {'P', 'O', 'L', 'I', 'Z', 'B', 'C', '\0'};
+
+// File layout: the header, `instructions` records, `variables` records and
+// `stringBytes` of strings, each one a uint32_t length and the characters.
+struct CacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    // opcodes are LexemeType values, so a reordered enum shows up here
+    uint32_t lexemeTypes;
+    uint64_t sourceHash;
+    uint64_t sourceSize;
+    uint64_t instructions;
+    uint64_t variables;
+    uint64_t stringBytes;
+};
+
+// One instruction (`key` is its LexemeType) or one variable, in slot order
+// (`key` is its SymbolId), with its Value: `index` is the alternative and `value` the bool,
+// the integer or the offset of the string.
+struct CacheRecord
+{
+    uint32_t key;
+    uint8_t index;
+    uint8_t reserved[3];
+    int64_t value;
+};
+
+static_assert(sizeof(CacheHeader) == 56 && sizeof(CacheRecord) == 16, "cache layout changed");
+
+static constexpr uint32_t c_lexemeTypes = static_cast<uint32_t>(LexemeType::Eof) + 1;
+
+static uint64_t HashSource(std::string_view source)
+{
+    constexpr uint64_t c_multiplier = 0x9e3779b97f4a7c15ull;
+    uint64_t hash = source.size() * c_multiplier;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= source.size(); i += sizeof(uint64_t))
+    {
+        uint64_t word;
+        std::memcpy(&word, source.data() + i, sizeof(word));
+        hash = (((hash << 29) | (hash >> 35)) ^ word) * c_multiplier;
+    }
+    for (; i < source.size(); ++i)
+    {
+        hash = (hash ^ static_cast<unsigned char>(source[i])) * c_multiplier;
+    }
+    // finalizer of splitmix64, so that every input bit reaches every output bit
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ull;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebull;
+    return hash ^ (hash >> 31);
+}
+
+CacheKey GetCacheKey(std::string_view source)
+{
+    return {HashSource(source), source.size()};
+}
+
+// Checks a record against the string area before anything is decoded.
+static bool IsValid(const CacheRecord& record, std::string_view strings)
+{
+    if (record.index == 2)
+    {
+        uint32_t length;
+        if (record.value < 0 || static_cast<uint64_t>(record.value) + sizeof(length) > strings.size())
+        {
+            return false;
+        }
+        std::memcpy(&length, strings.data() + record.value, sizeof(length));
+        return length <= strings.size() - record.value - sizeof(length);
+    }
+    return record.index < 2;
+}
+
+static Value Decode(const CacheRecord& record, std::string_view strings)
+{
+    switch (record.index)
+    {
+    case 1:
+        return static_cast<long long int>(record.value);
+    case 2:
+    {
+        uint32_t length;
+        std::memcpy(&length, strings.data() + record.value, sizeof(length));
+        return std::string{strings.substr(record.value + sizeof(length), length)};
+    }
+    default:
+        return record.value != 0;
+    }
+}
+
+static bool IsValidInstruction(const CacheRecord& record, const CacheHeader& header)
+{
+    const auto slots = static_cast<int64_t>(header.variables);
+    switch (static_cast<LexemeType>(record.key))
+    {
+    case LexemeType::LoadSlot:
+        return record.index == 1 && record.value >= 0 && record.value < slots;
+    case LexemeType::StoreSlot:
+        return record.index == 1 && record.value >= -1 && record.value < slots;
+    case LexemeType::Goto:
+    case LexemeType::ConditionalGoto:
+        return record.index == 1 && record.value >= 0 && static_cast<uint64_t>(record.value) <= header.instructions;
+    case LexemeType::Write:
+        return record.index == 1 && record.value >= 0;
+    case LexemeType::Literal:
+    case LexemeType::Read:
+    case LexemeType::Clear:
+        return true;
+    case LexemeType::Not:
+    case LexemeType::Multiply:
+    case LexemeType::Divide:
+    case LexemeType::Plus:
+    case LexemeType::Minus:
+    case LexemeType::Less:
+    case LexemeType::Greater:
+    case LexemeType::NotLess:
+    case LexemeType::NotGreater:
+    case LexemeType::Equal:
+    case LexemeType::NotEqual:
+    case LexemeType::UnaryMinus:
+    case LexemeType::UnaryPlus:
+    {
+        // the type of the operands, which the operator must take
+        Opcode op{};
+        return record.index == 1 && record.value >= 0 && record.value <= static_cast<int64_t>(ValueType::String)
+            && FindOperator(static_cast<LexemeType>(record.key), static_cast<ValueType>(record.value), op);
+    }
+    default:
+        // anything else has no instruction, stubs are never cached
+        return false;
+    }
+}
+
+bool LoadCache(const std::string& path, const CacheKey& key, Poliz& poliz)
+{
+    std::unique_ptr<SourceBuffer> file;
+    try
+    {
+        file = std::make_unique<SourceBuffer>(path.c_str());
+    }
+    catch (const std::runtime_error&)
+    {
+        return false;
+    }
+
+    const auto data = file->GetView();
+    CacheHeader header;
+    if (data.size() < sizeof(header))
+    {
+        return false;
+    }
+    std::memcpy(&header, data.data(), sizeof(header));
+    const uint64_t bodySize = data.size() - sizeof(header);
+    if (std::memcmp(header.magic, c_magic, sizeof(c_magic)) != 0
+        || header.version != c_version
+        || header.lexemeTypes != c_lexemeTypes
+        || header.sourceHash != key.hash
+        || header.sourceSize != key.size
+        || header.instructions > bodySize / sizeof(CacheRecord)
+        || header.variables > bodySize / sizeof(CacheRecord) - header.instructions
+        || header.stringBytes != bodySize - (header.instructions + header.variables) * sizeof(CacheRecord))
+    {
+        return false;
+    }
+
+    const auto count = header.instructions + header.variables;
+    std::vector<CacheRecord> records(count);
+    std::memcpy(records.data(), data.data() + sizeof(header), count * sizeof(CacheRecord));
+    const auto strings = data.substr(sizeof(header) + count * sizeof(CacheRecord));
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (!IsValid(records[i], strings) || (i < header.instructions && !IsValidInstruction(records[i], header)))
+        {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < header.instructions; ++i)
+    {
+        poliz.AddLexeme({static_cast<LexemeType>(records[i].key), Decode(records[i], strings)});
+    }
+    for (size_t i = header.instructions; i < count; ++i)
+    {
+        poliz.AddIdentifier(records[i].key, Decode(records[i], strings));
+    }
+    return true;
+}
+
+bool SaveCache(const std::string& path, const CacheKey& key, const Poliz& poliz)
+{
+    std::vector<CacheRecord> records;
+    std::string strings;
+    const auto encode = [&records, &strings](uint32_t key, const Value& value)
+    {
+        CacheRecord record{key, static_cast<uint8_t>(value.index()), {}, 0};
+        if (const auto text = std::get_if<std::string>(&value))
+        {
+            const auto length = static_cast<uint32_t>(text->size());
+            record.value = strings.size();
+            strings.append(reinterpret_cast<const char*>(&length), sizeof(length));
+            strings += *text;
+        }
+        else if (const auto number = std::get_if<long long int>(&value))
+        {
+            record.value = *number;
+        }
+        else
+        {
+            record.value = std::get<bool>(value);
+        }
+        records.push_back(record);
+    };
+
+    const auto& program = poliz.GetProgram();
+    const auto& variables = poliz.GetVariables();
+    const auto& identifiers = poliz.GetIdentifiers();
+    records.reserve(program.size() + variables.size());
+    for (const auto& lex: program)
+    {
+        encode(static_cast<uint32_t>(lex.type), lex.value);
+    }
+    for (size_t slot = 0; slot < variables.size(); ++slot)
+    {
+        encode(identifiers[slot], variables[slot].ToValue());
+    }
+
+    CacheHeader header{};
+    std::memcpy(header.magic, c_magic, sizeof(c_magic));
+    header.version = c_version;
+    header.lexemeTypes = c_lexemeTypes;
+    header.sourceHash = key.hash;
+    header.sourceSize = key.size;
+    header.instructions = program.size();
+    header.variables = variables.size();
+    header.stringBytes = strings.size();
+
+    // readers never see a half written file, concurrent writers race harmlessly
+    const auto temporary = path + ".tmp" + std::to_string(::getpid());
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(CacheRecord));
+        out.write(strings.data(), strings.size());
+        if (!out.flush())
+        {
+            std::remove(temporary.c_str());
+            return false;
+        }
+    }
+    if (std::rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        std::remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+class Poliz;
+
+// Compiled programs kept across runs. A cache file holds the Poliz and the
+// initial variables of one source text, stamped with the hash and size of
+// that text and with the format version, and is ignored for anything else.
+
+struct CacheKey
+{
+    uint64_t hash;
+    uint64_t size;
+};
+
+CacheKey GetCacheKey(std::string_view source);
+
+// Fills an empty `poliz` from the cache file at `path`. Returns false, with
+// `poliz` untouched, if the file is missing, stale or damaged.
+bool LoadCache(const std::string& path, const CacheKey& key, Poliz& poliz);
+// Replaces the cache file atomically. Returns false if it cannot be written.
+bool SaveCache(const std::string& path, const CacheKey& key, const Poliz& poliz);
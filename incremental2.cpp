@@ -0,0 +1,258 @@
+#include "incremental2.h"
+#include "poliz2.h"
+#include "symbols2.h"
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+// Lexes `text`, which starts at `offset` in the source where the scanner
+// line is `line`, as Tokenize() would, recording where each token ends.
+static void Lex(std::string_view text, size_t offset, int line, SymbolTable& symbols,
+                TokenArray& tokens, std::vector<size_t>& ends)
+{
+    Scanner scanner(text, symbols);
+    try
+    {
+        do
+        {
+            auto lexeme = scanner.GetLexeme();
+            tokens.Add(std::move(lexeme), line + scanner.GetCurrentLine() - 1);
+            ends.push_back(offset + scanner.GetPosition());
+        }
+        while (tokens.tokens.back().type != LexemeType::Eof);
+    }
+    catch (const lexical_exception&)
+    {
+        tokens.error = std::current_exception();
+    }
+}
+
+IncrementalCompiler::IncrementalCompiler(std::string source)
+    : m_source{std::move(source)}
+{
+    CompileAll();
+}
+
+IncrementalCompiler::~IncrementalCompiler() = default;
+
+void IncrementalCompiler::Edit(size_t offset, size_t length, std::string_view text)
+{
+    if (offset > m_source.size() || length > m_source.size() - offset)
+    {
+        throw std::out_of_range("edit is out of the source");
+    }
+    size_t first{};
+    size_t last{};
+    const bool partial = m_compiled && FindStatements(offset, length, first, last);
+    m_source.replace(offset, length, text);
+    if (partial && CompileStatements(first, last, static_cast<long long int>(text.size()) - length))
+    {
+        m_partialEdits += 1;
+        return;
+    }
+    CompileAll();
+}
+
+const std::string& IncrementalCompiler::GetSource() const
+{
+    return m_source;
+}
+
+const Poliz& IncrementalCompiler::GetPoliz() const
+{
+    return *m_poliz;
+}
+
+const SymbolTable& IncrementalCompiler::GetSymbols() const
+{
+    return *m_symbols;
+}
+
+size_t IncrementalCompiler::GetPartialEdits() const
+{
+    return m_partialEdits;
+}
+
+void IncrementalCompiler::CompileAll()
+{
+    m_compiled = false;
+    auto symbols = std::make_unique<SymbolTable>();
+    TokenArray tokens;
+    std::vector<size_t> ends;
+    Lex(m_source, 0, 1, *symbols, tokens, ends);
+
+    auto poliz = std::make_unique<Poliz>();
+    std::vector<StatementOutline> statements;
+    Parser parser(tokens, *symbols, *poliz);
+    parser.SetOutline(&statements);
+    parser.Analize();
+
+    m_symbols = std::move(symbols);
+    m_tokens = std::move(tokens);
+    m_ends = std::move(ends);
+    m_statements = std::move(statements);
+    m_poliz = std::move(poliz);
+    m_compiled = true;
+}
+
+// A statement owns the text from the end of the token before it to the end
+// of its last token, so statements tile the program body. Lexing from such a
+// point is exact because the token before is a ';', '{' or '}'.
+bool IncrementalCompiler::FindStatements(size_t offset, size_t length, size_t& first, size_t& last) const
+{
+    if (m_statements.empty())
+    {
+        return false;
+    }
+    const auto start = [this](const StatementOutline& statement) { return m_ends[statement.firstToken - 1]; };
+    const auto end = [this](const StatementOutline& statement) { return m_ends[statement.endToken - 1]; };
+    if (offset < start(m_statements.front()) || offset + length > end(m_statements.back()))
+    {
+        return false;
+    }
+
+    const auto head = std::lower_bound(m_statements.begin(), m_statements.end(), offset,
+        [&end](const StatementOutline& statement, size_t position) { return end(statement) < position; });
+    const auto tail = std::upper_bound(head, m_statements.end(), offset + length,
+        [&start](size_t position, const StatementOutline& statement) { return position < start(statement); });
+    first = head - m_statements.begin();
+    last = tail - m_statements.begin() - 1;
+    return true;
+}
+
+bool IncrementalCompiler::CompileStatements(size_t first, size_t last, long long int shift)
+{
+    const auto firstToken = m_statements[first].firstToken;
+    const auto endToken = m_statements[last].endToken;
+    const auto begin = m_ends[firstToken - 1];
+    const auto end = m_ends[endToken - 1] + shift;
+
+    TokenArray tokens;
+    std::vector<size_t> ends;
+    Lex(std::string_view{m_source}.substr(begin, end - begin), begin,
+        m_tokens.tokens[firstToken - 1].line, *m_symbols, tokens, ends);
+    // the new text must end right after a ';' or '}' too, else it may lex
+    // differently together with what follows
+    const auto count = tokens.tokens.size() - 1;
+    if (tokens.error
+        || (count > 0 && tokens.tokens[count - 1].type != LexemeType::Semicolon
+            && tokens.tokens[count - 1].type != LexemeType::RightBrace)
+        || (count > 0 && ends[count - 1] != end))
+    {
+        return false;
+    }
+
+    Poliz code;
+    const auto& variables = m_poliz->GetVariables();
+    for (size_t slot = 0; slot < variables.size(); ++slot)
+    {
+        code.AddIdentifier(m_poliz->GetIdentifiers()[slot], variables[slot].ToValue());
+    }
+    std::vector<StatementOutline> statements;
+    try
+    {
+        Parser parser(tokens, *m_symbols, code);
+        parser.SetOutline(&statements);
+        parser.AnalizeFragment();
+    }
+    catch (const std::exception&)
+    {
+        // let the full compile report it with the rest of the program around
+        return false;
+    }
+
+    const auto codeBegin = m_statements[first].codeBegin;
+    const auto codeEnd = m_statements[last].codeEnd;
+    const auto& program = code.GetProgram();
+    m_poliz->ReplaceCode(codeBegin, codeEnd, program);
+    const auto codeShift = static_cast<long long int>(program.size()) - static_cast<long long int>(codeEnd - codeBegin);
+
+    // Eof carries the line at the end of the region, newlines after the
+    // last token (or in a region left with none) included
+    const auto lineShift = tokens.tokens.back().line - m_tokens.tokens[endToken - 1].line;
+    for (size_t i = 0; i < count; ++i)
+    {
+        auto& token = tokens.tokens[i];
+        if (token.index == 2)
+        {
+            m_tokens.strings.push_back(std::move(tokens.strings[token.value]));
+            token.value = m_tokens.strings.size() - 1;
+        }
+    }
+    m_tokens.tokens.erase(m_tokens.tokens.begin() + firstToken, m_tokens.tokens.begin() + endToken);
+    m_tokens.tokens.insert(m_tokens.tokens.begin() + firstToken, tokens.tokens.begin(), tokens.tokens.begin() + count);
+    m_ends.erase(m_ends.begin() + firstToken, m_ends.begin() + endToken);
+    m_ends.insert(m_ends.begin() + firstToken, ends.begin(), ends.begin() + count);
+    for (size_t i = firstToken + count; i < m_tokens.tokens.size(); ++i)
+    {
+        m_tokens.tokens[i].line += lineShift;
+        m_ends[i] += shift;
+    }
+
+    const auto tokenShift = static_cast<long long int>(count) - static_cast<long long int>(endToken - firstToken);
+    for (auto& statement: statements)
+    {
+        statement.firstToken += firstToken;
+        statement.endToken += firstToken;
+        statement.codeBegin += codeBegin;
+        statement.codeEnd += codeBegin;
+    }
+    m_statements.erase(m_statements.begin() + first, m_statements.begin() + last + 1);
+    m_statements.insert(m_statements.begin() + first, statements.begin(), statements.end());
+    for (size_t i = first + statements.size(); i < m_statements.size(); ++i)
+    {
+        m_statements[i].firstToken += tokenShift;
+        m_statements[i].endToken += tokenShift;
+        m_statements[i].codeBegin += codeShift;
+        m_statements[i].codeEnd += codeShift;
+    }
+
+    RenumberSymbols();
+    return true;
+}
+
+// A full compile numbers identifiers in order of first appearance. An edit
+// may add a name, or move or drop the first use of one, so check the order
+// and renumber everything if it changed.
+void IncrementalCompiler::RenumberSymbols()
+{
+    constexpr auto c_unused = std::numeric_limits<SymbolId>::max();
+    std::vector<SymbolId> ids(m_symbols->GetSize(), c_unused);
+    SymbolId next{0};
+    bool unchanged{true};
+    for (const auto& token: m_tokens.tokens)
+    {
+        if (token.type == LexemeType::Identifier && ids[token.value] == c_unused)
+        {
+            unchanged = unchanged && token.value == next;
+            ids[token.value] = next++;
+        }
+    }
+    if (unchanged && next == ids.size())
+    {
+        return;
+    }
+
+    std::vector<SymbolId> names(next);
+    for (SymbolId id = 0; id < ids.size(); ++id)
+    {
+        if (ids[id] != c_unused)
+        {
+            names[ids[id]] = id;
+        }
+    }
+    auto symbols = std::make_unique<SymbolTable>();
+    for (const auto id: names)
+    {
+        symbols->Intern(m_symbols->GetName(id));
+    }
+    for (auto& token: m_tokens.tokens)
+    {
+        if (token.type == LexemeType::Identifier)
+        {
+            token.value = ids[token.value];
+        }
+    }
+    m_poliz->RenameSymbols(ids);
+    m_symbols = std::move(symbols);
+}
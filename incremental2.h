@@ -0,0 +1,53 @@
+#pragma once
+#include "syntax2.h"
+#include "tokens2.h"
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class Poliz;
+class SymbolTable;
+
+// Keeps a program compiled across edits of its text. An edit that stays
+// within the top-level statements of the program body re-lexes and re-parses
+// only the statements it touches and splices their code in; anything else
+// (declarations, the program braces, a change of statement boundaries or a
+// compile error) falls back to a full compile. Either way the Poliz, the
+// variables and the symbol ids are what a full compile gives.
+class IncrementalCompiler
+{
+public:
+    // Throws as Compile() does.
+    explicit IncrementalCompiler(std::string source);
+    IncrementalCompiler(const IncrementalCompiler& rhs) = delete;
+    IncrementalCompiler& operator = (const IncrementalCompiler& rhs) = delete;
+    ~IncrementalCompiler();
+
+    // Replaces `length` bytes at `offset` with `text`. On a compile error
+    // the new text is kept, the error thrown, and the next edit compiles in full.
+    void Edit(size_t offset, size_t length, std::string_view text);
+
+    const std::string& GetSource() const;
+    const Poliz& GetPoliz() const;
+    const SymbolTable& GetSymbols() const;
+    // Edits that did not need a full compile.
+    size_t GetPartialEdits() const;
+
+private:
+    void CompileAll();
+    // Statements [first, last] with the edit in them, false if there are none.
+    bool FindStatements(size_t offset, size_t length, size_t& first, size_t& last) const;
+    bool CompileStatements(size_t first, size_t last, long long int shift);
+    void RenumberSymbols();
+
+    std::string m_source;
+    std::unique_ptr<SymbolTable> m_symbols;
+    TokenArray m_tokens;
+    // source offset right after each token
+    std::vector<size_t> m_ends;
+    std::vector<StatementOutline> m_statements;
+    std::unique_ptr<Poliz> m_poliz;
+    bool m_compiled{false};
+    size_t m_partialEdits{0};
+};
@@ -1,345 +1,1004 @@
 #include "interpreter2.h"
+#include "poliz2.h"
+#include "registers2.h"
+#include "jit2.h"
+#include <algorithm>
+#include <functional>
 #include <iostream>
 
-Interpreter::Interpreter(const std::vector<Lexeme>& program,
-                         const std::unordered_map<std::string, Value>& variables)
+Interpreter::Interpreter(const Bytecode& program,
+                         const std::vector<TaggedValue>& variables,
+                         std::istream& input, std::ostream& output,
+                         Poliz* blocks)
     : m_program{program}
     , m_variables{variables}
+    , m_input{input}
+    , m_output{output}
+    , m_blocks{blocks}
 {
+    Reserve();
+}
+
+struct Interpreter::Tier
+{
+    // lexemes of the loop, from its condition to its jump back
+    size_t begin;
+    size_t end;
+    // false for a loop that stays on the stack machine
+    bool lowered{false};
+    RegisterCode code;
+    JitCode native;
+    bool compiled{false};
+    std::unique_ptr<RegisterInterpreter> interpreter;
+    // offset of the code after the loop
+    size_t exit{0};
+    size_t entries{0};
+};
+
+Interpreter::~Interpreter() = default;
+
+#if defined(__GNUC__)
+# define INTERPRETER_THREADED 1
+#else
+# define INTERPRETER_THREADED 0
+#endif
+
+static Dispatch& ActiveDispatch()
+{
+    static Dispatch dispatch = INTERPRETER_THREADED ? Dispatch::Threaded : Dispatch::Switch;
+    return dispatch;
+}
+
+bool SetDispatch(Dispatch dispatch)
+{
+    if (dispatch == Dispatch::Auto)
+    {
+        dispatch = INTERPRETER_THREADED ? Dispatch::Threaded : Dispatch::Switch;
+    }
+    if (dispatch == Dispatch::Threaded && !INTERPRETER_THREADED)
+    {
+        return false;
+    }
+    ActiveDispatch() = dispatch;
+    return true;
+}
+
+Dispatch GetDispatch()
+{
+    return ActiveDispatch();
 }
 
 void Interpreter::Run(bool debug)
 {
-    size_t i{0};
-    while (i < m_program.size())
+    // the program may have grown since the last run
+    Reserve();
+    if (m_threshold != 0)
     {
-        if (debug)
+        m_backEdges.resize(m_program.GetCode().size());
+    }
+    const bool verified = m_verification.verified && m_verifiedSize == m_program.GetCode().size();
+    if (debug)
+    {
+        RunSwitch<true, true>();
+    }
+#if INTERPRETER_THREADED
+    else if (ActiveDispatch() == Dispatch::Threaded)
+    {
+        if (verified)
         {
-            std::cerr << '[' << m_program[i]
-                      << ", ip: " << i
-                      << ", stack: " << m_stack.size() <<  "]\n";
+            RunThreaded<false>();
         }
-        switch (m_program[i].type)
+        else
         {
-        case LexemeType::Identifier:
-        case LexemeType::Literal:
-            m_stack.push(m_program[i]);
-            i += 1;
+            RunThreaded<true>();
+        }
+    }
+#endif
+    else if (verified)
+    {
+        RunSwitch<false, false>();
+    }
+    else
+    {
+        RunSwitch<false, true>();
+    }
+}
+
+template <bool Debug, bool Checked>
+void Interpreter::RunSwitch()
+{
+    // compiling a stub adds code, which may move it
+    const uint8_t* code = m_program.GetCode().data();
+    size_t size = m_program.GetCode().size();
+    const auto& constants = m_program.GetConstants();
+    size_t i{m_ip};
+    while (i < size)
+    {
+        if constexpr (Debug)
+        {
+            std::cerr << '[';
+            m_program.Print(std::cerr, i);
+            std::cerr << ", ip: " << i
+                      << ", stack: " << m_top - m_stack.data() <<  "]\n";
+        }
+        const auto op = static_cast<Opcode>(code[i]);
+        i += 1;
+        switch (op)
+        {
+        case Opcode::PushFalse:
+            PushValue<Checked>(false);
             break;
 
-        case LexemeType::Read:
-            HandleRead();
-            i += 1;
+        case Opcode::PushTrue:
+            PushValue<Checked>(true);
             break;
 
-        case LexemeType::Write:
-            HandleWrite(std::get<long long int>(m_program[i].value));
-            i += 1;
+        case Opcode::PushConstant:
+            PushValue<Checked>(constants[ReadVarint(code, i)]);
             break;
-        
-        case LexemeType::Goto:
-            i = std::get<long long int>(m_program[i].value);
+
+        case Opcode::Load:
+            PushSlot<Checked>(ReadVarint(code, i));
+            break;
+
+        case Opcode::Read:
+            HandleRead<Checked>();
+            break;
+
+        case Opcode::Write:
+            HandleWrite(ReadVarint(code, i));
             break;
         
-        case LexemeType::ConditionalGoto:
-            if (!std::get<bool>(m_stack.top().value))
+        case Opcode::Jump:
+        {
+            const auto relative = ReadInt32(code, i);
+            i += relative;
+            if (relative < 0 && m_threshold != 0 && ++m_backEdges[i] >= m_threshold)
             {
-                i = std::get<long long int>(m_program[i].value);
+                i = Promote(i - relative - 1 - sizeof(int32_t), i);
             }
-            else
+            break;
+        }
+        
+        case Opcode::JumpIfFalse:
+        {
+            const auto relative = ReadInt32(code, i);
+            if (!Resolve(*--m_top).GetBool())
             {
-                i += 1;
+                i += relative;
             }
-            m_stack.pop();
             break;
+        }
         
-        case LexemeType::Assign:
-            HandleAssign();
-            i += 1;
+        case Opcode::Store:
+            HandleStore<Checked>(ReadVarint(code, i));
             break;
 
-        case LexemeType::Clear:
-            m_stack = {};
-            i += 1;
+        case Opcode::StoreUnknown:
+            HandleStore<true>(-1);
             break;
-        
-        case LexemeType::Plus:
-        case LexemeType::Minus:
-        case LexemeType::Multiply:
-        case LexemeType::Divide:
-        case LexemeType::Less:
-        case LexemeType::NotLess:
-        case LexemeType::Greater:
-        case LexemeType::NotGreater:
-        case LexemeType::Equal:
-        case LexemeType::NotEqual:
-        case LexemeType::Or:
-        case LexemeType::And:
-            HandleBinary(m_program[i].type);
-            i += 1;
+
+        case Opcode::Clear:
+            m_top = m_stack.data();
+            break;
+
+        case Opcode::Stub:
+            // becomes a jump to the compiled block, run it next
+            if (!m_blocks)
+            {
+                throw std::runtime_error("block is not compiled");
+            }
+            i -= 1;
+            m_blocks->CompileBlock(m_program.GetPosition(i));
+            code = m_program.GetCode().data();
+            size = m_program.GetCode().size();
+            Reserve();
             break;
         
-        case LexemeType::Not:
-        case LexemeType::UnaryMinus:
-        case LexemeType::UnaryPlus:
-            HandleUnary(m_program[i].type);
-            i += 1;
+        case Opcode::AddInt:
+            HandleInt(std::plus<>{});
             break;
 
-        default:
-            i += 1;
+        case Opcode::SubtractInt:
+            HandleInt(std::minus<>{});
             break;
-        }
-    }
-}
 
-void Interpreter::HandleRead()
-{
-    auto lex = m_stack.top();
-    m_stack.pop();
-    if (lex.type != LexemeType::Identifier)
-    {
-        throw std::runtime_error("identifier expected");
-    }
+        case Opcode::MultiplyInt:
+            HandleInt(std::multiplies<>{});
+            break;
 
-    std::visit(
-        [](auto& v) { std::cin >> v; },
-        ResolveValue(lex));
-}
+        case Opcode::DivideInt:
+            HandleInt(std::divides<>{});
+            break;
 
-void Interpreter::HandleWrite(size_t ctr)
-{
-    std::vector<Lexeme> lexes;
-    for (size_t i = 0; i < ctr; ++i)
-    {
-        lexes.insert(lexes.begin(), m_stack.top());
-        m_stack.pop();
-    }
-    for (auto& lex: lexes)
-    {
-        std::visit(
-            [](auto& v) { std::cout << std::boolalpha << v << " "; },
-            ResolveValue(lex));
-    }
-    std::cout << std::endl;
-}
+        case Opcode::LessInt:
+            HandleInt(std::less<>{});
+            break;
 
-void Interpreter::HandleAssign()
-{
-    auto rhs = m_stack.top();
-    m_stack.pop();
+        case Opcode::GreaterInt:
+            HandleInt(std::greater<>{});
+            break;
+
+        case Opcode::NotLessInt:
+            HandleInt(std::greater_equal<>{});
+            break;
 
-    Value rhsValue = ResolveValue(rhs);
+        case Opcode::NotGreaterInt:
+            HandleInt(std::less_equal<>{});
+            break;
 
-    auto lhs = m_stack.top();
-    m_stack.pop();
+        case Opcode::EqualInt:
+            HandleInt(std::equal_to<>{});
+            break;
 
-    if (lhs.type != LexemeType::Identifier)
-    {
-        throw std::runtime_error("identifier expected");
-    }
+        case Opcode::NotEqualInt:
+            HandleInt(std::not_equal_to<>{});
+            break;
 
-    auto& lhsValue = ResolveValue(lhs);
+        case Opcode::Concatenate:
+            HandleConcatenate();
+            break;
 
-    if (lhsValue.index() != rhsValue.index())
-    {
-        throw std::runtime_error("type mismatch");
-    }
+        case Opcode::LessString:
+            HandleString(std::less<>{});
+            break;
 
-    lhsValue = rhsValue;
+        case Opcode::GreaterString:
+            HandleString(std::greater<>{});
+            break;
 
-    m_stack.push(lhs);
-}
+        case Opcode::NotLessString:
+            HandleString(std::greater_equal<>{});
+            break;
 
-void Interpreter::HandleBinary(LexemeType type)
-{
-    auto rhs = m_stack.top();
-    m_stack.pop();
-    Value rhsValue = ResolveValue(rhs);
+        case Opcode::NotGreaterString:
+            HandleString(std::less_equal<>{});
+            break;
 
-    auto lhs = m_stack.top();
-    m_stack.pop();
-    Value lhsValue = ResolveValue(lhs);
-    
-    if (lhsValue.index() != rhsValue.index())
-    {
-        throw std::runtime_error("type mismatch");
-    }
+        case Opcode::EqualString:
+            HandleString(std::equal_to<>{});
+            break;
 
-    if (std::holds_alternative<std::string>(lhsValue))
-    {
-        Lexeme result{LexemeType::Literal, {}};
-        const auto lhsStr = std::get<std::string>(lhsValue);
-        const auto rhsStr = std::get<std::string>(rhsValue);
-        switch (type)
-        {
-        case LexemeType::Plus:
-            result.value = lhsStr + rhsStr;
+        case Opcode::NotEqualString:
+            HandleString(std::not_equal_to<>{});
             break;
 
-        case LexemeType::Less:
-            result.value = lhsStr < rhsStr;
+        case Opcode::Not:
+            HandleNot();
             break;
 
-        case LexemeType::NotLess:
-            result.value = lhsStr >= rhsStr;
+        case Opcode::NegateInt:
+            HandleNegate();
             break;
 
-        case LexemeType::Greater:
-            result.value = lhsStr > rhsStr;    
+        case Opcode::PlusInt:
+            HandlePlus();
             break;
 
-        case LexemeType::NotGreater:
-            result.value = lhsStr <= rhsStr;
+        case Opcode::Assign:
+            HandleAssign<Checked>(ReadVarint(code, i));
             break;
 
-        case LexemeType::Equal:
-            result.value = lhsStr == rhsStr;
+        case Opcode::Increment:
+            HandleIncrement(code, i, constants);
             break;
 
-        case LexemeType::NotEqual:
-            result.value = lhsStr != rhsStr;
-            break;    
+        case Opcode::AddVarConst:
+            HandleFused<Checked, true>(std::plus<>{}, code, i, constants);
+            break;
 
-        default:
-            throw std::runtime_error("unsupported string operation");
-        }
-        m_stack.push(std::move(result));
-    }
-    else if (std::holds_alternative<long long int>(lhsValue))
-    {
-        Lexeme result{LexemeType::Literal, {}};
-        const auto lhsInt = std::get<long long int>(lhsValue);
-        const auto rhsInt = std::get<long long int>(rhsValue);
-        switch (type)
-        {
-        case LexemeType::Plus:
-            result.value = lhsInt + rhsInt;
+        case Opcode::SubtractVarConst:
+            HandleFused<Checked, true>(std::minus<>{}, code, i, constants);
             break;
-        
-        case LexemeType::Minus:
-            result.value = lhsInt - rhsInt;
+
+        case Opcode::MultiplyVarConst:
+            HandleFused<Checked, true>(std::multiplies<>{}, code, i, constants);
             break;
-        
-        case LexemeType::Multiply:
-            result.value = lhsInt * rhsInt;
+
+        case Opcode::DivideVarConst:
+            HandleFused<Checked, true>(std::divides<>{}, code, i, constants);
             break;
-        
-        case LexemeType::Divide:
-            result.value = lhsInt / rhsInt;
+
+        case Opcode::AddVarVar:
+            HandleFused<Checked, false>(std::plus<>{}, code, i, constants);
             break;
 
-        case LexemeType::Less:
-            result.value = lhsInt < rhsInt;
+        case Opcode::SubtractVarVar:
+            HandleFused<Checked, false>(std::minus<>{}, code, i, constants);
             break;
 
-        case LexemeType::NotLess:
-            result.value = lhsInt >= rhsInt;
+        case Opcode::MultiplyVarVar:
+            HandleFused<Checked, false>(std::multiplies<>{}, code, i, constants);
             break;
 
-        case LexemeType::Greater:
-            result.value = lhsInt > rhsInt;    
+        case Opcode::DivideVarVar:
+            HandleFused<Checked, false>(std::divides<>{}, code, i, constants);
             break;
 
-        case LexemeType::NotGreater:
-            result.value = lhsInt <= rhsInt;
+        case Opcode::JumpUnlessLessVarVar:
+            HandleFusedJump<false>(std::less<>{}, code, i, constants);
             break;
 
-        case LexemeType::Equal:
-            result.value = lhsInt == rhsInt;
+        case Opcode::JumpUnlessGreaterVarVar:
+            HandleFusedJump<false>(std::greater<>{}, code, i, constants);
             break;
 
-        case LexemeType::NotEqual:
-            result.value = lhsInt != rhsInt;
+        case Opcode::JumpUnlessNotLessVarVar:
+            HandleFusedJump<false>(std::greater_equal<>{}, code, i, constants);
+            break;
+
+        case Opcode::JumpUnlessNotGreaterVarVar:
+            HandleFusedJump<false>(std::less_equal<>{}, code, i, constants);
+            break;
+
+        case Opcode::JumpUnlessEqualVarVar:
+            HandleFusedJump<false>(std::equal_to<>{}, code, i, constants);
+            break;
+
+        case Opcode::JumpUnlessNotEqualVarVar:
+            HandleFusedJump<false>(std::not_equal_to<>{}, code, i, constants);
+            break;
+
+        case Opcode::JumpUnlessLessVarConst:
+            HandleFusedJump<true>(std::less<>{}, code, i, constants);
+            break;
+
+        case Opcode::JumpUnlessGreaterVarConst:
+            HandleFusedJump<true>(std::greater<>{}, code, i, constants);
+            break;
+
+        case Opcode::JumpUnlessNotLessVarConst:
+            HandleFusedJump<true>(std::greater_equal<>{}, code, i, constants);
+            break;
+
+        case Opcode::JumpUnlessNotGreaterVarConst:
+            HandleFusedJump<true>(std::less_equal<>{}, code, i, constants);
+            break;
+
+        case Opcode::JumpUnlessEqualVarConst:
+            HandleFusedJump<true>(std::equal_to<>{}, code, i, constants);
+            break;
+
+        case Opcode::JumpUnlessNotEqualVarConst:
+            HandleFusedJump<true>(std::not_equal_to<>{}, code, i, constants);
             break;
-        
-        default:
-            throw std::runtime_error("unsupported string operation");
         }
-        m_stack.push(std::move(result));
     }
-    else if (std::holds_alternative<bool>(lhsValue))
+    m_ip = i;
+}
+
+#if INTERPRETER_THREADED
+
+// GCC otherwise merges the jumps at the end of the handlers back into one
+#if !defined(__clang__)
+# pragma GCC push_options
+# pragma GCC optimize("no-gcse", "no-crossjumping")
+#endif
+
+// Same handlers as RunSwitch(), each ending in a jump of its own to the
+// next handler, which is easier to predict than the one shared jump of the
+// switch.
+template <bool Checked>
+void Interpreter::RunThreaded()
+{
+    static const void* const handlers[] = {
+        &&PushFalse,
+        &&PushTrue,
+        &&PushConstant,
+        &&Load,
+        &&Store,
+        &&StoreUnknown,
+        &&Read,
+        &&Write,
+        &&Jump,
+        &&JumpIfFalse,
+        &&Clear,
+        &&Stub,
+        &&AddInt,
+        &&SubtractInt,
+        &&MultiplyInt,
+        &&DivideInt,
+        &&LessInt,
+        &&GreaterInt,
+        &&NotLessInt,
+        &&NotGreaterInt,
+        &&EqualInt,
+        &&NotEqualInt,
+        &&Concatenate,
+        &&LessString,
+        &&GreaterString,
+        &&NotLessString,
+        &&NotGreaterString,
+        &&EqualString,
+        &&NotEqualString,
+        &&Not,
+        &&NegateInt,
+        &&PlusInt,
+        &&Assign,
+        &&Increment,
+        &&AddVarConst,
+        &&SubtractVarConst,
+        &&MultiplyVarConst,
+        &&DivideVarConst,
+        &&AddVarVar,
+        &&SubtractVarVar,
+        &&MultiplyVarVar,
+        &&DivideVarVar,
+        &&JumpUnlessLessVarVar,
+        &&JumpUnlessGreaterVarVar,
+        &&JumpUnlessNotLessVarVar,
+        &&JumpUnlessNotGreaterVarVar,
+        &&JumpUnlessEqualVarVar,
+        &&JumpUnlessNotEqualVarVar,
+        &&JumpUnlessLessVarConst,
+        &&JumpUnlessGreaterVarConst,
+        &&JumpUnlessNotLessVarConst,
+        &&JumpUnlessNotGreaterVarConst,
+        &&JumpUnlessEqualVarConst,
+        &&JumpUnlessNotEqualVarConst,
+    };
+    static_assert(sizeof(handlers) / sizeof(handlers[0]) == c_opcodes, "one handler per opcode");
+
+    const uint8_t* code = m_program.GetCode().data();
+    size_t size = m_program.GetCode().size();
+    const auto& constants = m_program.GetConstants();
+    size_t i{m_ip};
+    Opcode op{};
+
+#define DISPATCH() \
+    if (i >= size) \
+    { \
+        goto Done; \
+    } \
+    op = static_cast<Opcode>(code[i++]); \
+    goto *handlers[static_cast<size_t>(op)]
+
+    DISPATCH();
+
+PushFalse:
+    PushValue<Checked>(false);
+    DISPATCH();
+
+PushTrue:
+    PushValue<Checked>(true);
+    DISPATCH();
+
+PushConstant:
+    PushValue<Checked>(constants[ReadVarint(code, i)]);
+    DISPATCH();
+
+Load:
+    PushSlot<Checked>(ReadVarint(code, i));
+    DISPATCH();
+
+Store:
+    HandleStore<Checked>(ReadVarint(code, i));
+    DISPATCH();
+
+StoreUnknown:
+    HandleStore<true>(-1);
+    DISPATCH();
+
+Read:
+    HandleRead<Checked>();
+    DISPATCH();
+
+Write:
+    HandleWrite(ReadVarint(code, i));
+    DISPATCH();
+
+Jump:
     {
-        Lexeme result{LexemeType::Literal, {}};
-        const auto lhsInt = std::get<bool>(lhsValue);
-        const auto rhsInt = std::get<bool>(rhsValue);
-        switch (type)
+        const auto relative = ReadInt32(code, i);
+        i += relative;
+        if (relative < 0 && m_threshold != 0 && ++m_backEdges[i] >= m_threshold)
         {
-        case LexemeType::Or:
-            result.value = lhsInt || rhsInt;
-            break;
-    
-        case LexemeType::And:
-            result.value = lhsInt && rhsInt;
-            break;
+            i = Promote(i - relative - 1 - sizeof(int32_t), i);
+        }
+    }
+    DISPATCH();
 
-        default:
-            throw std::runtime_error("unsupported bool operation");
+JumpIfFalse:
+    {
+        const auto relative = ReadInt32(code, i);
+        if (!Resolve(*--m_top).GetBool())
+        {
+            i += relative;
         }
-        m_stack.push(std::move(result));
     }
-    else
+    DISPATCH();
+
+Clear:
+    m_top = m_stack.data();
+    DISPATCH();
+
+Stub:
+    // becomes a jump to the compiled block, run it next
+    if (!m_blocks)
+    {
+        throw std::runtime_error("block is not compiled");
+    }
+    i -= 1;
+    m_blocks->CompileBlock(m_program.GetPosition(i));
+    code = m_program.GetCode().data();
+    size = m_program.GetCode().size();
+    Reserve();
+    DISPATCH();
+
+AddInt:
+    HandleInt(std::plus<>{});
+    DISPATCH();
+
+SubtractInt:
+    HandleInt(std::minus<>{});
+    DISPATCH();
+
+MultiplyInt:
+    HandleInt(std::multiplies<>{});
+    DISPATCH();
+
+DivideInt:
+    HandleInt(std::divides<>{});
+    DISPATCH();
+
+LessInt:
+    HandleInt(std::less<>{});
+    DISPATCH();
+
+GreaterInt:
+    HandleInt(std::greater<>{});
+    DISPATCH();
+
+NotLessInt:
+    HandleInt(std::greater_equal<>{});
+    DISPATCH();
+
+NotGreaterInt:
+    HandleInt(std::less_equal<>{});
+    DISPATCH();
+
+EqualInt:
+    HandleInt(std::equal_to<>{});
+    DISPATCH();
+
+NotEqualInt:
+    HandleInt(std::not_equal_to<>{});
+    DISPATCH();
+
+Concatenate:
+    HandleConcatenate();
+    DISPATCH();
+
+LessString:
+    HandleString(std::less<>{});
+    DISPATCH();
+
+GreaterString:
+    HandleString(std::greater<>{});
+    DISPATCH();
+
+NotLessString:
+    HandleString(std::greater_equal<>{});
+    DISPATCH();
+
+NotGreaterString:
+    HandleString(std::less_equal<>{});
+    DISPATCH();
+
+EqualString:
+    HandleString(std::equal_to<>{});
+    DISPATCH();
+
+NotEqualString:
+    HandleString(std::not_equal_to<>{});
+    DISPATCH();
+
+Not:
+    HandleNot();
+    DISPATCH();
+
+NegateInt:
+    HandleNegate();
+    DISPATCH();
+
+PlusInt:
+    HandlePlus();
+    DISPATCH();
+
+Assign:
+    HandleAssign<Checked>(ReadVarint(code, i));
+    DISPATCH();
+
+Increment:
+    HandleIncrement(code, i, constants);
+    DISPATCH();
+
+AddVarConst:
+    HandleFused<Checked, true>(std::plus<>{}, code, i, constants);
+    DISPATCH();
+
+SubtractVarConst:
+    HandleFused<Checked, true>(std::minus<>{}, code, i, constants);
+    DISPATCH();
+
+MultiplyVarConst:
+    HandleFused<Checked, true>(std::multiplies<>{}, code, i, constants);
+    DISPATCH();
+
+DivideVarConst:
+    HandleFused<Checked, true>(std::divides<>{}, code, i, constants);
+    DISPATCH();
+
+AddVarVar:
+    HandleFused<Checked, false>(std::plus<>{}, code, i, constants);
+    DISPATCH();
+
+SubtractVarVar:
+    HandleFused<Checked, false>(std::minus<>{}, code, i, constants);
+    DISPATCH();
+
+MultiplyVarVar:
+    HandleFused<Checked, false>(std::multiplies<>{}, code, i, constants);
+    DISPATCH();
+
+DivideVarVar:
+    HandleFused<Checked, false>(std::divides<>{}, code, i, constants);
+    DISPATCH();
+
+JumpUnlessLessVarVar:
+    HandleFusedJump<false>(std::less<>{}, code, i, constants);
+    DISPATCH();
+
+JumpUnlessGreaterVarVar:
+    HandleFusedJump<false>(std::greater<>{}, code, i, constants);
+    DISPATCH();
+
+JumpUnlessNotLessVarVar:
+    HandleFusedJump<false>(std::greater_equal<>{}, code, i, constants);
+    DISPATCH();
+
+JumpUnlessNotGreaterVarVar:
+    HandleFusedJump<false>(std::less_equal<>{}, code, i, constants);
+    DISPATCH();
+
+JumpUnlessEqualVarVar:
+    HandleFusedJump<false>(std::equal_to<>{}, code, i, constants);
+    DISPATCH();
+
+JumpUnlessNotEqualVarVar:
+    HandleFusedJump<false>(std::not_equal_to<>{}, code, i, constants);
+    DISPATCH();
+
+JumpUnlessLessVarConst:
+    HandleFusedJump<true>(std::less<>{}, code, i, constants);
+    DISPATCH();
+
+JumpUnlessGreaterVarConst:
+    HandleFusedJump<true>(std::greater<>{}, code, i, constants);
+    DISPATCH();
+
+JumpUnlessNotLessVarConst:
+    HandleFusedJump<true>(std::greater_equal<>{}, code, i, constants);
+    DISPATCH();
+
+JumpUnlessNotGreaterVarConst:
+    HandleFusedJump<true>(std::less_equal<>{}, code, i, constants);
+    DISPATCH();
+
+JumpUnlessEqualVarConst:
+    HandleFusedJump<true>(std::equal_to<>{}, code, i, constants);
+    DISPATCH();
+
+JumpUnlessNotEqualVarConst:
+    HandleFusedJump<true>(std::not_equal_to<>{}, code, i, constants);
+    DISPATCH();
+
+#undef DISPATCH
+
+Done:
+    m_ip = i;
+}
+
+#if !defined(__clang__)
+# pragma GCC pop_options
+#endif
+
+#endif
+
+void Interpreter::EnableTiering(const std::vector<Lexeme>& program, size_t threshold, bool native, bool perfMap)
+{
+    if (m_blocks)
     {
-        throw std::runtime_error("unknown type");
+        return;
     }
+    m_lexemes = &program;
+    m_threshold = threshold;
+    m_native = native && JitCode::IsAvailable();
+    m_perfMap = perfMap;
+    m_backEdges.assign(m_program.GetCode().size(), 0);
 }
 
-void Interpreter::HandleUnary(LexemeType type)
+void Interpreter::PrintTiers(std::ostream& os) const
 {
-    auto op = m_stack.top();
-    m_stack.pop();
-    Value opValue = ResolveValue(op);
-    
-    if (std::holds_alternative<bool>(opValue))
-    {
-        const auto opInt = std::get<bool>(opValue);
-        switch (type)
+    std::vector<const Tier*> tiers;
+    for (const auto& [header, tier]: m_tiers)
+    {
+        tiers.push_back(tier.get());
+    }
+    std::sort(tiers.begin(), tiers.end(), [](const Tier* lhs, const Tier* rhs) { return lhs->begin < rhs->begin; });
+    os << tiers.size() << " loops hot after " << m_threshold << " jumps back\n";
+    for (const auto tier: tiers)
+    {
+        os << "  loop at lexemes " << tier->begin << "-" << tier->end << ": ";
+        if (tier->lowered)
         {
-        case LexemeType::Not:
-            m_stack.push({LexemeType::Literal, !opInt});
-            break;
-        
-        default:
-            throw std::runtime_error("unsupported bool operation");
+            os << tier->code.GetCode().size() << " register instructions, "
+               << (tier->compiled ? "native" : "interpreted") << ", entered " << tier->entries
+               << (tier->entries == 1 ? " time\n" : " times\n");
+        }
+        else
+        {
+            os << "stays on the stack machine\n";
         }
     }
-    else if (std::holds_alternative<long long int>(opValue))
+    os.flush();
+}
+
+size_t Interpreter::Promote(size_t jump, size_t header)
+{
+    auto it = m_tiers.find(header);
+    if (it == m_tiers.end())
     {
-        const auto opInt = std::get<long long int>(opValue);
-        switch (type)
+        auto tier = std::make_unique<Tier>();
+        tier->end = m_program.GetPosition(jump);
+        tier->begin = static_cast<size_t>(std::get<long long int>((*m_lexemes)[tier->end].value));
+        tier->lowered = m_program.GetOffset(tier->begin) == header
+            && tier->code.LowerLoop(*m_lexemes, m_variables.size(), tier->begin, tier->end);
+        if (tier->lowered)
         {
-        case LexemeType::UnaryMinus:
-            m_stack.push({LexemeType::Literal, -opInt});
-            break;
-        
-        case LexemeType::UnaryPlus:
-            m_stack.push({LexemeType::Literal, +opInt});
-            break;
-        
-        default:
-            throw std::runtime_error("unsupported bool operation");
+            tier->interpreter = std::make_unique<RegisterInterpreter>(tier->code, m_variables, m_input, m_output);
+            tier->compiled = m_native && tier->native.Compile(tier->code, m_variables);
+            if (tier->compiled && m_perfMap)
+            {
+                const auto name = "loop at lexemes " + std::to_string(tier->begin) + "-" + std::to_string(tier->end);
+                tier->native.WritePerfMap(name.c_str());
+            }
+            tier->exit = m_program.GetOffset(tier->end + 1);
         }
+        it = m_tiers.emplace(header, std::move(tier)).first;
+    }
+
+    auto& tier = *it->second;
+    // the loop starts on an empty stack in its tier
+    if (!tier.lowered || m_top != m_stack.data())
+    {
+        m_backEdges[header] = 0;
+        return header;
+    }
+    auto& registers = *tier.interpreter;
+    std::copy(m_variables.begin(), m_variables.end(), registers.GetFrame());
+    if (tier.compiled)
+    {
+        registers.Run(tier.native);
     }
     else
     {
-        throw std::runtime_error("unknown type");
+        registers.Run();
+    }
+    std::copy(registers.GetFrame(), registers.GetFrame() + m_variables.size(), m_variables.begin());
+    ++tier.entries;
+    return tier.exit;
+}
+
+const Verification& Interpreter::Verify()
+{
+    m_verification = m_program.Verify(m_variables);
+    m_verifiedSize = m_program.GetCode().size();
+    if (m_verification.verified && m_top == m_stack.data())
+    {
+        m_stack.resize(m_verification.stackSize);
+        m_stack.shrink_to_fit();
+        m_top = m_stack.data();
+    }
+    return m_verification;
+}
+
+void Interpreter::Reserve()
+{
+    if (m_verification.verified && m_verifiedSize == m_program.GetCode().size())
+    {
+        // sized by the verifier
+        return;
+    }
+    const auto size = std::max<size_t>(m_program.GetStackSize(), 1);
+    if (m_stack.size() < size)
+    {
+        const auto depth = m_top - m_stack.data();
+        m_stack.resize(size);
+        m_top = m_stack.data() + depth;
     }
 }
 
-Value& Interpreter::ResolveValue(Lexeme& lex)
+template <bool Checked>
+void Interpreter::PushValue(const TaggedValue& value)
 {
-    if (lex.type == LexemeType::Literal)
+    if (Checked && m_top == m_stack.data() + m_stack.size())
     {
-        return lex.value;
+        throw std::runtime_error("stack overflow");
     }
-    else if (lex.type != LexemeType::Identifier)
+    m_top->value = value;
+    m_top->slot = -1;
+    ++m_top;
+}
+
+template <bool Checked>
+void Interpreter::PushSlot(long long int slot)
+{
+    if (Checked && m_top == m_stack.data() + m_stack.size())
     {
-        throw std::runtime_error("invalid value");
+        throw std::runtime_error("stack overflow");
     }
-    if (const auto it = m_variables.find(std::get<std::string>(lex.value));
-        it != m_variables.end())
+    m_top->slot = slot;
+    ++m_top;
+}
+
+template <bool Checked>
+void Interpreter::HandleRead()
+{
+    const auto& operand = *--m_top;
+    if (Checked && operand.slot < 0)
     {
-        return it->second;
+        throw std::runtime_error("identifier expected");
     }
-    throw std::runtime_error("unknown variable");
+
+    auto& variable = m_variables[operand.slot];
+    switch (variable.GetType())
+    {
+    case TaggedValue::Type::Bool:
+    {
+        bool value{};
+        m_input >> value;
+        variable = value;
+        break;
+    }
+
+    case TaggedValue::Type::Int:
+    {
+        long long int value{};
+        m_input >> value;
+        variable = value;
+        break;
+    }
+
+    case TaggedValue::Type::String:
+    {
+        std::string value;
+        m_input >> value;
+        variable = TaggedValue{std::string_view{value}};
+        break;
+    }
+    }
+}
+
+void Interpreter::HandleWrite(size_t ctr)
+{
+    for (auto operand = m_top - ctr; operand != m_top; ++operand)
+    {
+        m_output << Resolve(*operand) << " ";
+    }
+    m_top -= ctr;
+    m_output << std::endl;
+}
+
+// The value of an assignment is the variable itself, as for a load.
+template <bool Checked>
+void Interpreter::HandleStore(long long int slot)
+{
+    auto& rhs = m_top[-1];
+    if (Checked && slot < 0)
+    {
+        throw std::runtime_error("unknown variable");
+    }
+
+    if (rhs.slot < 0)
+    {
+        m_variables[slot] = std::move(rhs.value);
+    }
+    else
+    {
+        m_variables[slot] = m_variables[rhs.slot];
+    }
+    rhs.slot = slot;
+}
+
+template <typename Operation>
+void Interpreter::HandleInt(Operation operation)
+{
+    auto& lhs = m_top[-2];
+    lhs.value = operation(Resolve(lhs).GetInt(), Resolve(m_top[-1]).GetInt());
+    lhs.slot = -1;
+    --m_top;
+}
+
+template <typename Operation>
+void Interpreter::HandleString(Operation operation)
+{
+    auto& lhs = m_top[-2];
+    lhs.value = static_cast<bool>(operation(Resolve(lhs).GetString(), Resolve(m_top[-1]).GetString()));
+    lhs.slot = -1;
+    --m_top;
+}
+
+void Interpreter::HandleConcatenate()
+{
+    auto& lhs = m_top[-2];
+    lhs.value = TaggedValue::Concatenate(Resolve(lhs).GetString(), Resolve(m_top[-1]).GetString());
+    lhs.slot = -1;
+    --m_top;
+}
+
+void Interpreter::HandleNot()
+{
+    auto& operand = m_top[-1];
+    operand.value = !Resolve(operand).GetBool();
+    operand.slot = -1;
+}
+
+void Interpreter::HandleNegate()
+{
+    auto& operand = m_top[-1];
+    operand.value = -Resolve(operand).GetInt();
+    operand.slot = -1;
+}
+
+// Takes the value of a variable operand, so that a later assignment does
+// not change it.
+void Interpreter::HandlePlus()
+{
+    auto& operand = m_top[-1];
+    operand.value = Resolve(operand).GetInt();
+    operand.slot = -1;
+}
+
+template <bool Checked>
+void Interpreter::HandleAssign(long long int slot)
+{
+    HandleStore<Checked>(slot);
+    m_top = m_stack.data();
+}
+
+void Interpreter::HandleIncrement(const uint8_t* code, size_t& i, const std::vector<TaggedValue>& constants)
+{
+    auto& variable = m_variables[ReadVarint(code, i)];
+    const auto step = constants[ReadVarint(code, i)].GetInt();
+    variable = variable.GetInt() + step;
+}
+
+// The result of an operator goes on the stack, a comparison jumps instead
+// if it is false.
+template <bool Checked, bool Constant, typename Operation>
+void Interpreter::HandleFused(Operation operation, const uint8_t* code, size_t& i, const std::vector<TaggedValue>& constants)
+{
+    const auto lhs = m_variables[ReadVarint(code, i)].GetInt();
+    const auto index = ReadVarint(code, i);
+    const auto rhs = Constant ? constants[index].GetInt() : m_variables[index].GetInt();
+    PushValue<Checked>(operation(lhs, rhs));
+}
+
+template <bool Constant, typename Operation>
+void Interpreter::HandleFusedJump(Operation operation, const uint8_t* code, size_t& i, const std::vector<TaggedValue>& constants)
+{
+    const auto lhs = m_variables[ReadVarint(code, i)].GetInt();
+    const auto index = ReadVarint(code, i);
+    const auto rhs = Constant ? constants[index].GetInt() : m_variables[index].GetInt();
+    const auto relative = ReadInt32(code, i);
+    if (!operation(lhs, rhs))
+    {
+        i += relative;
+    }
+}
+
+TaggedValue& Interpreter::Resolve(Operand& operand)
+{
+    return operand.slot < 0 ? operand.value : m_variables[operand.slot];
 }
@@ -1,28 +1,142 @@
 #pragma once
+#include "bytecode2.h"
 #include "lexical2.h"
+#include "symbols2.h"
+#include "value2.h"
+#include <iostream>
+#include <memory>
 #include <unordered_map>
 #include <vector>
-#include <stack>
 
+class Poliz;
+
+// How Run() goes from one instruction to the next. Threaded dispatch jumps
+// from each handler straight to the next one through a table of labels
+// (GCC and Clang); the switch loop is the portable fallback and is the one
+// that traces.
+enum class Dispatch
+{
+    Auto = 0,
+    Switch,
+    Threaded,
+};
+
+// Dispatch of every interpreter, threaded where available unless set. Returns
+// false if the compiler lacks it.
+bool SetDispatch(Dispatch dispatch);
+// Dispatch set for every interpreter, Switch or Threaded.
+Dispatch GetDispatch();
+
+// Runs a program that outlives it, on its own copy of the variables. Stubs
+// are compiled by `blocks`, the Poliz of the program, if there is one.
 class Interpreter
 {
 public:
-    Interpreter(const std::vector<Lexeme>& program,
-                const std::unordered_map<std::string, Value>& variables);
+    Interpreter(const Bytecode& program,
+                const std::vector<TaggedValue>& variables,
+                std::istream& input = std::cin, std::ostream& output = std::cout,
+                Poliz* blocks = nullptr);
     Interpreter(const Interpreter& rhs) = delete;
     Interpreter& operator = (const Interpreter& rhs) = delete;
+    ~Interpreter();
 
+    // Runs from where the last Run() stopped to the end of the program, so
+    // a program that grows can be run on.
     void Run(bool debug = false);
 
+    // Counts the jumps back to each loop condition. Once a loop has jumped
+    // back `threshold` times, it is lowered from `program`, the Poliz of the
+    // bytecode, to registers and compiled to native code if `native` is set
+    // and the JIT is available, and from its next jump back on the loop
+    // runs there until it exits. Loops that do not lower stay here. Not for
+    // programs with stubs, whose code grows as they run. `perfMap` lists
+    // the native code of each loop for perf, see JitCode::WritePerfMap().
+    void EnableTiering(const std::vector<Lexeme>& program, size_t threshold, bool native, bool perfMap = false);
+    // Prints the loops promoted so far.
+    void PrintTiers(std::ostream& os) const;
+
+    // Verifies the program as it is (see Bytecode::Verify()). If it is
+    // verified, Run() goes without the checks the verifier has made, on a
+    // stack of just the size it has found, until the program grows.
+    const Verification& Verify();
+
 private:
+    // Without `Checked` operands are neither checked for room on the
+    // stack nor for a variable where one is needed.
+    template <bool Debug, bool Checked>
+    void RunSwitch();
+    // only built where threaded dispatch is available
+    template <bool Checked>
+    void RunThreaded();
+
+    // An operand on the stack: a value, or the variable at `slot` if it is
+    // not negative, as left by a load or an assignment.
+    struct Operand
+    {
+        TaggedValue value;
+        long long int slot{-1};
+    };
+
+    // Sizes the stack for the program, as far as it is compiled.
+    void Reserve();
+    template <bool Checked>
+    void PushValue(const TaggedValue& value);
+    template <bool Checked>
+    void PushSlot(long long int slot);
+
+    template <bool Checked>
     void HandleRead();
     void HandleWrite(size_t ctr);
-    void HandleAssign();
-    void HandleBinary(LexemeType type);
-    void HandleUnary(LexemeType type);
-    Value& ResolveValue(Lexeme& lex);
-
-    const std::vector<Lexeme> m_program;
-    std::unordered_map<std::string, Value> m_variables;
-    std::stack<Lexeme> m_stack;
+    template <bool Checked>
+    void HandleStore(long long int slot);
+    // Operators on operands of the type they take, with the result in
+    // place of the left (only) operand.
+    template <typename Operation>
+    void HandleInt(Operation operation);
+    template <typename Operation>
+    void HandleString(Operation operation);
+    void HandleConcatenate();
+    void HandleNot();
+    void HandleNegate();
+    void HandlePlus();
+    // Fused instructions read their operands at `i`: a variable, then a
+    // variable or a constant as `Constant` says.
+    template <bool Checked>
+    void HandleAssign(long long int slot);
+    void HandleIncrement(const uint8_t* code, size_t& i, const std::vector<TaggedValue>& constants);
+    template <bool Checked, bool Constant, typename Operation>
+    void HandleFused(Operation operation, const uint8_t* code, size_t& i, const std::vector<TaggedValue>& constants);
+    template <bool Constant, typename Operation>
+    void HandleFusedJump(Operation operation, const uint8_t* code, size_t& i, const std::vector<TaggedValue>& constants);
+    TaggedValue& Resolve(Operand& operand);
+
+    // A loop lowered once it got hot.
+    struct Tier;
+    // Runs the loop whose condition is at `header`, having jumped back to
+    // it from `jump`, in its tier if it has one. Returns where to go on.
+    size_t Promote(size_t jump, size_t header);
+
+    const Bytecode& m_program;
+    std::vector<TaggedValue> m_variables;
+    std::istream& m_input;
+    std::ostream& m_output;
+    Poliz* m_blocks;
+    size_t m_ip{0};
+    // Operands live in place, [data, m_top) in use. Entries above the top
+    // keep their old values until they are pushed over.
+    std::vector<Operand> m_stack;
+    Operand* m_top{};
+    // of the code verified so far, if any
+    Verification m_verification;
+    size_t m_verifiedSize{0};
+
+    // no tiering if it is 0
+    size_t m_threshold{0};
+    const std::vector<Lexeme>* m_lexemes{};
+    bool m_native{false};
+    bool m_perfMap{false};
+    // jumps back to each offset so far
+    std::vector<uint32_t> m_backEdges;
+    // by the offset of the loop condition, null for a loop that stays
+    std::unordered_map<size_t, std::unique_ptr<Tier>> m_tiers;
 };
@@ -0,0 +1,399 @@
+#include "jit2.h"
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__x86_64__) && defined(__linux__)
+# define JIT_X86_64 1
+# include <sys/mman.h>
+# include <unistd.h>
+#else
+# define JIT_X86_64 0
+#endif
+
+#if JIT_X86_64
+
+namespace
+{
+
+// Native code works on TaggedValue in place: the value in its first 8 bytes
+// (a bool as 0 or 1 in all of them), the type tag in the byte after.
+constexpr int32_t c_typeOffset = 8;
+static_assert(sizeof(TaggedValue) == 16, "a register takes 16 bytes");
+
+// General purpose registers by their number in the encoding.
+enum Gpr : uint8_t
+{
+    Rax = 0,
+    Rcx = 1,
+};
+
+// Condition codes of jcc and setcc.
+enum Condition : uint8_t
+{
+    Equal = 0x4,
+    NotEqual = 0x5,
+    Less = 0xc,
+    NotLess = 0xd,
+    NotGreater = 0xe,
+    Greater = 0xf,
+};
+
+// The little of x86-64 the JIT needs. The frame is addressed through rbx
+// and the context of the callbacks is kept in r12, both callee saved.
+class Assembler
+{
+public:
+    std::vector<uint8_t> code;
+
+    void Bytes(std::initializer_list<uint8_t> bytes)
+    {
+        code.insert(code.end(), bytes);
+    }
+    void Int32(int32_t value)
+    {
+        uint8_t bytes[sizeof(value)];
+        std::memcpy(bytes, &value, sizeof(value));
+        code.insert(code.end(), bytes, bytes + sizeof(value));
+    }
+    void Int64(uint64_t value)
+    {
+        uint8_t bytes[sizeof(value)];
+        std::memcpy(bytes, &value, sizeof(value));
+        code.insert(code.end(), bytes, bytes + sizeof(value));
+    }
+
+    // mov reg, [rbx + offset]
+    void Load(Gpr reg, int32_t offset)
+    {
+        Bytes({0x48, 0x8b, static_cast<uint8_t>(0x83 | reg << 3)});
+        Int32(offset);
+    }
+    // mov [rbx + offset], reg
+    void Store(int32_t offset, Gpr reg)
+    {
+        Bytes({0x48, 0x89, static_cast<uint8_t>(0x83 | reg << 3)});
+        Int32(offset);
+    }
+    // movzx eax, byte [rbx + offset]
+    void LoadByte(int32_t offset)
+    {
+        Bytes({0x0f, 0xb6, 0x83});
+        Int32(offset);
+    }
+    // mov byte [rbx + offset], value
+    void StoreByte(int32_t offset, uint8_t value)
+    {
+        Bytes({0xc6, 0x83});
+        Int32(offset);
+        Bytes({value});
+    }
+    // setcc al; movzx eax, al
+    void Set(Condition condition)
+    {
+        Bytes({0x0f, static_cast<uint8_t>(0x90 | condition), 0xc0, 0x0f, 0xb6, 0xc0});
+    }
+    // jmp or jcc with a 32-bit offset, returns where the offset goes
+    size_t Jump()
+    {
+        Bytes({0xe9});
+        Int32(0);
+        return code.size() - sizeof(int32_t);
+    }
+    size_t Jump(Condition condition)
+    {
+        Bytes({0x0f, static_cast<uint8_t>(0x80 | condition)});
+        Int32(0);
+        return code.size() - sizeof(int32_t);
+    }
+    void Patch(size_t at, size_t target)
+    {
+        const auto relative = static_cast<int32_t>(static_cast<long long int>(target)
+                                                   - static_cast<long long int>(at + sizeof(int32_t)));
+        std::memcpy(&code[at], &relative, sizeof(relative));
+    }
+};
+
+int32_t GetOffset(uint32_t reg)
+{
+    return static_cast<int32_t>(reg * sizeof(TaggedValue));
+}
+
+Condition GetCondition(RegisterOp op)
+{
+    switch (op)
+    {
+    case RegisterOp::LessInt:
+    case RegisterOp::JumpUnlessLessInt:
+        return Less;
+    case RegisterOp::GreaterInt:
+    case RegisterOp::JumpUnlessGreaterInt:
+        return Greater;
+    case RegisterOp::NotLessInt:
+    case RegisterOp::JumpUnlessNotLessInt:
+        return NotLess;
+    case RegisterOp::NotGreaterInt:
+    case RegisterOp::JumpUnlessNotGreaterInt:
+        return NotGreater;
+    case RegisterOp::EqualInt:
+    case RegisterOp::JumpUnlessEqualInt:
+        return Equal;
+    default:
+        return NotEqual;
+    }
+}
+
+// Registers that may hold a string at some point. Writing an int or a bool
+// over a string would have to release it, so those are left to the
+// interpreter.
+std::vector<bool> FindStrings(const RegisterCode& program, const std::vector<TaggedValue>& variables)
+{
+    std::vector<bool> strings(program.GetFrameSize());
+    for (size_t i = 0; i < variables.size(); ++i)
+    {
+        strings[i] = variables[i].IsString();
+    }
+    const auto& constants = program.GetConstants();
+    for (size_t i = 0; i < constants.size(); ++i)
+    {
+        strings[variables.size() + i] = constants[i].IsString();
+    }
+    for (bool changed = true; changed; )
+    {
+        changed = false;
+        for (const auto& instruction: program.GetCode())
+        {
+            const bool string = instruction.op == RegisterOp::Concatenate
+                || (instruction.op == RegisterOp::Move && strings[instruction.b]);
+            if (string && !strings[instruction.a])
+            {
+                strings[instruction.a] = true;
+                changed = true;
+            }
+        }
+    }
+    return strings;
+}
+
+}
+
+#endif
+
+JitCode::~JitCode()
+{
+#if JIT_X86_64
+    if (m_memory)
+    {
+        ::munmap(m_memory, m_capacity);
+    }
+#endif
+}
+
+bool JitCode::IsAvailable()
+{
+    return JIT_X86_64;
+}
+
+bool JitCode::Compile(const RegisterCode& program, const std::vector<TaggedValue>& variables)
+{
+#if JIT_X86_64
+    const auto strings = FindStrings(program, variables);
+    const auto& code = program.GetCode();
+    const auto step = &RegisterInterpreter::Step;
+
+    Assembler as;
+    // push rbx; push r12; sub rsp, 8 (aligns the calls); mov rbx, rdi; mov r12, rsi
+    as.Bytes({0x53, 0x41, 0x54, 0x48, 0x83, 0xec, 0x08, 0x48, 0x89, 0xfb, 0x49, 0x89, 0xf4});
+
+    std::vector<size_t> starts(code.size() + 1);
+    // where a jump offset goes -> the instruction it jumps to
+    std::vector<std::pair<size_t, size_t>> jumps;
+    // where the jumps out after a failed callback go
+    std::vector<size_t> exits;
+    for (size_t i = 0; i < code.size(); ++i)
+    {
+        starts[i] = as.code.size();
+        const auto& instruction = code[i];
+        const auto a = GetOffset(instruction.a);
+        const auto b = GetOffset(instruction.b);
+        const auto c = GetOffset(instruction.c);
+        const bool writes = instruction.op == RegisterOp::Move
+            || (instruction.op >= RegisterOp::AddInt && instruction.op <= RegisterOp::PlusInt);
+        switch (writes && strings[instruction.a] ? RegisterOp::Fail : instruction.op)
+        {
+        case RegisterOp::Move:
+            if (strings[instruction.b])
+            {
+                break;
+            }
+            as.Load(Rax, b);
+            as.Load(Rcx, b + c_typeOffset);
+            as.Store(a, Rax);
+            as.Store(a + c_typeOffset, Rcx);
+            continue;
+
+        case RegisterOp::Jump:
+            jumps.push_back({as.Jump(), instruction.a});
+            continue;
+
+        case RegisterOp::JumpIfFalse:
+            // movzx eax, byte [b]; test al, al; jz
+            as.LoadByte(b);
+            as.Bytes({0x84, 0xc0});
+            jumps.push_back({as.Jump(Equal), instruction.a});
+            continue;
+
+        case RegisterOp::AddInt:
+        case RegisterOp::SubtractInt:
+        case RegisterOp::MultiplyInt:
+        case RegisterOp::DivideInt:
+            as.Load(Rax, b);
+            as.Load(Rcx, c);
+            switch (instruction.op)
+            {
+            case RegisterOp::AddInt:
+                // add rax, rcx
+                as.Bytes({0x48, 0x01, 0xc8});
+                break;
+            case RegisterOp::SubtractInt:
+                // sub rax, rcx
+                as.Bytes({0x48, 0x29, 0xc8});
+                break;
+            case RegisterOp::MultiplyInt:
+                // imul rax, rcx
+                as.Bytes({0x48, 0x0f, 0xaf, 0xc1});
+                break;
+            default:
+                // cqo; idiv rcx, which traps on 0 as the interpreter does
+                as.Bytes({0x48, 0x99, 0x48, 0xf7, 0xf9});
+                break;
+            }
+            as.Store(a, Rax);
+            as.StoreByte(a + c_typeOffset, static_cast<uint8_t>(ValueType::Int));
+            continue;
+
+        case RegisterOp::LessInt:
+        case RegisterOp::GreaterInt:
+        case RegisterOp::NotLessInt:
+        case RegisterOp::NotGreaterInt:
+        case RegisterOp::EqualInt:
+        case RegisterOp::NotEqualInt:
+            as.Load(Rax, b);
+            as.Load(Rcx, c);
+            // cmp rax, rcx
+            as.Bytes({0x48, 0x39, 0xc8});
+            as.Set(GetCondition(instruction.op));
+            as.Store(a, Rax);
+            as.StoreByte(a + c_typeOffset, static_cast<uint8_t>(ValueType::Bool));
+            continue;
+
+        case RegisterOp::Not:
+            // xor eax, 1
+            as.LoadByte(b);
+            as.Bytes({0x83, 0xf0, 0x01});
+            as.Store(a, Rax);
+            as.StoreByte(a + c_typeOffset, static_cast<uint8_t>(ValueType::Bool));
+            continue;
+
+        case RegisterOp::NegateInt:
+        case RegisterOp::PlusInt:
+            as.Load(Rax, b);
+            if (instruction.op == RegisterOp::NegateInt)
+            {
+                // neg rax
+                as.Bytes({0x48, 0xf7, 0xd8});
+            }
+            as.Store(a, Rax);
+            as.StoreByte(a + c_typeOffset, static_cast<uint8_t>(ValueType::Int));
+            continue;
+
+        case RegisterOp::JumpUnlessLessInt:
+        case RegisterOp::JumpUnlessGreaterInt:
+        case RegisterOp::JumpUnlessNotLessInt:
+        case RegisterOp::JumpUnlessNotGreaterInt:
+        case RegisterOp::JumpUnlessEqualInt:
+        case RegisterOp::JumpUnlessNotEqualInt:
+            as.Load(Rax, b);
+            as.Load(Rcx, c);
+            as.Bytes({0x48, 0x39, 0xc8});
+            // the opposite condition differs in the lowest bit
+            jumps.push_back({as.Jump(static_cast<Condition>(GetCondition(instruction.op) ^ 1)), instruction.a});
+            continue;
+
+        default:
+            break;
+        }
+
+        // mov rdi, r12; mov esi, i; mov rax, step; call rax; test eax, eax; jnz exit
+        as.Bytes({0x4c, 0x89, 0xe7, 0xbe});
+        as.Int32(static_cast<int32_t>(i));
+        as.Bytes({0x48, 0xb8});
+        as.Int64(reinterpret_cast<uint64_t>(step));
+        as.Bytes({0xff, 0xd0, 0x85, 0xc0});
+        exits.push_back(as.Jump(NotEqual));
+    }
+    starts[code.size()] = as.code.size();
+    // add rsp, 8; pop r12; pop rbx; ret
+    as.Bytes({0x48, 0x83, 0xc4, 0x08, 0x41, 0x5c, 0x5b, 0xc3});
+
+    for (const auto& [at, target]: jumps)
+    {
+        as.Patch(at, starts[target]);
+    }
+    for (const auto at: exits)
+    {
+        as.Patch(at, starts[code.size()]);
+    }
+
+    const auto page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    const auto capacity = (as.code.size() + page - 1) / page * page;
+    void* memory = ::mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+    {
+        throw std::runtime_error("cannot allocate native code");
+    }
+    std::memcpy(memory, as.code.data(), as.code.size());
+    if (::mprotect(memory, capacity, PROT_READ | PROT_EXEC) != 0)
+    {
+        ::munmap(memory, capacity);
+        throw std::runtime_error("cannot allocate native code");
+    }
+    if (m_memory)
+    {
+        ::munmap(m_memory, m_capacity);
+    }
+    m_memory = memory;
+    m_capacity = capacity;
+    m_size = as.code.size();
+    return true;
+#else
+    static_cast<void>(program);
+    static_cast<void>(variables);
+    return false;
+#endif
+}
+
+void JitCode::Run(TaggedValue* frame, void* context) const
+{
+    reinterpret_cast<void (*)(TaggedValue*, void*)>(m_memory)(frame, context);
+}
+
+size_t JitCode::GetSize() const
+{
+    return m_size;
+}
+
+void JitCode::WritePerfMap(const char* name) const
+{
+#if JIT_X86_64
+    char path[64];
+    std::snprintf(path, sizeof(path), "/tmp/perf-%d.map", static_cast<int>(::getpid()));
+    if (auto file = std::fopen(path, "a"))
+    {
+        std::fprintf(file, "%lx %zx %s\n", reinterpret_cast<unsigned long>(m_memory), m_size, name);
+        std::fclose(file);
+    }
+#else
+    static_cast<void>(name);
+#endif
+}
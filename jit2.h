@@ -0,0 +1,41 @@
+#pragma once
+#include "registers2.h"
+#include "value2.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Native code for a program lowered to registers, on Linux x86-64 only.
+// Instructions on int and bool registers become machine code that works on
+// the frame of the interpreter in place; the rest (read, write, strings and
+// errors) call back into RegisterInterpreter::Step(). Jumps stay jumps, so
+// loops run without dispatch.
+class JitCode
+{
+public:
+    JitCode() = default;
+    JitCode(const JitCode& rhs) = delete;
+    JitCode& operator = (const JitCode& rhs) = delete;
+    ~JitCode();
+
+    // Whether this build can compile to native code.
+    static bool IsAvailable();
+
+    // Compiles `program`, with variables of the types of `variables`.
+    // Returns false where the JIT is not available.
+    bool Compile(const RegisterCode& program, const std::vector<TaggedValue>& variables);
+
+    // Runs on `frame`, with `context` for the callbacks.
+    void Run(TaggedValue* frame, void* context) const;
+    // Bytes of native code.
+    size_t GetSize() const;
+
+    // Appends the code as `name` to /tmp/perf-<pid>.map, where perf looks
+    // for the symbols of code it cannot find in a file.
+    void WritePerfMap(const char* name) const;
+
+private:
+    void* m_memory{nullptr};
+    size_t m_capacity{0};
+    size_t m_size{0};
+};
@@ -0,0 +1,109 @@
+#pragma once
+#include "lexical2.h"
+#include <algorithm>
+#include <array>
+#include <string_view>
+
+// Reserved words of the language. 'true' and 'false' are literals, the rest
+// map to their own lexeme type.
+struct Keyword
+{
+    std::string_view word;
+    LexemeType type;
+    bool value;
+};
+
+constexpr std::array<Keyword, 15> c_keywords{{
+    {"program", LexemeType::Program, false},
+    {"int", LexemeType::Int, false},
+    {"string", LexemeType::String, false},
+    {"boolean", LexemeType::Boolean, false},
+    {"true", LexemeType::Literal, true},
+    {"false", LexemeType::Literal, false},
+    {"if", LexemeType::If, false},
+    {"else", LexemeType::Else, false},
+    {"while", LexemeType::While, false},
+    {"not", LexemeType::Not, false},
+    {"read", LexemeType::Read, false},
+    {"write", LexemeType::Write, false},
+    {"and", LexemeType::And, false},
+    {"or", LexemeType::Or, false},
+    {"break", LexemeType::Break, false},
+}};
+
+// Perfect hash over c_keywords: the seed is searched at compile time, so a new
+// keyword only needs an entry above (and a bigger table if the search fails).
+class KeywordTable
+{
+public:
+    static constexpr size_t c_size = 32;
+    static constexpr size_t c_empty = c_keywords.size();
+
+    constexpr KeywordTable()
+    {
+        for (size_t i = 0; i < c_keywords.size(); ++i)
+        {
+            m_minLength = std::min(m_minLength, c_keywords[i].word.size());
+            m_maxLength = std::max(m_maxLength, c_keywords[i].word.size());
+        }
+        for (m_seed = 1; m_seed < c_maxSeed; ++m_seed)
+        {
+            if (TryFill())
+            {
+                return;
+            }
+        }
+    }
+
+    constexpr bool IsValid() const
+    {
+        return m_seed < c_maxSeed;
+    }
+
+    // Index into c_keywords or c_empty, with a single table probe.
+    constexpr size_t Find(std::string_view word) const
+    {
+        if (word.size() < m_minLength || word.size() > m_maxLength)
+        {
+            return c_empty;
+        }
+        const auto slot = m_slots[Hash(word, m_seed)];
+        return slot != c_empty && c_keywords[slot].word == word ? slot : c_empty;
+    }
+
+private:
+    static constexpr size_t c_maxSeed = 4096;
+
+    static constexpr size_t Hash(std::string_view word, size_t seed)
+    {
+        const auto first = static_cast<unsigned char>(word[0]);
+        const auto second = static_cast<unsigned char>(word[1]);
+        return ((first * seed) ^ (second * (seed / 3 + 1)) ^ word.size()) % c_size;
+    }
+
+    constexpr bool TryFill()
+    {
+        for (auto& slot: m_slots)
+        {
+            slot = c_empty;
+        }
+        for (size_t i = 0; i < c_keywords.size(); ++i)
+        {
+            const auto hash = Hash(c_keywords[i].word, m_seed);
+            if (m_slots[hash] != c_empty)
+            {
+                return false;
+            }
+            m_slots[hash] = i;
+        }
+        return true;
+    }
+
+    std::array<size_t, c_size> m_slots{};
+    size_t m_seed{};
+    size_t m_minLength{static_cast<size_t>(-1)};
+    size_t m_maxLength{};
+};
+
+constexpr KeywordTable c_keywordTable{};
+static_assert(c_keywordTable.IsValid(), "no perfect hash seed for c_keywords, enlarge KeywordTable::c_size");
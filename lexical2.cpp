@@ -1,5 +1,9 @@
 #include "lexical2.h"
+#include "symbols2.h"
+#include "keywords2.h"
+#include "skip2.h"
 #include <sstream>
+#include <charconv>
 
 #define THROW(msg, line, ch) throw lexical_exception((msg), (line), (ch))
 
@@ -12,21 +16,95 @@ enum class State
     Identifier,
 };
 
-Scanner::Scanner(std::istream& input)
-    : m_input{input}
+static Lexeme MakeWord(std::string_view word, SymbolTable& symbols)
+{
+    if (const auto index = c_keywordTable.Find(word); index != KeywordTable::c_empty)
+    {
+        const auto& keyword = c_keywords[index];
+        if (keyword.type == LexemeType::Literal)
+        {
+            return {LexemeType::Literal, keyword.value};
+        }
+        return {keyword.type, {}};
+    }
+    return {LexemeType::Identifier, static_cast<long long int>(symbols.Intern(word))};
+}
+
+static Lexeme MakeNumber(std::string_view digits, int line)
+{
+    long long int number{};
+    const auto [end, ec] = std::from_chars(digits.data(), digits.data() + digits.size(), number);
+    if (ec != std::errc{} || end != digits.data() + digits.size())
+    {
+        THROW("integer literal is out of range", line, 0);
+    }
+    return {LexemeType::Literal, number};
+}
+
+static bool IsDigit(char ch)
+{
+    return ch >= '0' && ch <= '9';
+}
+
+static bool IsSpace(char ch)
+{
+    return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n';
+}
+
+static bool IsAlpha(char ch)
+{
+    return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z');
+}
+
+Scanner::Scanner(std::istream& input, SymbolTable& symbols)
+    : m_symbols{symbols}
+    , m_input{&input}
+{
+}
+
+Scanner::Scanner(std::string_view source, SymbolTable& symbols)
+    : m_symbols{symbols}
+    , m_begin{source.data()}
+    , m_cursor{source.data()}
+    , m_end{source.data() + source.size()}
 {
 }
 
 Lexeme Scanner::GetLexeme()
+{
+    return m_input ? ReadLexeme() : ScanLexeme();
+}
+
+bool Scanner::GetChar(char& ch)
+{
+    if (m_input->get(ch).eof())
+    {
+        return false;
+    }
+    if (ch == '\n')
+    {
+        m_currentLine += 1;
+    }
+    return true;
+}
+
+void Scanner::UngetChar(char ch)
+{
+    m_input->unget();
+    if (ch == '\n')
+    {
+        m_currentLine -= 1;
+    }
+}
+
+Lexeme Scanner::ReadLexeme()
 {
     State state{};
     std::string buffer;
     do
     {
-        const auto ungetted = m_input.gcount() == 0;
-
         char ch{};
-        if (m_input.get(ch).eof())
+        if (!GetChar(ch))
         {
             if (state == State::Undefined)
             {
@@ -37,11 +115,6 @@ Lexeme Scanner::GetLexeme()
                 THROW("unexpected eof", m_currentLine, 0);
             }
         }
-        if (!ungetted && ch == '\n')
-        {
-            m_currentLine += 1;
-        }
-
         switch (state)
         {
         case State::Undefined:
@@ -51,7 +124,7 @@ Lexeme Scanner::GetLexeme()
             }
             else if (ch == '/')
             {
-                if (m_input.get(ch).eof())
+                if (!GetChar(ch))
                 {
                     return {LexemeType::Divide, {}};
                 }
@@ -61,13 +134,13 @@ Lexeme Scanner::GetLexeme()
                 }
                 else
                 {
-                    m_input.unget();
+                    UngetChar(ch);
                     return {LexemeType::Divide, {}};
                 }
             }
             else if (ch == '+')
             {
-                if (m_input.get(ch).eof())
+                if (!GetChar(ch))
                 {
                     return {LexemeType::Plus, {}};
                 }
@@ -78,13 +151,13 @@ Lexeme Scanner::GetLexeme()
                 }
                 else
                 {
-                    m_input.unget();
+                    UngetChar(ch);
                     return {LexemeType::Plus, {}};
                 }
             }
             else if (ch == '-')
             {
-                if (m_input.get(ch).eof())
+                if (!GetChar(ch))
                 {
                     return {LexemeType::Minus, {}};
                 }
@@ -96,13 +169,13 @@ Lexeme Scanner::GetLexeme()
                 }
                 else
                 {
-                    m_input.unget();
+                    UngetChar(ch);
                     return {LexemeType::Minus, {}};
                 }
             }
             else if (ch == '<')
             {
-                if (m_input.get(ch).eof())
+                if (!GetChar(ch))
                 {
                     return {LexemeType::Less, {}};
                 }
@@ -112,13 +185,13 @@ Lexeme Scanner::GetLexeme()
                 }
                 else
                 {
-                    m_input.unget();
+                    UngetChar(ch);
                     return {LexemeType::Less, {}}; 
                 }
             }
             else if (ch == '>')
             {
-                if (m_input.get(ch).eof())
+                if (!GetChar(ch))
                 {
                     return {LexemeType::Greater, {}};
                 }
@@ -128,13 +201,13 @@ Lexeme Scanner::GetLexeme()
                 }
                 else
                 {
-                    m_input.unget();
+                    UngetChar(ch);
                     return {LexemeType::Greater, {}}; 
                 }
             }
             else if (ch == '=')
             {
-                if (m_input.get(ch).eof())
+                if (!GetChar(ch))
                 {
                     return {LexemeType::Assign, {}};
                 }
@@ -144,13 +217,13 @@ Lexeme Scanner::GetLexeme()
                 }
                 else
                 {
-                    m_input.unget();
+                    UngetChar(ch);
                     return {LexemeType::Assign, {}}; 
                 }
             }
             else if (ch == '!')
             {
-                if (m_input.get(ch).eof())
+                if (!GetChar(ch))
                 {
                     THROW("unexpected symbol", m_currentLine, '!');
                 }
@@ -160,6 +233,7 @@ Lexeme Scanner::GetLexeme()
                 }
                 else
                 {
+                    UngetChar(ch);
                     THROW("unexpected symbol", m_currentLine, '!');
                 }
             }
@@ -215,7 +289,7 @@ Lexeme Scanner::GetLexeme()
             break;
         
         case State::Comment:
-            if (ch == '*' && !m_input.get(ch).eof())
+            if (ch == '*' && GetChar(ch))
             {
                 if (ch == '/')
                 {
@@ -223,7 +297,7 @@ Lexeme Scanner::GetLexeme()
                 }
                 else
                 {
-                    m_input.unget();
+                    UngetChar(ch);
                 }
             }
             break;
@@ -235,8 +309,8 @@ Lexeme Scanner::GetLexeme()
             }
             else
             {
-                m_input.unget();
-                return {LexemeType::Literal, std::stoll(buffer)};
+                UngetChar(ch);
+                return MakeNumber(buffer, m_currentLine);
             }
             break;
         
@@ -247,68 +321,8 @@ Lexeme Scanner::GetLexeme()
             }
             else
             {
-                m_input.unget();
-                if (buffer == "program")
-                {
-                    return {LexemeType::Program, {}};
-                }
-                if (buffer == "int")
-                {
-                    return {LexemeType::Int, {}};
-                }
-                if (buffer == "string")
-                {
-                    return {LexemeType::String, {}};
-                }
-                if (buffer == "boolean")
-                {
-                    return {LexemeType::Boolean, {}};
-                }
-                if (buffer == "true")
-                {
-                    return {LexemeType::Literal, true};
-                }
-                if (buffer == "false")
-                {
-                    return {LexemeType::Literal, false};
-                }
-                if (buffer == "if")
-                {
-                    return {LexemeType::If, {}};
-                }
-                if (buffer == "else")
-                {
-                    return {LexemeType::Else, {}};
-                }
-                if (buffer == "while")
-                {
-                    return {LexemeType::While, {}};
-                }
-                if (buffer == "not")
-                {
-                    return {LexemeType::Not, {}};
-                }
-                if (buffer == "read")
-                {
-                    return {LexemeType::Read, {}};
-                }
-                if (buffer == "write")
-                {
-                    return {LexemeType::Write, {}};
-                }
-                if (buffer == "and")
-                {
-                    return {LexemeType::And, {}};
-                }
-                if (buffer == "or")
-                {
-                    return {LexemeType::Or, {}};
-                }
-                if (buffer == "break")
-                {
-                    return {LexemeType::Break, {}};
-                }
-                return {LexemeType::Identifier, buffer};
+                UngetChar(ch);
+                return MakeWord(buffer, m_symbols);
             }
             break;
         }
@@ -316,11 +330,186 @@ Lexeme Scanner::GetLexeme()
     while (true);
 }
 
+Lexeme Scanner::ScanLexeme()
+{
+    while (m_cursor != m_end)
+    {
+        const char ch = *m_cursor++;
+        const bool hasNext = m_cursor != m_end;
+        switch (ch)
+        {
+        case ' ':
+        case '\t':
+        case '\r':
+        case '\n':
+            m_currentLine += ch == '\n';
+            // single separators are common, only runs go to the bulk kernel
+            if (hasNext && IsSpace(*m_cursor))
+            {
+                m_cursor = GetSkipKernels().skipSpaces(m_cursor, m_end, m_currentLine);
+            }
+            break;
+
+        case '"':
+            return ScanString();
+
+        case '/':
+            if (hasNext && *m_cursor == '*')
+            {
+                m_cursor += 1;
+                SkipComment();
+                break;
+            }
+            return {LexemeType::Divide, {}};
+
+        case '+':
+            if (hasNext && IsDigit(*m_cursor))
+            {
+                return ScanNumber(m_cursor);
+            }
+            return {LexemeType::Plus, {}};
+
+        case '-':
+            if (hasNext && IsDigit(*m_cursor))
+            {
+                return ScanNumber(m_cursor - 1);
+            }
+            return {LexemeType::Minus, {}};
+
+        case '<':
+            if (hasNext && *m_cursor == '=')
+            {
+                m_cursor += 1;
+                return {LexemeType::NotGreater, {}};
+            }
+            return {LexemeType::Less, {}};
+
+        case '>':
+            if (hasNext && *m_cursor == '=')
+            {
+                m_cursor += 1;
+                return {LexemeType::NotLess, {}};
+            }
+            return {LexemeType::Greater, {}};
+
+        case '=':
+            if (hasNext && *m_cursor == '=')
+            {
+                m_cursor += 1;
+                return {LexemeType::Equal, {}};
+            }
+            return {LexemeType::Assign, {}};
+
+        case '!':
+            if (hasNext && *m_cursor == '=')
+            {
+                m_cursor += 1;
+                return {LexemeType::NotEqual, {}};
+            }
+            THROW("unexpected symbol", m_currentLine, '!');
+
+        case '*':
+            return {LexemeType::Multiply, {}};
+
+        case '{':
+            return {LexemeType::LeftBrace, {}};
+
+        case '}':
+            return {LexemeType::RightBrace, {}};
+
+        case '(':
+            return {LexemeType::LeftParenthesis, {}};
+
+        case ')':
+            return {LexemeType::RightParenthesis, {}};
+
+        case ';':
+            return {LexemeType::Semicolon, {}};
+
+        case ',':
+            return {LexemeType::Comma, {}};
+
+        default:
+            if (IsAlpha(ch))
+            {
+                return ScanIdentifier(m_cursor - 1);
+            }
+            if (IsDigit(ch))
+            {
+                return ScanNumber(m_cursor - 1);
+            }
+            // like the stream scanner, any other symbol separates lexemes
+            break;
+        }
+    }
+    return {LexemeType::Eof, {}};
+}
+
+Lexeme Scanner::ScanString()
+{
+    const char* begin = m_cursor;
+    m_cursor = GetSkipKernels().findQuote(m_cursor, m_end, m_currentLine);
+    if (m_cursor == m_end)
+    {
+        THROW("unexpected eof", m_currentLine, 0);
+    }
+    const std::string_view text{begin, static_cast<size_t>(m_cursor - begin)};
+    m_cursor += 1;
+    return {LexemeType::Literal, std::string{text}};
+}
+
+Lexeme Scanner::ScanNumber(const char* begin)
+{
+    m_cursor = begin + 1;
+    while (m_cursor != m_end && IsDigit(*m_cursor))
+    {
+        m_cursor += 1;
+    }
+    if (m_cursor == m_end)
+    {
+        THROW("unexpected eof", m_currentLine, 0);
+    }
+    return MakeNumber({begin, static_cast<size_t>(m_cursor - begin)}, m_currentLine);
+}
+
+Lexeme Scanner::ScanIdentifier(const char* begin)
+{
+    while (m_cursor != m_end && (IsAlpha(*m_cursor) || IsDigit(*m_cursor)))
+    {
+        m_cursor += 1;
+    }
+    if (m_cursor == m_end)
+    {
+        THROW("unexpected eof", m_currentLine, 0);
+    }
+    return MakeWord({begin, static_cast<size_t>(m_cursor - begin)}, m_symbols);
+}
+
+void Scanner::SkipComment()
+{
+    m_cursor = GetSkipKernels().findCommentEnd(m_cursor, m_end, m_currentLine);
+    if (m_cursor == m_end)
+    {
+        THROW("unexpected eof", m_currentLine, 0);
+    }
+    m_cursor += 2;
+}
+
 int Scanner::GetCurrentLine() const
 {
     return m_currentLine;
 }
 
+SymbolTable& Scanner::GetSymbols() const
+{
+    return m_symbols;
+}
+
+size_t Scanner::GetPosition() const
+{
+    return m_cursor - m_begin;
+}
+
 std::ostream& operator << (std::ostream& os, const Lexeme& lex)
 {
     if (lex.type == LexemeType::Undefined)
@@ -354,3 +543,13 @@ std::string lexical_exception::DebugInfo() const
     return ss.str();
 }
 
+
+int lexical_exception::GetLine() const
+{
+    return m_line;
+}
+
+char lexical_exception::GetSymbol() const
+{
+    return m_ch;
+}
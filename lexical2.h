@@ -1,9 +1,11 @@
 #pragma once
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <variant>
 #include <istream>
 
-enum class LexemeType
+enum class LexemeType : uint8_t
 {
     Undefined = 0,
     Program,
@@ -43,11 +45,26 @@ enum class LexemeType
     Goto,
     ConditionalGoto,
     Clear,
+    // value is a variable slot, see Poliz::AddIdentifier()
+    LoadSlot,
+    StoreSlot,
+    // value is the index of a block not compiled yet, see CompileLazy()
+    Stub,
     Eof,
 };
 
 using Value = std::variant<bool, long long int, std::string>;
 
+// Type of a value, in the order of the alternatives of Value.
+enum class ValueType : uint8_t
+{
+    Bool = 0,
+    Int,
+    String,
+};
+
+class SymbolTable;
+
 struct Lexeme
 {
     LexemeType type;
@@ -57,15 +74,34 @@ struct Lexeme
 class Scanner
 {
 public:
-    Scanner(std::istream& input);
+    Scanner(std::istream& input, SymbolTable& symbols);
+    // Scans a contiguous buffer (see SourceBuffer) that must outlive the scanner.
+    Scanner(std::string_view source, SymbolTable& symbols);
     Scanner(const Scanner& rhs) = delete;
     Scanner& operator = (const Scanner& rhs) = delete;
 
     Lexeme GetLexeme();
     int GetCurrentLine() const;
+    SymbolTable& GetSymbols() const;
+    // Bytes consumed so far, buffered mode only.
+    size_t GetPosition() const;
 
 private:
-    std::istream& m_input;
+    Lexeme ReadLexeme();
+    bool GetChar(char& ch);
+    void UngetChar(char ch);
+
+    Lexeme ScanLexeme();
+    Lexeme ScanString();
+    Lexeme ScanNumber(const char* begin);
+    Lexeme ScanIdentifier(const char* begin);
+    void SkipComment();
+
+    SymbolTable& m_symbols;
+    std::istream* m_input{};
+    const char* m_begin{};
+    const char* m_cursor{};
+    const char* m_end{};
     int m_currentLine{1};
 };
 
@@ -75,6 +111,8 @@ class lexical_exception
 public:
     lexical_exception(const char* msg, int line, char ch);
     std::string DebugInfo() const;
+    int GetLine() const;
+    char GetSymbol() const;
 
 private:
     const int m_line{};
@@ -1,72 +1,515 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
 #include <iostream>
-#include <fstream>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+#include "source2.h"
 #include "lexical2.h"
+#include "symbols2.h"
+#include "tokens2.h"
+#include "threads2.h"
 #include "syntax2.h"
 #include "poliz2.h"
+#include "cache2.h"
+#include "server2.h"
+#include "stream2.h"
+#include "registers2.h"
+#include "jit2.h"
+#include "aot2.h"
 
 #ifndef DEBUG_INTERPRETER
 # define DEBUG_INTERPRETER 0
 #endif
 
-void PrintLexemas(std::istream& is)
+struct Options
 {
-    Scanner scanner(is);
+    const char* path{};
+    // every program given, for tools that take a corpus
+    std::vector<const char*> paths;
+    // lexer threads, 0 to scan sequentially
+    size_t threads{};
+    // keep the compiled program next to the source or in `cacheDir`
+    bool cache{};
+    const char* cacheDir{};
+    // compile blocks as they first run; `check` still parses them all up
+    // front to report their errors. Not for cached programs.
+    bool lazy{};
+    bool check{};
+    // run each top-level statement as soon as it is parsed
+    bool stream{};
+    // interpreter loop, see SetDispatch()
+    Dispatch dispatch{Dispatch::Auto};
+    // run on the register machine (see RegisterCode) where the program
+    // lowers to it; lazy and streamed programs stay on the stack machine
+    bool registers{};
+    // compile to native code where the JIT is available: loops that jump
+    // back `tierThreshold` times (see Interpreter::EnableTiering()), or the
+    // whole program up front if it is 0. `perfMap` tells perf where the
+    // code is, `stats` reports the loops promoted.
+    bool jit{true};
+    size_t tierThreshold{1000};
+    bool perfMap{};
+    bool stats{};
+    // serve requests on this socket instead of running a program
+    const char* serve{};
+    size_t workers{};
+    // client: the server's socket and whether to send the path, not the text
+    const char* connect{};
+    bool byPath{};
+};
+
+void PrintLexemas(std::string_view source, const Options& options)
+{
+    SymbolTable symbols;
+    if (options.threads)
+    {
+        ThreadPool pool(options.threads);
+        const auto tokens = TokenizeParallel(source, symbols, pool);
+        for (size_t i = 0; i < tokens.tokens.size(); ++i)
+        {
+            if (tokens.tokens[i].type != LexemeType::Eof)
+            {
+                std::cout << symbols.Restore(tokens.Get(i)) << std::endl;
+            }
+        }
+        if (tokens.error)
+        {
+            std::rethrow_exception(tokens.error);
+        }
+        return;
+    }
+
+    Scanner scanner(source, symbols);
 
     Lexeme lex;
     while ((lex = scanner.GetLexeme()).type != LexemeType::Eof)
     {
-        std::cout << lex << std::endl;
+        std::cout << symbols.Restore(lex) << std::endl;
+    }
+}
+
+// Identifier lexemes used to carry their name as a std::string in every copy
+// (token lookahead, Poliz, interpreter program, operand stack).
+void PrintSymbolStatistics(const Poliz& poliz, const SymbolTable& symbols)
+{
+    const auto inlineCapacity = std::string{}.capacity();
+    size_t identifiers{};
+    size_t nameBytes{};
+    size_t heapAllocations{};
+    for (const auto& lex: poliz.GetProgram())
+    {
+        const auto slot = std::get_if<long long int>(&lex.value);
+        if ((lex.type == LexemeType::LoadSlot || lex.type == LexemeType::StoreSlot) && *slot >= 0)
+        {
+            const auto length = symbols.GetName(poliz.GetIdentifiers()[*slot]).size();
+            identifiers += 1;
+            nameBytes += length + 1;
+            heapAllocations += length > inlineCapacity;
+        }
+    }
+    if (identifiers == 0)
+    {
+        return;
+    }
+    std::cout << "symbols: " << symbols.GetSize()
+              << ", identifier lexemes: " << identifiers << std::endl;
+    std::cout << "per identifier lexeme copy: "
+              << static_cast<double>(nameBytes) / identifiers << " name bytes and "
+              << static_cast<double>(heapAllocations) / identifiers << " heap allocations saved, "
+              << sizeof(SymbolId) << " byte symbol id used" << std::endl;
+}
+
+void PrintVerification(const Verification& verification, std::ostream& os)
+{
+    if (verification.verified)
+    {
+        os << "verified, stack of " << verification.stackSize << " operands" << std::endl;
+    }
+    else
+    {
+        os << "not verified: " << verification.error << std::endl;
     }
 }
 
-void PrintPoliz(std::istream& is)
+void PrintPoliz(std::string_view source, const Options& options)
 {
-    Scanner scanner(is);
+    std::pmr::monotonic_buffer_resource arena;
+    SymbolTable symbols{&arena};
+    Scanner scanner(source, symbols);
 
     Poliz poliz;
-    Parser parser(scanner, poliz);
+    Parser parser(Tokenize(scanner, &arena), symbols, poliz);
     parser.Analize();
 
-    const auto& program = poliz.GetProgram();
-    for (size_t i = 0; i < program.size(); ++i)
+    const auto& code = poliz.GetBytecode();
+    code.Disassemble(std::cout);
+    std::cout << "variables:\n";
+    const auto& identifiers = poliz.GetIdentifiers();
+    for (size_t slot = 0; slot < identifiers.size(); ++slot)
     {
-        std::cout << "i: " << i << ", " << program[i] << std::endl;
+        std::cout << std::setw(6) << slot << "  " << symbols.GetName(identifiers[slot]) << '\n';
+    }
+    std::cout << poliz.GetProgram().size() << " instructions in " << code.GetCode().size()
+              << " bytes of code (" << poliz.GetProgram().size() * sizeof(Lexeme) << " bytes as lexemes), "
+              << code.GetConstants().size() << " constants" << std::endl;
+    PrintSymbolStatistics(poliz, symbols);
+    PrintVerification(code.Verify(poliz.GetVariables()), std::cout);
+
+    if (options.registers)
+    {
+        RegisterCode registers;
+        if (registers.Lower(poliz.GetProgram(), identifiers.size()))
+        {
+            std::cout << "registers:\n";
+            registers.Disassemble(std::cout);
+        }
+        else
+        {
+            std::cout << "not lowered to registers" << std::endl;
+        }
     }
 }
 
-void ExecuteProgram(std::istream& is)
+// Writes the program as C++ for a native build of it, see Transpile().
+void PrintAot(std::string_view source)
 {
-    Scanner scanner(is);
+    std::pmr::monotonic_buffer_resource arena;
+    SymbolTable symbols{&arena};
+    Scanner scanner(source, symbols);
 
     Poliz poliz;
-    Parser parser(scanner, poliz);
+    Parser parser(Tokenize(scanner, &arena), symbols, poliz);
     parser.Analize();
 
+    RegisterCode registers;
+    if (!registers.Lower(poliz.GetProgram(), poliz.GetVariables().size()))
+    {
+        throw std::runtime_error("program does not lower to registers");
+    }
+    std::vector<std::string> names;
+    for (const auto identifier: poliz.GetIdentifiers())
+    {
+        names.emplace_back(symbols.GetName(identifier));
+    }
+    Transpile(registers, poliz.GetVariables(), names, std::cout);
+}
+
+// Sequences of instructions worth fusing, counted over the programs given.
+// A sequence counts where it could be fused: no jump lands inside it and
+// only its last instruction may end a statement or jump. Sequences in loops
+// run more often, so each loop around one weighs it by c_loopWeight.
+void PrintPatterns(const Options& options)
+{
+    constexpr size_t c_longest = 5;
+    constexpr double c_loopWeight = 10;
+    constexpr size_t c_shown = 40;
+
+    struct Count
+    {
+        size_t times{};
+        double weight{};
+    };
+    std::map<std::string, Count> counts;
+    for (const auto path: options.paths)
+    {
+        const SourceBuffer source{path};
+        Poliz poliz;
+        try
+        {
+            Compile(source.GetView(), poliz);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << path << ": skipped, " << e.what() << std::endl;
+            continue;
+        }
+        const auto& program = poliz.GetProgram();
+
+        std::vector<bool> targets(program.size() + 1);
+        std::vector<int> depths(program.size() + 1);
+        std::vector<std::string> names;
+        for (size_t i = 0; i < program.size(); ++i)
+        {
+            const auto op = GetOpcode(program[i]);
+            names.push_back(GetName(op));
+            if (op == Opcode::Jump || op == Opcode::JumpIfFalse)
+            {
+                const auto target = static_cast<size_t>(std::get<long long int>(program[i].value));
+                targets[target] = true;
+                for (auto j = target; op == Opcode::Jump && j < i; ++j)
+                {
+                    depths[j] += 1;
+                }
+            }
+        }
+
+        for (size_t first = 0; first < program.size(); ++first)
+        {
+            std::string pattern{names[first]};
+            for (size_t last = first + 1; last < std::min(program.size(), first + c_longest); ++last)
+            {
+                const auto previous = GetOpcode(program[last - 1]);
+                if (targets[last] || previous == Opcode::Clear || previous == Opcode::Write || previous == Opcode::Read
+                    || previous == Opcode::Jump || previous == Opcode::JumpIfFalse || previous == Opcode::Stub)
+                {
+                    break;
+                }
+                pattern += "; " + names[last];
+                auto& count = counts[pattern];
+                count.times += 1;
+                count.weight += std::pow(c_loopWeight, depths[first]);
+            }
+        }
+    }
+
+    std::vector<std::pair<std::string, Count>> sorted(counts.begin(), counts.end());
+    std::sort(sorted.begin(), sorted.end(),
+              [](const auto& lhs, const auto& rhs) { return lhs.second.weight > rhs.second.weight; });
+    sorted.resize(std::min(sorted.size(), c_shown));
+    std::cout << "  weight   times  instructions\n";
+    for (const auto& [pattern, count]: sorted)
+    {
+        std::cout << std::setw(8) << count.weight << std::setw(8) << count.times << "  " << pattern << '\n';
+    }
+}
+
+// Empty if the compiled program is not to be cached.
+std::string GetCachePath(const CacheKey& key, const Options& options)
+{
+    if (options.cacheDir)
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "/%016llx.polizc", static_cast<unsigned long long>(key.hash));
+        return options.cacheDir + std::string{name};
+    }
+    if (options.cache && options.path)
+    {
+        return options.path + std::string{".polizc"};
+    }
+    return {};
+}
+
+void ExecuteProgram(std::string_view source, const Options& options)
+{
+    if (options.stream)
+    {
+        RunStreaming(source, std::cin, std::cout, DEBUG_INTERPRETER);
+        return;
+    }
+
+    Poliz poliz;
+    if (options.lazy && !options.cache)
+    {
+        CompileLazy(source, poliz, options.check);
+        auto interpreter = poliz.CreateLazyInterpreter();
+        interpreter.Run(DEBUG_INTERPRETER);
+        return;
+    }
+
+    const auto key = options.cache ? GetCacheKey(source) : CacheKey{};
+    const auto cachePath = options.cache ? GetCachePath(key, options) : std::string{};
+    if (cachePath.empty() || !LoadCache(cachePath, key, poliz))
+    {
+        Compile(source, poliz);
+        if (!cachePath.empty())
+        {
+            SaveCache(cachePath, key, poliz);
+        }
+    }
+
+    RegisterCode registers;
+    const bool jit = options.jit && JitCode::IsAvailable() && !DEBUG_INTERPRETER;
+    const bool upFront = jit && options.tierThreshold == 0;
+    if ((options.registers || upFront) && registers.Lower(poliz.GetProgram(), poliz.GetVariables().size()))
+    {
+        RegisterInterpreter interpreter{registers, poliz.GetVariables()};
+        JitCode native;
+        if (upFront && native.Compile(registers, poliz.GetVariables()))
+        {
+            if (options.perfMap)
+            {
+                native.WritePerfMap(options.path ? options.path : "program");
+            }
+            interpreter.Run(native);
+            return;
+        }
+        if (options.registers)
+        {
+            interpreter.Run(DEBUG_INTERPRETER);
+            return;
+        }
+    }
+
     auto interpreter = poliz.CreateInterpreter();
+    const auto& verification = interpreter.Verify();
+    if (options.jit && options.tierThreshold != 0 && !DEBUG_INTERPRETER)
+    {
+        interpreter.EnableTiering(poliz.GetProgram(), options.tierThreshold, true, options.perfMap);
+    }
     interpreter.Run(DEBUG_INTERPRETER);
+    if (options.stats)
+    {
+        PrintVerification(verification, std::cerr);
+        interpreter.PrintTiers(std::cerr);
+    }
+}
+
+// Runs the program on a server started with `int --serve`, reading the
+// whole standard input first.
+int RunClient(const Options& options)
+{
+    if (!options.connect || !options.path)
+    {
+        throw std::runtime_error("usage: client --connect=SOCKET [--by-path] PROGRAM");
+    }
+
+    Request request;
+    if (options.byPath)
+    {
+        std::unique_ptr<char, decltype(&std::free)> path{::realpath(options.path, nullptr), &std::free};
+        if (!path)
+        {
+            throw std::runtime_error("cannot open source file");
+        }
+        request.kind = Request::Path;
+        request.program = path.get();
+    }
+    else
+    {
+        request.program = SourceBuffer{options.path}.GetView();
+    }
+    request.input.assign(std::istreambuf_iterator<char>{std::cin}, std::istreambuf_iterator<char>{});
+    return SendRequest(options.connect, request, std::cout, std::cerr);
+}
+
+Options ParseOptions(int argc, char** argv)
+{
+    Options options;
+    options.workers = std::max(std::thread::hardware_concurrency(), 1u);
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string_view arg{argv[i]};
+        if (arg == "--parallel")
+        {
+            options.threads = std::max(std::thread::hardware_concurrency(), 1u);
+        }
+        else if (arg.substr(0, 11) == "--parallel=")
+        {
+            options.threads = std::stoul(std::string{arg.substr(11)});
+        }
+        else if (arg == "--cache")
+        {
+            options.cache = true;
+        }
+        else if (arg.substr(0, 12) == "--cache-dir=")
+        {
+            options.cache = true;
+            options.cacheDir = argv[i] + 12;
+        }
+        else if (arg == "--lazy")
+        {
+            options.lazy = true;
+        }
+        else if (arg == "--check")
+        {
+            options.check = true;
+        }
+        else if (arg == "--stream")
+        {
+            options.stream = true;
+        }
+        else if (arg == "--switch")
+        {
+            options.dispatch = Dispatch::Switch;
+        }
+        else if (arg == "--registers")
+        {
+            options.registers = true;
+        }
+        else if (arg == "--no-jit")
+        {
+            options.jit = false;
+        }
+        else if (arg.substr(0, 17) == "--tier-threshold=")
+        {
+            options.tierThreshold = std::stoul(std::string{arg.substr(17)});
+        }
+        else if (arg == "--perf-map")
+        {
+            options.perfMap = true;
+        }
+        else if (arg == "--stats")
+        {
+            options.stats = true;
+        }
+        else if (arg.substr(0, 8) == "--serve=")
+        {
+            options.serve = argv[i] + 8;
+        }
+        else if (arg.substr(0, 10) == "--workers=")
+        {
+            options.workers = std::stoul(std::string{arg.substr(10)});
+        }
+        else if (arg.substr(0, 10) == "--connect=")
+        {
+            options.connect = argv[i] + 10;
+        }
+        else if (arg == "--by-path")
+        {
+            options.byPath = true;
+        }
+        else if (arg.substr(0, 2) == "--")
+        {
+            throw std::runtime_error("unknown option " + std::string{arg});
+        }
+        else
+        {
+            options.path = argv[i];
+            options.paths.push_back(argv[i]);
+        }
+    }
+    return options;
 }
 
 int main(int argc, char** argv)
 {
     try
     {
-        std::fstream f;
-        std::istream* input{};
-        if (argc > 1)
+        const auto options = ParseOptions(argc, argv);
+        SetDispatch(options.dispatch);
+#if defined (CLIENT)
+        return RunClient(options);
+#elif defined (PATTERNS)
+        PrintPatterns(options);
+#else
+        if (options.serve)
         {
-            f.open(argv[1]);
-            input = &f;
+            Serve(options.serve, options.workers);
+        }
+
+        std::unique_ptr<SourceBuffer> source;
+        if (options.path)
+        {
+            source = std::make_unique<SourceBuffer>(options.path);
         }
         else
         {
-            input = &std::cin;
+            source = std::make_unique<SourceBuffer>(std::cin);
         }
-#if defined (LEXICAL)
-        PrintLexemas(*input);
-#elif defined (POLIZ)
-        PrintPoliz(*input);
-#else
-        ExecuteProgram(*input);
+# if defined (LEXICAL)
+        PrintLexemas(source->GetView(), options);
+# elif defined (POLIZ)
+        PrintPoliz(source->GetView(), options);
+# elif defined (AOT)
+        PrintAot(source->GetView());
+# else
+        ExecuteProgram(source->GetView(), options);
+# endif
 #endif
     }
     catch (lexical_exception& e)
@@ -1,6 +1,11 @@
 #include "poliz2.h"
+#include "syntax2.h"
 
-void Poliz::AddIdentifier(const std::string& identifier, const Value& value)
+Poliz::Poliz() = default;
+
+Poliz::~Poliz() = default;
+
+void Poliz::AddIdentifier(SymbolId identifier, const Value& value)
 {
     if (HasIdentifier(identifier))
     {
@@ -8,24 +13,32 @@ void Poliz::AddIdentifier(const std::string& identifier, const Value& value)
     }
     else
     {
-        m_variables.insert({identifier, value});
+        m_slots.insert({identifier, m_variables.size()});
+        m_variables.emplace_back(value);
+        m_identifiers.push_back(identifier);
     }
 }
 
-bool Poliz::HasIdentifier(const std::string& identifier) const
+bool Poliz::HasIdentifier(SymbolId identifier) const
 {
-    return m_variables.find(identifier) != m_variables.end();
+    return m_slots.find(identifier) != m_slots.end();
+}
+
+long long int Poliz::FindSlot(SymbolId identifier) const
+{
+    const auto it = m_slots.find(identifier);
+    return it != m_slots.end() ? static_cast<long long int>(it->second) : -1;
 }
 
 size_t Poliz::AddGoto()
 {
-    m_poliz.push_back({LexemeType::Goto, -1ll});
+    AddLexeme({LexemeType::Goto, -1ll});
     return m_poliz.size() - 1;
 }
 
 size_t Poliz::AddConditionalGoto()
 {
-    m_poliz.push_back({LexemeType::ConditionalGoto, -1ll});
+    AddLexeme({LexemeType::ConditionalGoto, -1ll});
     return m_poliz.size() - 1;
 }
 
@@ -41,6 +54,7 @@ void Poliz::SetLabel(size_t pos, long long int label)
         throw std::runtime_error("object is not a label");
     }
     m_poliz[pos].value = label;
+    m_code.Patch(pos, m_poliz[pos]);
 }
 
 void Poliz::SetLabel(size_t pos)
@@ -50,15 +64,123 @@ void Poliz::SetLabel(size_t pos)
 
 void Poliz::AddLexeme(const Lexeme& lexeme)
 {
+    m_code.Add(lexeme);
     m_poliz.push_back(lexeme);
 }
 
+void Poliz::AddLexeme(Lexeme&& lexeme)
+{
+    m_code.Add(lexeme);
+    m_poliz.push_back(std::move(lexeme));
+}
+
+static bool IsJump(LexemeType type)
+{
+    return type == LexemeType::Goto || type == LexemeType::ConditionalGoto;
+}
+
+void Poliz::ReplaceCode(size_t begin, size_t end, const std::vector<Lexeme>& code)
+{
+    const auto shift = static_cast<long long int>(code.size()) - static_cast<long long int>(end - begin);
+    if (shift > 0)
+    {
+        m_poliz.insert(m_poliz.begin() + end, shift, Lexeme{});
+    }
+    else
+    {
+        m_poliz.erase(m_poliz.begin() + end + shift, m_poliz.begin() + end);
+    }
+
+    for (size_t i = 0; i < code.size(); ++i)
+    {
+        m_poliz[begin + i] = code[i];
+        if (IsJump(code[i].type))
+        {
+            m_poliz[begin + i].value = std::get<long long int>(code[i].value) + static_cast<long long int>(begin);
+        }
+    }
+    // relative jumps in the code that follows stay as they are
+    m_code.Replace(begin, end, m_poliz.data() + begin, code.size());
+    if (shift == 0)
+    {
+        return;
+    }
+    for (size_t i = begin + code.size(); i < m_poliz.size(); ++i)
+    {
+        if (IsJump(m_poliz[i].type))
+        {
+            std::get<long long int>(m_poliz[i].value) += shift;
+        }
+    }
+}
+
+void Poliz::RenameSymbols(const std::vector<SymbolId>& ids)
+{
+    m_slots.clear();
+    for (size_t slot = 0; slot < m_identifiers.size(); ++slot)
+    {
+        m_identifiers[slot] = ids[m_identifiers[slot]];
+        m_slots.insert({m_identifiers[slot], slot});
+    }
+}
+
+void Poliz::SetBlockCompiler(std::unique_ptr<SymbolTable> symbols, std::unique_ptr<Parser> parser)
+{
+    m_symbols = std::move(symbols);
+    m_parser = std::move(parser);
+    m_exit = AddGoto();
+    SetLabel(m_exit);
+}
+
+void Poliz::CompileBlock(size_t position)
+{
+    if (!m_parser || m_poliz[position].type != LexemeType::Stub)
+    {
+        throw std::runtime_error("block is not compiled");
+    }
+    const auto begin = m_poliz.size();
+    try
+    {
+        m_parser->AnalizeBlock(std::get<long long int>(m_poliz[position].value));
+    }
+    catch (...)
+    {
+        m_poliz.erase(m_poliz.begin() + begin, m_poliz.end());
+        m_code.Truncate(begin);
+        throw;
+    }
+    SetLabel(AddGoto(), position + 1);
+    m_poliz[position] = {LexemeType::Goto, static_cast<long long int>(begin)};
+    m_code.Patch(position, m_poliz[position]);
+    SetLabel(m_exit);
+}
+
 const std::vector<Lexeme>& Poliz::GetProgram() const
 {
     return m_poliz;
 }
 
-Interpreter Poliz::CreateInterpreter() const
+const Bytecode& Poliz::GetBytecode() const
+{
+    return m_code;
+}
+
+const std::vector<TaggedValue>& Poliz::GetVariables() const
+{
+    return m_variables;
+}
+
+const std::vector<SymbolId>& Poliz::GetIdentifiers() const
+{
+    return m_identifiers;
+}
+
+Interpreter Poliz::CreateInterpreter(std::istream& input, std::ostream& output) const
+{
+    return Interpreter{m_code, m_variables, input, output};
+}
+
+Interpreter Poliz::CreateLazyInterpreter(std::istream& input, std::ostream& output)
 {
-    return Interpreter{m_poliz, m_variables};
+    return Interpreter{m_code, m_variables, input, output, this};
 }
@@ -1,31 +1,73 @@
 #pragma once
+#include "bytecode2.h"
 #include "lexical2.h"
 #include "interpreter2.h"
+#include "symbols2.h"
+#include <memory>
 #include <variant>
 #include <vector>
 #include <unordered_map>
 
+class Parser;
+
 class Poliz
 {
 public:
-    Poliz() = default;
+    Poliz();
     Poliz(const Poliz& rhs) = delete;
     Poliz& operator = (const Poliz& rhs) = delete;
+    ~Poliz();
 
-    void AddIdentifier(const std::string& identifier, const Value& value = {});
-    bool HasIdentifier(const std::string& identifier) const;
+    // Declares a variable in the next free slot. Code refers to variables
+    // by slot: LoadSlot pushes a reference to one and StoreSlot assigns the
+    // value on the stack to one (slot -1 for an undeclared name, which is
+    // an error once it runs). Operators hold the ValueType of their operands
+    // as value, known from the declarations.
+    void AddIdentifier(SymbolId identifier, const Value& value = {});
+    bool HasIdentifier(SymbolId identifier) const;
+    // -1 if the identifier is not declared.
+    long long int FindSlot(SymbolId identifier) const;
     size_t AddGoto();
     size_t AddConditionalGoto();
     long long int GetCurrentLabel() const;
     void SetLabel(size_t pos, long long int label);
     void SetLabel(size_t pos);
     void AddLexeme(const Lexeme& lexeme);
-    
+    void AddLexeme(Lexeme&& lexeme);
+    // Puts `code`, compiled on its own from label 0, in place of [begin, end)
+    // and moves along the jumps of the code that follows. Jumps before
+    // `begin` must not point past it.
+    void ReplaceCode(size_t begin, size_t end, const std::vector<Lexeme>& code);
+    // Variables get symbol id `ids[id]`.
+    void RenameSymbols(const std::vector<SymbolId>& ids);
+    // Keeps the parser of a program compiled lazily (see CompileLazy()) for
+    // its blocks. They go after the program, behind a jump to the end.
+    void SetBlockCompiler(std::unique_ptr<SymbolTable> symbols, std::unique_ptr<Parser> parser);
+    // Compiles the block of the Stub at `position` and turns the stub into
+    // a jump to it.
+    void CompileBlock(size_t position);
+
+    // The program as lexemes, for tools, and as the bytecode that runs.
+    // Both are kept up to date as the program is built.
     const std::vector<Lexeme>& GetProgram() const;
-    Interpreter CreateInterpreter() const;
+    const Bytecode& GetBytecode() const;
+    // Initial values and identifiers of the variables, by slot.
+    const std::vector<TaggedValue>& GetVariables() const;
+    const std::vector<SymbolId>& GetIdentifiers() const;
+    // The interpreter refers to the program, which must outlive it.
+    Interpreter CreateInterpreter(std::istream& input = std::cin, std::ostream& output = std::cout) const;
+    // Same, for a program with stubs that get compiled as they first run.
+    Interpreter CreateLazyInterpreter(std::istream& input = std::cin, std::ostream& output = std::cout);
 
 private:
-    std::unordered_map<std::string, Value> m_variables;
+    std::vector<TaggedValue> m_variables;
+    std::vector<SymbolId> m_identifiers;
+    std::unordered_map<SymbolId, size_t> m_slots;
     std::vector<Lexeme> m_poliz;
+    Bytecode m_code;
+    std::unique_ptr<SymbolTable> m_symbols;
+    std::unique_ptr<Parser> m_parser;
+    // the jump to the end of the program, kept past the compiled blocks
+    size_t m_exit{};
 };
 
@@ -0,0 +1,1143 @@
+#include "registers2.h"
+#include "interpreter2.h"
+#include "jit2.h"
+#include <algorithm>
+#include <functional>
+#include <iomanip>
+#include <map>
+#include <stdexcept>
+#include <utility>
+
+static const char* const c_names[] = {
+    "move",
+    "read",
+    "write",
+    "jump",
+    "jump if false",
+    "fail",
+    "add",
+    "sub",
+    "mul",
+    "div",
+    "lt",
+    "gt",
+    "ge",
+    "le",
+    "eq",
+    "ne",
+    "concat",
+    "lt str",
+    "gt str",
+    "ge str",
+    "le str",
+    "eq str",
+    "ne str",
+    "not",
+    "neg",
+    "pos",
+    "jump unless lt",
+    "jump unless gt",
+    "jump unless ge",
+    "jump unless le",
+    "jump unless eq",
+    "jump unless ne",
+};
+static_assert(sizeof(c_names) / sizeof(c_names[0]) == c_registerOps, "a name per opcode");
+
+static_assert(static_cast<size_t>(RegisterOp::PlusInt) - static_cast<size_t>(RegisterOp::AddInt)
+    == static_cast<size_t>(Opcode::PlusInt) - static_cast<size_t>(Opcode::AddInt),
+    "an operator per typed opcode");
+
+// errors of Fail instructions
+static const char* const c_errors[] = {
+    "unknown variable",
+    "identifier expected",
+};
+
+const char* GetErrorMessage(uint32_t error)
+{
+    return c_errors[error];
+}
+
+static bool IsJump(RegisterOp op)
+{
+    return op == RegisterOp::Jump || op == RegisterOp::JumpIfFalse || op >= RegisterOp::JumpUnlessLessInt;
+}
+
+namespace
+{
+
+// Where the lowering keeps an operand of the stack of the Poliz.
+struct Location
+{
+    enum Kind : uint8_t
+    {
+        Variable,
+        Constant,
+        Temporary,
+    };
+
+    Kind kind;
+    uint32_t index;
+    // A temporary that holds a copy of this variable where the stack
+    // machine refers to the variable itself, -1 for none. Assigning the
+    // variable while the temporary is in use would tell them apart.
+    long long int alias{-1};
+
+    bool operator == (const Location& rhs) const
+    {
+        return kind == rhs.kind && index == rhs.index;
+    }
+    bool operator != (const Location& rhs) const
+    {
+        return !(*this == rhs);
+    }
+};
+
+using Stack = std::vector<Location>;
+
+// Runs the stack of the Poliz symbolically and emits an instruction for
+// each lexeme that computes something. Where paths of the code meet with
+// operands on the stack (the end of an and/or chain), the operands that
+// differ between them go to the temporary of their depth on every path.
+// A first pass finds those, a second emits the moves on the jumps, which
+// come before their target.
+class Lowering
+{
+public:
+    Lowering(const std::vector<Lexeme>& program, size_t variables);
+
+    bool Run(bool emit);
+
+    std::vector<RegisterInstruction> code;
+    std::vector<uint32_t> operands;
+    std::vector<TaggedValue> constants;
+    size_t depth{0};
+
+private:
+    uint32_t GetRegister(const Location& location) const;
+    uint32_t AddConstant(const Value& value);
+    void Emit(RegisterOp op, uint32_t a, uint32_t b = 0, uint32_t c = 0);
+    // Records or, in the second pass, moves the operands for a jump from
+    // `position` to `target` with `stack`.
+    bool AddEdge(size_t position, long long int target, const Stack& stack);
+    // The stack where the paths to `position` meet.
+    bool Merge(size_t position, const Stack* fallthrough);
+    // Moves what `stack` has and `target` lacks to the temporaries.
+    void Materialize(const Stack& stack, const Stack& target);
+
+    const std::vector<Lexeme>& m_program;
+    size_t m_variables;
+    bool m_emit{false};
+    std::vector<bool> m_targets;
+    std::vector<std::vector<Stack>> m_edges;
+    std::vector<Stack> m_merged;
+    std::vector<uint32_t> m_starts;
+    std::map<Value, uint32_t> m_constantIndex;
+};
+
+Lowering::Lowering(const std::vector<Lexeme>& program, size_t variables)
+    : m_program{program}
+    , m_variables{variables}
+    , m_targets(program.size() + 1)
+    , m_edges(program.size() + 1)
+    , m_merged(program.size() + 1)
+    , m_starts(program.size() + 1)
+{
+    for (const auto& lexeme: program)
+    {
+        if (lexeme.type == LexemeType::Goto || lexeme.type == LexemeType::ConditionalGoto)
+        {
+            const auto target = std::get<long long int>(lexeme.value);
+            if (target >= 0 && static_cast<size_t>(target) <= program.size())
+            {
+                m_targets[target] = true;
+            }
+        }
+    }
+}
+
+bool Lowering::Run(bool emit)
+{
+    m_emit = emit;
+    code.clear();
+    operands.clear();
+    depth = 0;
+
+    Stack stack;
+    bool reachable = true;
+    // the instruction whose result is on top of the stack, if it is the
+    // last one and nothing jumps in after it
+    size_t result = SIZE_MAX;
+    for (size_t position = 0; position <= m_program.size(); ++position)
+    {
+        if (m_targets[position])
+        {
+            if (!Merge(position, reachable ? &stack : nullptr))
+            {
+                return false;
+            }
+            stack = m_merged[position];
+            result = SIZE_MAX;
+        }
+        else if (!reachable)
+        {
+            // code after a jump that nothing jumps to starts a statement
+            stack.clear();
+        }
+        reachable = true;
+        m_starts[position] = static_cast<uint32_t>(code.size());
+        if (position == m_program.size())
+        {
+            break;
+        }
+
+        const auto& lexeme = m_program[position];
+        const auto op = GetOpcode(lexeme);
+        const auto last = result;
+        result = SIZE_MAX;
+        switch (op)
+        {
+        case Opcode::PushFalse:
+        case Opcode::PushTrue:
+        case Opcode::PushConstant:
+            stack.push_back({Location::Constant, AddConstant(lexeme.value)});
+            break;
+
+        case Opcode::Load:
+            stack.push_back({Location::Variable, static_cast<uint32_t>(std::get<long long int>(lexeme.value))});
+            break;
+
+        case Opcode::Store:
+        {
+            const auto slot = std::get<long long int>(lexeme.value);
+            for (size_t i = 0; i + 1 < stack.size(); ++i)
+            {
+                if (stack[i].alias == slot)
+                {
+                    return false;
+                }
+            }
+            const Location variable{Location::Variable, static_cast<uint32_t>(slot)};
+            const auto& value = stack.back();
+            if (last != SIZE_MAX && last == code.size() - 1 && value == Location{Location::Temporary, static_cast<uint32_t>(stack.size() - 1)})
+            {
+                // the operator stores its result itself
+                code[last].a = GetRegister(variable);
+            }
+            else if (value != variable)
+            {
+                Emit(RegisterOp::Move, GetRegister(variable), GetRegister(value));
+            }
+            stack.back() = variable;
+            break;
+        }
+
+        case Opcode::StoreUnknown:
+            Emit(RegisterOp::Fail, 0);
+            break;
+
+        case Opcode::Read:
+            if (stack.back().kind == Location::Variable)
+            {
+                Emit(RegisterOp::Read, GetRegister(stack.back()));
+            }
+            else
+            {
+                Emit(RegisterOp::Fail, 1);
+            }
+            stack.pop_back();
+            break;
+
+        case Opcode::Write:
+        {
+            const auto count = static_cast<size_t>(std::get<long long int>(lexeme.value));
+            Emit(RegisterOp::Write, static_cast<uint32_t>(operands.size()), static_cast<uint32_t>(count));
+            for (auto it = stack.end() - count; it != stack.end(); ++it)
+            {
+                operands.push_back(GetRegister(*it));
+            }
+            stack.resize(stack.size() - count);
+            break;
+        }
+
+        case Opcode::Jump:
+        {
+            const auto target = std::get<long long int>(lexeme.value);
+            if (!AddEdge(position, target, stack))
+            {
+                return false;
+            }
+            Emit(RegisterOp::Jump, static_cast<uint32_t>(target));
+            reachable = false;
+            break;
+        }
+
+        case Opcode::JumpIfFalse:
+        {
+            const auto target = std::get<long long int>(lexeme.value);
+            const auto condition = stack.back();
+            stack.pop_back();
+            const auto size = code.size();
+            if (!AddEdge(position, target, stack))
+            {
+                return false;
+            }
+            const auto comparison = last != SIZE_MAX && last == size - 1 && size == code.size()
+                && condition == Location{Location::Temporary, static_cast<uint32_t>(stack.size())}
+                && code[last].op >= RegisterOp::LessInt && code[last].op <= RegisterOp::NotEqualInt;
+            if (comparison)
+            {
+                // jumps on the comparison itself, its result is not needed
+                code[last].op = static_cast<RegisterOp>(static_cast<size_t>(code[last].op)
+                    - static_cast<size_t>(RegisterOp::LessInt) + static_cast<size_t>(RegisterOp::JumpUnlessLessInt));
+                code[last].a = static_cast<uint32_t>(target);
+            }
+            else
+            {
+                Emit(RegisterOp::JumpIfFalse, static_cast<uint32_t>(target), GetRegister(condition));
+            }
+            break;
+        }
+
+        case Opcode::Clear:
+            stack.clear();
+            break;
+
+        case Opcode::Stub:
+            return false;
+
+        case Opcode::Not:
+        case Opcode::NegateInt:
+        case Opcode::PlusInt:
+        {
+            auto& operand = stack.back();
+            const Location temporary{Location::Temporary, static_cast<uint32_t>(stack.size() - 1)};
+            // unary plus only makes a value of a variable
+            if (op != Opcode::PlusInt || operand.kind == Location::Variable)
+            {
+                Emit(static_cast<RegisterOp>(static_cast<size_t>(op) - static_cast<size_t>(Opcode::AddInt)
+                         + static_cast<size_t>(RegisterOp::AddInt)),
+                     GetRegister(temporary), GetRegister(operand));
+                operand = temporary;
+                result = code.size() - 1;
+            }
+            operand.alias = -1;
+            break;
+        }
+
+        default:
+        {
+            // binary operators
+            const auto rhs = stack.back();
+            stack.pop_back();
+            const auto lhs = stack.back();
+            const Location temporary{Location::Temporary, static_cast<uint32_t>(stack.size() - 1)};
+            Emit(static_cast<RegisterOp>(static_cast<size_t>(op) - static_cast<size_t>(Opcode::AddInt)
+                     + static_cast<size_t>(RegisterOp::AddInt)),
+                 GetRegister(temporary), GetRegister(lhs), GetRegister(rhs));
+            stack.back() = temporary;
+            result = code.size() - 1;
+            break;
+        }
+        }
+        depth = std::max(depth, stack.size());
+    }
+
+    // jumps name lexeme positions until every instruction is placed
+    for (auto& instruction: code)
+    {
+        if (IsJump(instruction.op))
+        {
+            instruction.a = m_starts[instruction.a];
+        }
+    }
+    return true;
+}
+
+// Temporaries come after the constants, which are all known once the
+// first pass is done.
+uint32_t Lowering::GetRegister(const Location& location) const
+{
+    switch (location.kind)
+    {
+    case Location::Variable:
+        return location.index;
+    case Location::Constant:
+        return static_cast<uint32_t>(m_variables + location.index);
+    default:
+        return static_cast<uint32_t>(m_variables + constants.size() + location.index);
+    }
+}
+
+uint32_t Lowering::AddConstant(const Value& value)
+{
+    const auto it = m_constantIndex.find(value);
+    if (it != m_constantIndex.end())
+    {
+        return it->second;
+    }
+    constants.emplace_back(value);
+    m_constantIndex.insert({value, static_cast<uint32_t>(constants.size() - 1)});
+    return static_cast<uint32_t>(constants.size() - 1);
+}
+
+void Lowering::Emit(RegisterOp op, uint32_t a, uint32_t b, uint32_t c)
+{
+    code.push_back({op, a, b, c});
+}
+
+bool Lowering::AddEdge(size_t position, long long int target, const Stack& stack)
+{
+    if (target < 0 || static_cast<size_t>(target) > m_program.size())
+    {
+        return false;
+    }
+    if (static_cast<size_t>(target) <= position)
+    {
+        // loops jump back to a condition, on an empty stack
+        return stack.empty() && m_merged[target].empty();
+    }
+    if (m_emit)
+    {
+        Materialize(stack, m_merged[target]);
+    }
+    else
+    {
+        m_edges[target].push_back(stack);
+    }
+    return true;
+}
+
+bool Lowering::Merge(size_t position, const Stack* fallthrough)
+{
+    if (m_emit)
+    {
+        if (fallthrough)
+        {
+            Materialize(*fallthrough, m_merged[position]);
+        }
+        return true;
+    }
+
+    auto& edges = m_edges[position];
+    if (fallthrough)
+    {
+        edges.push_back(*fallthrough);
+    }
+    auto& merged = m_merged[position];
+    merged = edges.empty() ? Stack{} : edges.front();
+    for (const auto& edge: edges)
+    {
+        if (edge.size() != merged.size())
+        {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < merged.size(); ++i)
+    {
+        const Location temporary{Location::Temporary, static_cast<uint32_t>(i)};
+        const bool same = std::all_of(edges.begin(), edges.end(),
+                                      [&](const Stack& edge) { return edge[i] == merged[i]; });
+        if (!same)
+        {
+            merged[i] = temporary;
+        }
+        // a variable left on some path is a copy from here on
+        for (const auto& edge: edges)
+        {
+            const auto alias = !same && edge[i].kind == Location::Variable
+                ? static_cast<long long int>(edge[i].index)
+                : edge[i].alias;
+            if (alias >= 0 && merged[i].alias >= 0 && merged[i].alias != alias)
+            {
+                return false;
+            }
+            if (alias >= 0)
+            {
+                merged[i].alias = alias;
+            }
+        }
+    }
+    edges.clear();
+    return true;
+}
+
+void Lowering::Materialize(const Stack& stack, const Stack& target)
+{
+    for (size_t i = 0; i < stack.size() && i < target.size(); ++i)
+    {
+        if (stack[i] != target[i])
+        {
+            Emit(RegisterOp::Move, GetRegister(target[i]), GetRegister(stack[i]));
+        }
+    }
+}
+
+}
+
+bool RegisterCode::Lower(const std::vector<Lexeme>& program, size_t variables)
+{
+    Lowering lowering{program, variables};
+    if (!lowering.Run(false) || !lowering.Run(true))
+    {
+        return false;
+    }
+    m_code = std::move(lowering.code);
+    m_operands = std::move(lowering.operands);
+    m_constants = std::move(lowering.constants);
+    m_variables = variables;
+    m_frameSize = variables + m_constants.size() + lowering.depth;
+    return true;
+}
+
+bool RegisterCode::LowerLoop(const std::vector<Lexeme>& program, size_t variables, size_t begin, size_t end)
+{
+    std::vector<Lexeme> loop(program.begin() + begin, program.begin() + end + 1);
+    for (auto& lexeme: loop)
+    {
+        if (lexeme.type == LexemeType::Goto || lexeme.type == LexemeType::ConditionalGoto)
+        {
+            const auto target = std::get<long long int>(lexeme.value);
+            if (target < static_cast<long long int>(begin) || target > static_cast<long long int>(end + 1))
+            {
+                return false;
+            }
+            lexeme.value = target - static_cast<long long int>(begin);
+        }
+    }
+    return Lower(loop, variables);
+}
+
+const std::vector<RegisterInstruction>& RegisterCode::GetCode() const
+{
+    return m_code;
+}
+
+const std::vector<uint32_t>& RegisterCode::GetOperands() const
+{
+    return m_operands;
+}
+
+const std::vector<TaggedValue>& RegisterCode::GetConstants() const
+{
+    return m_constants;
+}
+
+size_t RegisterCode::GetVariables() const
+{
+    return m_variables;
+}
+
+size_t RegisterCode::GetFrameSize() const
+{
+    return m_frameSize;
+}
+
+void RegisterCode::Print(std::ostream& os, size_t index) const
+{
+    const auto register_ = [this, &os](uint32_t number)
+    {
+        if (number < m_variables)
+        {
+            os << 'v' << number;
+        }
+        else if (number < m_variables + m_constants.size())
+        {
+            const auto& value = m_constants[number - m_variables];
+            if (value.IsString())
+            {
+                os << '"' << value << '"';
+            }
+            else
+            {
+                os << value;
+            }
+        }
+        else
+        {
+            os << 't' << number - m_variables - m_constants.size();
+        }
+    };
+
+    const auto& instruction = m_code[index];
+    os << c_names[static_cast<size_t>(instruction.op)] << ' ';
+    switch (instruction.op)
+    {
+    case RegisterOp::Read:
+        register_(instruction.a);
+        break;
+
+    case RegisterOp::Write:
+        for (uint32_t i = 0; i < instruction.b; ++i)
+        {
+            os << (i ? ", " : "");
+            register_(m_operands[instruction.a + i]);
+        }
+        break;
+
+    case RegisterOp::Jump:
+        os << instruction.a;
+        break;
+
+    case RegisterOp::JumpIfFalse:
+        register_(instruction.b);
+        os << ", " << instruction.a;
+        break;
+
+    case RegisterOp::Fail:
+        os << c_errors[instruction.a];
+        break;
+
+    case RegisterOp::Move:
+    case RegisterOp::Not:
+    case RegisterOp::NegateInt:
+    case RegisterOp::PlusInt:
+        register_(instruction.a);
+        os << ", ";
+        register_(instruction.b);
+        break;
+
+    default:
+        if (IsJump(instruction.op))
+        {
+            register_(instruction.b);
+            os << ", ";
+            register_(instruction.c);
+            os << ", " << instruction.a;
+        }
+        else
+        {
+            register_(instruction.a);
+            os << ", ";
+            register_(instruction.b);
+            os << ", ";
+            register_(instruction.c);
+        }
+        break;
+    }
+}
+
+void RegisterCode::Disassemble(std::ostream& os) const
+{
+    for (size_t i = 0; i < m_code.size(); ++i)
+    {
+        os << std::setw(6) << i << "  ";
+        Print(os, i);
+        os << '\n';
+    }
+    os << m_code.size() << " instructions, " << m_frameSize << " registers" << std::endl;
+}
+
+RegisterInterpreter::RegisterInterpreter(const RegisterCode& program,
+                                         const std::vector<TaggedValue>& variables,
+                                         std::istream& input, std::ostream& output)
+    : m_program{program}
+    , m_frame(program.GetFrameSize())
+    , m_input{input}
+    , m_output{output}
+{
+    std::copy(variables.begin(), variables.end(), m_frame.begin());
+    std::copy(program.GetConstants().begin(), program.GetConstants().end(), m_frame.begin() + variables.size());
+}
+
+#if defined(__GNUC__)
+# define REGISTERS_THREADED 1
+#else
+# define REGISTERS_THREADED 0
+#endif
+
+void RegisterInterpreter::Run(bool debug)
+{
+    if (debug)
+    {
+        RunSwitch<true>(0, m_program.GetCode().size());
+    }
+#if REGISTERS_THREADED
+    else if (GetDispatch() == Dispatch::Threaded)
+    {
+        RunThreaded();
+    }
+#endif
+    else
+    {
+        RunSwitch<false>(0, m_program.GetCode().size());
+    }
+}
+
+void RegisterInterpreter::Run(const JitCode& native)
+{
+    native.Run(m_frame.data(), this);
+    if (m_error)
+    {
+        std::rethrow_exception(std::exchange(m_error, nullptr));
+    }
+}
+
+TaggedValue* RegisterInterpreter::GetFrame()
+{
+    return m_frame.data();
+}
+
+int RegisterInterpreter::Step(void* context, uint32_t index)
+{
+    auto& interpreter = *static_cast<RegisterInterpreter*>(context);
+    try
+    {
+        interpreter.RunSwitch<false>(index, index + 1);
+        return 0;
+    }
+    catch (...)
+    {
+        // unwinding through the native code is not possible, so the error
+        // is passed around it
+        interpreter.m_error = std::current_exception();
+        return 1;
+    }
+}
+
+template <bool Debug>
+void RegisterInterpreter::RunSwitch(size_t begin, size_t end)
+{
+    const auto code = m_program.GetCode().data();
+    size_t i{begin};
+    while (i < end)
+    {
+        if constexpr (Debug)
+        {
+            std::cerr << '[';
+            m_program.Print(std::cerr, i);
+            std::cerr << ", ip: " << i << "]\n";
+        }
+        const auto& instruction = code[i++];
+        switch (instruction.op)
+        {
+        case RegisterOp::Move:
+            m_frame[instruction.a] = m_frame[instruction.b];
+            break;
+
+        case RegisterOp::Read:
+            HandleRead(m_frame[instruction.a]);
+            break;
+
+        case RegisterOp::Write:
+            HandleWrite(instruction);
+            break;
+
+        case RegisterOp::Jump:
+            i = instruction.a;
+            break;
+
+        case RegisterOp::JumpIfFalse:
+            if (!m_frame[instruction.b].GetBool())
+            {
+                i = instruction.a;
+            }
+            break;
+
+        case RegisterOp::Fail:
+            throw std::runtime_error(c_errors[instruction.a]);
+
+        case RegisterOp::AddInt:
+            HandleInt(std::plus<>{}, instruction);
+            break;
+
+        case RegisterOp::SubtractInt:
+            HandleInt(std::minus<>{}, instruction);
+            break;
+
+        case RegisterOp::MultiplyInt:
+            HandleInt(std::multiplies<>{}, instruction);
+            break;
+
+        case RegisterOp::DivideInt:
+            HandleInt(std::divides<>{}, instruction);
+            break;
+
+        case RegisterOp::LessInt:
+            HandleInt(std::less<>{}, instruction);
+            break;
+
+        case RegisterOp::GreaterInt:
+            HandleInt(std::greater<>{}, instruction);
+            break;
+
+        case RegisterOp::NotLessInt:
+            HandleInt(std::greater_equal<>{}, instruction);
+            break;
+
+        case RegisterOp::NotGreaterInt:
+            HandleInt(std::less_equal<>{}, instruction);
+            break;
+
+        case RegisterOp::EqualInt:
+            HandleInt(std::equal_to<>{}, instruction);
+            break;
+
+        case RegisterOp::NotEqualInt:
+            HandleInt(std::not_equal_to<>{}, instruction);
+            break;
+
+        case RegisterOp::Concatenate:
+            m_frame[instruction.a] = TaggedValue::Concatenate(m_frame[instruction.b].GetString(),
+                                                              m_frame[instruction.c].GetString());
+            break;
+
+        case RegisterOp::LessString:
+            HandleString(std::less<>{}, instruction);
+            break;
+
+        case RegisterOp::GreaterString:
+            HandleString(std::greater<>{}, instruction);
+            break;
+
+        case RegisterOp::NotLessString:
+            HandleString(std::greater_equal<>{}, instruction);
+            break;
+
+        case RegisterOp::NotGreaterString:
+            HandleString(std::less_equal<>{}, instruction);
+            break;
+
+        case RegisterOp::EqualString:
+            HandleString(std::equal_to<>{}, instruction);
+            break;
+
+        case RegisterOp::NotEqualString:
+            HandleString(std::not_equal_to<>{}, instruction);
+            break;
+
+        case RegisterOp::Not:
+            m_frame[instruction.a] = !m_frame[instruction.b].GetBool();
+            break;
+
+        case RegisterOp::NegateInt:
+            m_frame[instruction.a] = -m_frame[instruction.b].GetInt();
+            break;
+
+        case RegisterOp::PlusInt:
+            m_frame[instruction.a] = m_frame[instruction.b].GetInt();
+            break;
+
+        case RegisterOp::JumpUnlessLessInt:
+            if (!IsTrue(std::less<>{}, instruction))
+            {
+                i = instruction.a;
+            }
+            break;
+
+        case RegisterOp::JumpUnlessGreaterInt:
+            if (!IsTrue(std::greater<>{}, instruction))
+            {
+                i = instruction.a;
+            }
+            break;
+
+        case RegisterOp::JumpUnlessNotLessInt:
+            if (!IsTrue(std::greater_equal<>{}, instruction))
+            {
+                i = instruction.a;
+            }
+            break;
+
+        case RegisterOp::JumpUnlessNotGreaterInt:
+            if (!IsTrue(std::less_equal<>{}, instruction))
+            {
+                i = instruction.a;
+            }
+            break;
+
+        case RegisterOp::JumpUnlessEqualInt:
+            if (!IsTrue(std::equal_to<>{}, instruction))
+            {
+                i = instruction.a;
+            }
+            break;
+
+        case RegisterOp::JumpUnlessNotEqualInt:
+            if (!IsTrue(std::not_equal_to<>{}, instruction))
+            {
+                i = instruction.a;
+            }
+            break;
+        }
+    }
+}
+
+#if REGISTERS_THREADED
+
+#if !defined(__clang__)
+# pragma GCC push_options
+# pragma GCC optimize("no-gcse", "no-crossjumping")
+#endif
+
+// Same handlers as RunSwitch(), as in Interpreter::RunThreaded().
+void RegisterInterpreter::RunThreaded()
+{
+    static const void* const handlers[] = {
+        &&Move,
+        &&Read,
+        &&Write,
+        &&Jump,
+        &&JumpIfFalse,
+        &&Fail,
+        &&AddInt,
+        &&SubtractInt,
+        &&MultiplyInt,
+        &&DivideInt,
+        &&LessInt,
+        &&GreaterInt,
+        &&NotLessInt,
+        &&NotGreaterInt,
+        &&EqualInt,
+        &&NotEqualInt,
+        &&Concatenate,
+        &&LessString,
+        &&GreaterString,
+        &&NotLessString,
+        &&NotGreaterString,
+        &&EqualString,
+        &&NotEqualString,
+        &&Not,
+        &&NegateInt,
+        &&PlusInt,
+        &&JumpUnlessLessInt,
+        &&JumpUnlessGreaterInt,
+        &&JumpUnlessNotLessInt,
+        &&JumpUnlessNotGreaterInt,
+        &&JumpUnlessEqualInt,
+        &&JumpUnlessNotEqualInt,
+    };
+    static_assert(sizeof(handlers) / sizeof(handlers[0]) == c_registerOps, "one handler per opcode");
+
+    const auto code = m_program.GetCode().data();
+    const auto size = m_program.GetCode().size();
+    size_t i{0};
+    const RegisterInstruction* instruction{};
+
+#define DISPATCH() \
+    if (i >= size) \
+    { \
+        return; \
+    } \
+    instruction = &code[i++]; \
+    goto *handlers[static_cast<size_t>(instruction->op)]
+
+    DISPATCH();
+
+Move:
+    m_frame[instruction->a] = m_frame[instruction->b];
+    DISPATCH();
+
+Read:
+    HandleRead(m_frame[instruction->a]);
+    DISPATCH();
+
+Write:
+    HandleWrite(*instruction);
+    DISPATCH();
+
+Jump:
+    i = instruction->a;
+    DISPATCH();
+
+JumpIfFalse:
+    if (!m_frame[instruction->b].GetBool())
+    {
+        i = instruction->a;
+    }
+    DISPATCH();
+
+Fail:
+    throw std::runtime_error(c_errors[instruction->a]);
+
+AddInt:
+    HandleInt(std::plus<>{}, *instruction);
+    DISPATCH();
+
+SubtractInt:
+    HandleInt(std::minus<>{}, *instruction);
+    DISPATCH();
+
+MultiplyInt:
+    HandleInt(std::multiplies<>{}, *instruction);
+    DISPATCH();
+
+DivideInt:
+    HandleInt(std::divides<>{}, *instruction);
+    DISPATCH();
+
+LessInt:
+    HandleInt(std::less<>{}, *instruction);
+    DISPATCH();
+
+GreaterInt:
+    HandleInt(std::greater<>{}, *instruction);
+    DISPATCH();
+
+NotLessInt:
+    HandleInt(std::greater_equal<>{}, *instruction);
+    DISPATCH();
+
+NotGreaterInt:
+    HandleInt(std::less_equal<>{}, *instruction);
+    DISPATCH();
+
+EqualInt:
+    HandleInt(std::equal_to<>{}, *instruction);
+    DISPATCH();
+
+NotEqualInt:
+    HandleInt(std::not_equal_to<>{}, *instruction);
+    DISPATCH();
+
+Concatenate:
+    m_frame[instruction->a] = TaggedValue::Concatenate(m_frame[instruction->b].GetString(),
+                                                       m_frame[instruction->c].GetString());
+    DISPATCH();
+
+LessString:
+    HandleString(std::less<>{}, *instruction);
+    DISPATCH();
+
+GreaterString:
+    HandleString(std::greater<>{}, *instruction);
+    DISPATCH();
+
+NotLessString:
+    HandleString(std::greater_equal<>{}, *instruction);
+    DISPATCH();
+
+NotGreaterString:
+    HandleString(std::less_equal<>{}, *instruction);
+    DISPATCH();
+
+EqualString:
+    HandleString(std::equal_to<>{}, *instruction);
+    DISPATCH();
+
+NotEqualString:
+    HandleString(std::not_equal_to<>{}, *instruction);
+    DISPATCH();
+
+Not:
+    m_frame[instruction->a] = !m_frame[instruction->b].GetBool();
+    DISPATCH();
+
+NegateInt:
+    m_frame[instruction->a] = -m_frame[instruction->b].GetInt();
+    DISPATCH();
+
+PlusInt:
+    m_frame[instruction->a] = m_frame[instruction->b].GetInt();
+    DISPATCH();
+
+JumpUnlessLessInt:
+    if (!IsTrue(std::less<>{}, *instruction))
+    {
+        i = instruction->a;
+    }
+    DISPATCH();
+
+JumpUnlessGreaterInt:
+    if (!IsTrue(std::greater<>{}, *instruction))
+    {
+        i = instruction->a;
+    }
+    DISPATCH();
+
+JumpUnlessNotLessInt:
+    if (!IsTrue(std::greater_equal<>{}, *instruction))
+    {
+        i = instruction->a;
+    }
+    DISPATCH();
+
+JumpUnlessNotGreaterInt:
+    if (!IsTrue(std::less_equal<>{}, *instruction))
+    {
+        i = instruction->a;
+    }
+    DISPATCH();
+
+JumpUnlessEqualInt:
+    if (!IsTrue(std::equal_to<>{}, *instruction))
+    {
+        i = instruction->a;
+    }
+    DISPATCH();
+
+JumpUnlessNotEqualInt:
+    if (!IsTrue(std::not_equal_to<>{}, *instruction))
+    {
+        i = instruction->a;
+    }
+    DISPATCH();
+
+#undef DISPATCH
+}
+
+#if !defined(__clang__)
+# pragma GCC pop_options
+#endif
+
+#endif
+
+void RegisterInterpreter::HandleRead(TaggedValue& variable)
+{
+    switch (variable.GetType())
+    {
+    case TaggedValue::Type::Bool:
+    {
+        bool value{};
+        m_input >> value;
+        variable = value;
+        break;
+    }
+
+    case TaggedValue::Type::Int:
+    {
+        long long int value{};
+        m_input >> value;
+        variable = value;
+        break;
+    }
+
+    case TaggedValue::Type::String:
+    {
+        std::string value;
+        m_input >> value;
+        variable = TaggedValue{std::string_view{value}};
+        break;
+    }
+    }
+}
+
+void RegisterInterpreter::HandleWrite(const RegisterInstruction& instruction)
+{
+    const auto operands = m_program.GetOperands().data() + instruction.a;
+    for (uint32_t i = 0; i < instruction.b; ++i)
+    {
+        m_output << m_frame[operands[i]] << " ";
+    }
+    m_output << std::endl;
+}
+
+template <typename Operation>
+void RegisterInterpreter::HandleInt(Operation operation, const RegisterInstruction& instruction)
+{
+    m_frame[instruction.a] = operation(m_frame[instruction.b].GetInt(), m_frame[instruction.c].GetInt());
+}
+
+template <typename Operation>
+void RegisterInterpreter::HandleString(Operation operation, const RegisterInstruction& instruction)
+{
+    m_frame[instruction.a] = static_cast<bool>(operation(m_frame[instruction.b].GetString(),
+                                                         m_frame[instruction.c].GetString()));
+}
+
+template <typename Operation>
+bool RegisterInterpreter::IsTrue(Operation operation, const RegisterInstruction& instruction)
+{
+    return operation(m_frame[instruction.b].GetInt(), m_frame[instruction.c].GetInt());
+}
@@ -0,0 +1,157 @@
+#pragma once
+#include "bytecode2.h"
+#include "lexical2.h"
+#include "value2.h"
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <vector>
+
+// Instructions of the register machine, in three-address form over a frame
+// of registers: the variables by slot, then the constants, then one
+// temporary for each depth of the stack of the Poliz. The destination, if
+// any, is the first operand.
+enum class RegisterOp : uint8_t
+{
+    // a = b
+    Move = 0,
+    // reads a value into variable a
+    Read,
+    // writes registers operands[a], ..., operands[a + b - 1] on a line
+    Write,
+    // to instruction a
+    Jump,
+    // to instruction a if b is false
+    JumpIfFalse,
+    // throws error a, for code that fails once it runs
+    Fail,
+    // a = b op c and a = op b, in the order of Opcode
+    AddInt,
+    SubtractInt,
+    MultiplyInt,
+    DivideInt,
+    LessInt,
+    GreaterInt,
+    NotLessInt,
+    NotGreaterInt,
+    EqualInt,
+    NotEqualInt,
+    Concatenate,
+    LessString,
+    GreaterString,
+    NotLessString,
+    NotGreaterString,
+    EqualString,
+    NotEqualString,
+    Not,
+    NegateInt,
+    PlusInt,
+    // to instruction a unless b op c, in the order of the comparisons above
+    JumpUnlessLessInt,
+    JumpUnlessGreaterInt,
+    JumpUnlessNotLessInt,
+    JumpUnlessNotGreaterInt,
+    JumpUnlessEqualInt,
+    JumpUnlessNotEqualInt,
+};
+
+constexpr size_t c_registerOps = static_cast<size_t>(RegisterOp::JumpUnlessNotEqualInt) + 1;
+
+// Message of the error a Fail instruction throws.
+const char* GetErrorMessage(uint32_t error);
+
+struct RegisterInstruction
+{
+    RegisterOp op;
+    uint32_t a;
+    uint32_t b;
+    uint32_t c;
+};
+
+// A program lowered from its Poliz for the register machine. Operands that
+// the stack machine pushes only to pop them again become registers of the
+// instructions that use them: `c = (a + b) * 2;` takes two instructions,
+// not seven.
+class RegisterCode
+{
+public:
+    // Lowers the Poliz of a program with `variables` slots. Returns false for
+    // a program that the register machine would not run as the stack
+    // machine does: one with blocks still to compile, or one that assigns a
+    // variable while the stack machine still refers to it through the
+    // result of an and/or chain, which the registers hold as a copy.
+    bool Lower(const std::vector<Lexeme>& program, size_t variables);
+    // Lowers only the loop from its condition at `begin` to its jump back
+    // at `end`, which runs until it leaves the loop for `end` + 1. Returns
+    // false also if code in the loop jumps anywhere else outside it.
+    bool LowerLoop(const std::vector<Lexeme>& program, size_t variables, size_t begin, size_t end);
+
+    const std::vector<RegisterInstruction>& GetCode() const;
+    // registers written by Write instructions
+    const std::vector<uint32_t>& GetOperands() const;
+    const std::vector<TaggedValue>& GetConstants() const;
+    size_t GetVariables() const;
+    // registers in a frame, constants and temporaries included
+    size_t GetFrameSize() const;
+
+    // Prints the instruction at `index`.
+    void Print(std::ostream& os, size_t index) const;
+    // Prints every instruction.
+    void Disassemble(std::ostream& os) const;
+
+private:
+    std::vector<RegisterInstruction> m_code;
+    std::vector<uint32_t> m_operands;
+    std::vector<TaggedValue> m_constants;
+    size_t m_variables{0};
+    size_t m_frameSize{0};
+};
+
+class JitCode;
+
+// Runs a lowered program that outlives it, on its own copy of the variables.
+class RegisterInterpreter
+{
+public:
+    RegisterInterpreter(const RegisterCode& program,
+                        const std::vector<TaggedValue>& variables,
+                        std::istream& input = std::cin, std::ostream& output = std::cout);
+    RegisterInterpreter(const RegisterInterpreter& rhs) = delete;
+    RegisterInterpreter& operator = (const RegisterInterpreter& rhs) = delete;
+
+    // Runs the program from the start, tracing each instruction if `debug`
+    // is set. Dispatch is threaded or a switch as SetDispatch() says.
+    void Run(bool debug = false);
+    // Runs the program compiled to `native` from it.
+    void Run(const JitCode& native);
+    // The frame, variables first, to set before a run and read after it.
+    TaggedValue* GetFrame();
+
+    // Runs the instruction at `index` for native code, with the interpreter
+    // as `context`. Returns nonzero if it failed, with the error kept for
+    // Run() to throw.
+    static int Step(void* context, uint32_t index);
+
+private:
+    // Runs from instruction `begin` until a jump out of [begin, end).
+    template <bool Debug>
+    void RunSwitch(size_t begin, size_t end);
+    // only built where threaded dispatch is available
+    void RunThreaded();
+
+    void HandleRead(TaggedValue& variable);
+    void HandleWrite(const RegisterInstruction& instruction);
+    template <typename Operation>
+    void HandleInt(Operation operation, const RegisterInstruction& instruction);
+    template <typename Operation>
+    void HandleString(Operation operation, const RegisterInstruction& instruction);
+    template <typename Operation>
+    bool IsTrue(Operation operation, const RegisterInstruction& instruction);
+
+    const RegisterCode& m_program;
+    std::vector<TaggedValue> m_frame;
+    std::istream& m_input;
+    std::ostream& m_output;
+    // the error of a failed Step()
+    std::exception_ptr m_error;
+};
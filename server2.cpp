@@ -0,0 +1,406 @@
+#include "server2.h"
+#include "poliz2.h"
+#include "source2.h"
+#include "syntax2.h"
+#include "threads2.h"
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <streambuf>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Compiled programs the server keeps around.
+static constexpr size_t c_cachedPrograms = 64;
+// Longest a request may run before it is killed.
+static constexpr unsigned c_requestSeconds = 10;
+
+ProgramCache::ProgramCache(size_t capacity)
+    : m_capacity{capacity}
+{
+}
+
+std::shared_ptr<const Poliz> ProgramCache::Get(std::string_view source)
+{
+    const auto key = GetCacheKey(source);
+    {
+        std::lock_guard lock{m_mutex};
+        if (const auto it = m_index.find(key.hash); it != m_index.end() && it->second->first.size == key.size)
+        {
+            m_entries.splice(m_entries.begin(), m_entries, it->second);
+            return it->second->second;
+        }
+    }
+
+    // two workers may compile the same program at once, the later one wins
+    auto poliz = std::make_shared<Poliz>();
+    Compile(source, *poliz);
+
+    std::lock_guard lock{m_mutex};
+    if (const auto it = m_index.find(key.hash); it != m_index.end())
+    {
+        m_entries.erase(it->second);
+        m_index.erase(it);
+    }
+    m_entries.emplace_front(key, poliz);
+    m_index[key.hash] = m_entries.begin();
+    if (m_entries.size() > m_capacity)
+    {
+        m_index.erase(m_entries.back().first.hash);
+        m_entries.pop_back();
+    }
+    return poliz;
+}
+
+class Socket
+{
+public:
+    explicit Socket(int fd)
+        : m_fd{fd}
+    {
+    }
+    Socket(const Socket& rhs) = delete;
+    Socket& operator = (const Socket& rhs) = delete;
+    ~Socket()
+    {
+        if (m_fd >= 0)
+        {
+            ::close(m_fd);
+        }
+    }
+
+    int Get() const
+    {
+        return m_fd;
+    }
+
+private:
+    const int m_fd;
+};
+
+// Both directions carry frames: a tag, a uint32_t length and the data.
+// Requests are a 'T' or 'P' frame with the program and an 'I' frame with the
+// input, replies any number of 'O' (output) and 'E' (error) frames and an
+// 'X' frame with the exit status.
+
+static bool SendAll(int fd, const char* data, size_t size)
+{
+    while (size > 0)
+    {
+        const auto count = ::send(fd, data, size, MSG_NOSIGNAL);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count <= 0)
+        {
+            return false;
+        }
+        data += count;
+        size -= count;
+    }
+    return true;
+}
+
+static bool ReceiveAll(int fd, char* data, size_t size)
+{
+    while (size > 0)
+    {
+        const auto count = ::recv(fd, data, size, 0);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count <= 0)
+        {
+            return false;
+        }
+        data += count;
+        size -= count;
+    }
+    return true;
+}
+
+static bool SendFrame(int fd, char tag, std::string_view data)
+{
+    char header[1 + sizeof(uint32_t)];
+    const auto size = static_cast<uint32_t>(data.size());
+    header[0] = tag;
+    std::memcpy(header + 1, &size, sizeof(size));
+    return SendAll(fd, header, sizeof(header)) && SendAll(fd, data.data(), data.size());
+}
+
+static bool ReceiveFrame(int fd, char& tag, std::string& data)
+{
+    char header[1 + sizeof(uint32_t)];
+    uint32_t size;
+    if (!ReceiveAll(fd, header, sizeof(header)))
+    {
+        return false;
+    }
+    tag = header[0];
+    std::memcpy(&size, header + 1, sizeof(size));
+    data.resize(size);
+    return ReceiveAll(fd, data.data(), size);
+}
+
+// Sends what the program writes as one 'O' frame per flush; `write` flushes
+// at the end of each statement.
+class FrameBuffer
+    : public std::streambuf
+{
+public:
+    explicit FrameBuffer(int fd)
+        : m_fd{fd}
+    {
+    }
+
+protected:
+    int overflow(int ch) override
+    {
+        if (ch != traits_type::eof())
+        {
+            m_buffer.push_back(static_cast<char>(ch));
+        }
+        return ch;
+    }
+
+    std::streamsize xsputn(const char* data, std::streamsize size) override
+    {
+        m_buffer.append(data, size);
+        return size;
+    }
+
+    int sync() override
+    {
+        if (m_buffer.empty())
+        {
+            return 0;
+        }
+        const bool sent = SendFrame(m_fd, 'O', m_buffer);
+        m_buffer.clear();
+        return sent ? 0 : -1;
+    }
+
+private:
+    const int m_fd;
+    std::string m_buffer;
+};
+
+// Ends a reply with the error messages, if any, and the exit status.
+static void SendResult(int fd, const std::string& errors)
+{
+    if (!errors.empty())
+    {
+        SendFrame(fd, 'E', errors);
+    }
+    SendFrame(fd, 'X', std::string(1, errors.empty() ? EXIT_SUCCESS : EXIT_FAILURE));
+}
+
+static void HandleConnection(int fd, ProgramCache& cache)
+{
+    const Socket connection{fd};
+    Request request;
+    char tag{};
+    if (!ReceiveFrame(fd, tag, request.program) || (tag != Request::Text && tag != Request::Path))
+    {
+        return;
+    }
+    request.kind = static_cast<Request::Kind>(tag);
+    if (!ReceiveFrame(fd, tag, request.input) || tag != 'I')
+    {
+        return;
+    }
+
+    std::ostringstream errors;
+    std::shared_ptr<const Poliz> poliz;
+    try
+    {
+        std::unique_ptr<SourceBuffer> file;
+        std::string_view source{request.program};
+        if (request.kind == Request::Path)
+        {
+            file = std::make_unique<SourceBuffer>(request.program.c_str());
+            source = file->GetView();
+        }
+        poliz = cache.Get(source);
+    }
+    catch (lexical_exception& e)
+    {
+        errors << "lexical error: " << e.what() << std::endl;
+        errors << "debug info: " << e.DebugInfo() << std::endl;
+    }
+    catch (syntax_exception& e)
+    {
+        errors << "syntax error: " << e.what() << std::endl;
+        errors << "debug info: " << e.DebugInfo() << std::endl;
+    }
+    catch (std::exception& e)
+    {
+        errors << "error: " << e.what() << std::endl;
+    }
+
+    // The program runs in a child of its own, so that a signal it raises
+    // (an integer division by zero) or a loop that never ends takes down
+    // the request and not the server. The child only runs the compiled
+    // program and touches nothing the other workers lock.
+    if (poliz)
+    {
+        const auto pid = ::fork();
+        if (pid == 0)
+        {
+            ::alarm(c_requestSeconds);
+            FrameBuffer buffer{fd};
+            std::ostream output{&buffer};
+            try
+            {
+                std::istringstream input{request.input};
+                auto interpreter = poliz->CreateInterpreter(input, output);
+                interpreter.Run();
+            }
+            catch (std::exception& e)
+            {
+                errors << "error: " << e.what() << std::endl;
+            }
+            output.flush();
+            SendResult(fd, errors.str());
+            ::_exit(EXIT_SUCCESS);
+        }
+
+        int status{};
+        auto waited = pid;
+        while (pid > 0 && (waited = ::waitpid(pid, &status, 0)) < 0 && errno == EINTR)
+        {
+        }
+        if (pid < 0)
+        {
+            errors << "error: cannot start the program" << std::endl;
+        }
+        else if (waited != pid || !WIFSIGNALED(status))
+        {
+            // the child has replied
+            return;
+        }
+        else if (WTERMSIG(status) == SIGALRM)
+        {
+            errors << "error: program ran longer than " << c_requestSeconds << " s" << std::endl;
+        }
+        else
+        {
+            errors << "error: program killed by signal " << WTERMSIG(status) << " (" << ::strsignal(WTERMSIG(status))
+                   << ")" << std::endl;
+        }
+    }
+    SendResult(fd, errors.str());
+}
+
+static sockaddr_un MakeAddress(const char* socketPath)
+{
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (std::strlen(socketPath) >= sizeof(address.sun_path))
+    {
+        throw std::runtime_error("socket path is too long");
+    }
+    std::strcpy(address.sun_path, socketPath);
+    return address;
+}
+
+// Removes the socket a server left behind at `address`. Throws if the path
+// is something else or a server still answers on it.
+static void RemoveStaleSocket(const sockaddr_un& address)
+{
+    struct stat info{};
+    if (::lstat(address.sun_path, &info) != 0)
+    {
+        if (errno == ENOENT)
+        {
+            return;
+        }
+        throw std::runtime_error("cannot check socket path");
+    }
+    if (!S_ISSOCK(info.st_mode))
+    {
+        throw std::runtime_error("socket path exists and is not a socket");
+    }
+    const Socket probe{::socket(AF_UNIX, SOCK_STREAM, 0)};
+    if (probe.Get() < 0)
+    {
+        throw std::runtime_error("cannot check socket path");
+    }
+    if (::connect(probe.Get(), reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0)
+    {
+        throw std::runtime_error("a server is already listening on the socket");
+    }
+    ::unlink(address.sun_path);
+}
+
+void Serve(const char* socketPath, size_t workers)
+{
+    const auto address = MakeAddress(socketPath);
+    RemoveStaleSocket(address);
+    const Socket listener{::socket(AF_UNIX, SOCK_STREAM, 0)};
+    if (listener.Get() < 0
+        || ::bind(listener.Get(), reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0
+        || ::listen(listener.Get(), SOMAXCONN) != 0)
+    {
+        throw std::runtime_error("cannot listen on socket");
+    }
+
+    ProgramCache cache{c_cachedPrograms};
+    ThreadPool pool{workers};
+    while (true)
+    {
+        const int fd = ::accept(listener.Get(), nullptr, nullptr);
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            throw std::runtime_error("cannot accept connection");
+        }
+        pool.Submit([fd, &cache] { HandleConnection(fd, cache); });
+    }
+}
+
+int SendRequest(const char* socketPath, const Request& request,
+                std::ostream& output, std::ostream& errors)
+{
+    const auto address = MakeAddress(socketPath);
+    const Socket connection{::socket(AF_UNIX, SOCK_STREAM, 0)};
+    if (connection.Get() < 0
+        || ::connect(connection.Get(), reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0)
+    {
+        throw std::runtime_error("cannot connect to server");
+    }
+    if (!SendFrame(connection.Get(), request.kind, request.program)
+        || !SendFrame(connection.Get(), 'I', request.input))
+    {
+        throw std::runtime_error("cannot send request");
+    }
+
+    char tag{};
+    std::string data;
+    while (ReceiveFrame(connection.Get(), tag, data))
+    {
+        if (tag == 'O')
+        {
+            output << data << std::flush;
+        }
+        else if (tag == 'E')
+        {
+            errors << data << std::flush;
+        }
+        else if (tag == 'X' && data.size() == 1)
+        {
+            return data[0];
+        }
+    }
+    throw std::runtime_error("server closed the connection");
+}
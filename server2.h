@@ -0,0 +1,58 @@
+#pragma once
+#include "cache2.h"
+#include <list>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+class Poliz;
+
+// Compiled programs by source hash. The least recently used one is dropped
+// when there are more than `capacity`.
+class ProgramCache
+{
+public:
+    explicit ProgramCache(size_t capacity);
+    ProgramCache(const ProgramCache& rhs) = delete;
+    ProgramCache& operator = (const ProgramCache& rhs) = delete;
+
+    // Compiles on a miss, compile errors are thrown as by Compile().
+    std::shared_ptr<const Poliz> Get(std::string_view source);
+
+private:
+    using Entry = std::pair<CacheKey, std::shared_ptr<const Poliz>>;
+
+    const size_t m_capacity;
+    std::mutex m_mutex;
+    // most recently used first
+    std::list<Entry> m_entries;
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> m_index;
+};
+
+// A program to run, by text or by a path the server can read, and the whole
+// input for its `read`s. The reply streams the output of every `write` as it
+// happens and ends with the exit status int would have had.
+struct Request
+{
+    enum Kind : char
+    {
+        Text = 'T',
+        Path = 'P',
+    };
+
+    Kind kind{Text};
+    std::string program;
+    std::string input;
+};
+
+// Serves requests on the Unix socket `socketPath` with `workers` threads.
+// Does not return unless the socket cannot be set up.
+void Serve(const char* socketPath, size_t workers);
+
+// Runs one request on the server, copying its output and error messages as
+// they come. Returns the exit status.
+int SendRequest(const char* socketPath, const Request& request,
+                std::ostream& output, std::ostream& errors);
@@ -0,0 +1,255 @@
+#include "skip2.h"
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+# define SKIP_X86 1
+# include <immintrin.h>
+#else
+# define SKIP_X86 0
+#endif
+
+static bool IsSpace(char ch)
+{
+    return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n';
+}
+
+static const char* SkipSpacesScalar(const char* begin, const char* end, int& lines)
+{
+    for (; begin != end && IsSpace(*begin); ++begin)
+    {
+        lines += *begin == '\n';
+    }
+    return begin;
+}
+
+static const char* FindQuoteScalar(const char* begin, const char* end, int& lines)
+{
+    for (; begin != end && *begin != '"'; ++begin)
+    {
+        lines += *begin == '\n';
+    }
+    return begin;
+}
+
+static const char* FindCommentEndScalar(const char* begin, const char* end, int& lines)
+{
+    for (; begin != end; ++begin)
+    {
+        if (*begin == '*' && begin + 1 != end && begin[1] == '/')
+        {
+            return begin;
+        }
+        lines += *begin == '\n';
+    }
+    return end;
+}
+
+#if SKIP_X86
+
+// Newlines among the bytes of `newlines` that come before bit `stop`.
+static int CountBefore(uint32_t newlines, int stop)
+{
+    return __builtin_popcount(newlines & ((1u << stop) - 1));
+}
+
+static const char* SkipSpacesSse2(const char* begin, const char* end, int& lines)
+{
+    const auto space = _mm_set1_epi8(' ');
+    const auto tab = _mm_set1_epi8('\t');
+    const auto cr = _mm_set1_epi8('\r');
+    const auto lf = _mm_set1_epi8('\n');
+    for (; end - begin >= 16; begin += 16)
+    {
+        const auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+        const auto isLf = _mm_cmpeq_epi8(chunk, lf);
+        const auto isSpace = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, space), _mm_cmpeq_epi8(chunk, tab)),
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, cr), isLf));
+        const uint32_t newlines = _mm_movemask_epi8(isLf);
+        const uint32_t other = ~_mm_movemask_epi8(isSpace) & 0xffffu;
+        if (other)
+        {
+            const int stop = __builtin_ctz(other);
+            lines += CountBefore(newlines, stop);
+            return begin + stop;
+        }
+        lines += __builtin_popcount(newlines);
+    }
+    return SkipSpacesScalar(begin, end, lines);
+}
+
+static const char* FindQuoteSse2(const char* begin, const char* end, int& lines)
+{
+    const auto quote = _mm_set1_epi8('"');
+    const auto lf = _mm_set1_epi8('\n');
+    for (; end - begin >= 16; begin += 16)
+    {
+        const auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+        const uint32_t newlines = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, lf));
+        const uint32_t quotes = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, quote));
+        if (quotes)
+        {
+            const int stop = __builtin_ctz(quotes);
+            lines += CountBefore(newlines, stop);
+            return begin + stop;
+        }
+        lines += __builtin_popcount(newlines);
+    }
+    return FindQuoteScalar(begin, end, lines);
+}
+
+static const char* FindCommentEndSse2(const char* begin, const char* end, int& lines)
+{
+    const auto star = _mm_set1_epi8('*');
+    const auto slash = _mm_set1_epi8('/');
+    const auto lf = _mm_set1_epi8('\n');
+    // the second load looks one byte ahead, so keep 17 bytes in range
+    for (; end - begin >= 17; begin += 16)
+    {
+        const auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+        const auto next = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin + 1));
+        const uint32_t newlines = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, lf));
+        const uint32_t closes = _mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(chunk, star), _mm_cmpeq_epi8(next, slash)));
+        if (closes)
+        {
+            const int stop = __builtin_ctz(closes);
+            lines += CountBefore(newlines, stop);
+            return begin + stop;
+        }
+        lines += __builtin_popcount(newlines);
+    }
+    return FindCommentEndScalar(begin, end, lines);
+}
+
+#pragma GCC push_options
+#pragma GCC target("avx2,popcnt,bmi2")
+
+static uint32_t CountBeforeAvx2(uint32_t newlines, int stop)
+{
+    return _mm_popcnt_u32(_bzhi_u32(newlines, stop));
+}
+
+static const char* SkipSpacesAvx2(const char* begin, const char* end, int& lines)
+{
+    const auto space = _mm256_set1_epi8(' ');
+    const auto tab = _mm256_set1_epi8('\t');
+    const auto cr = _mm256_set1_epi8('\r');
+    const auto lf = _mm256_set1_epi8('\n');
+    for (; end - begin >= 32; begin += 32)
+    {
+        const auto chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+        const auto isLf = _mm256_cmpeq_epi8(chunk, lf);
+        const auto isSpace = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(chunk, space), _mm256_cmpeq_epi8(chunk, tab)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(chunk, cr), isLf));
+        const uint32_t newlines = _mm256_movemask_epi8(isLf);
+        const uint32_t other = ~static_cast<uint32_t>(_mm256_movemask_epi8(isSpace));
+        if (other)
+        {
+            const int stop = __builtin_ctz(other);
+            lines += CountBeforeAvx2(newlines, stop);
+            return begin + stop;
+        }
+        lines += _mm_popcnt_u32(newlines);
+    }
+    return SkipSpacesSse2(begin, end, lines);
+}
+
+static const char* FindQuoteAvx2(const char* begin, const char* end, int& lines)
+{
+    const auto quote = _mm256_set1_epi8('"');
+    const auto lf = _mm256_set1_epi8('\n');
+    for (; end - begin >= 32; begin += 32)
+    {
+        const auto chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+        const uint32_t newlines = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, lf));
+        const uint32_t quotes = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, quote));
+        if (quotes)
+        {
+            const int stop = __builtin_ctz(quotes);
+            lines += CountBeforeAvx2(newlines, stop);
+            return begin + stop;
+        }
+        lines += _mm_popcnt_u32(newlines);
+    }
+    return FindQuoteSse2(begin, end, lines);
+}
+
+static const char* FindCommentEndAvx2(const char* begin, const char* end, int& lines)
+{
+    const auto star = _mm256_set1_epi8('*');
+    const auto slash = _mm256_set1_epi8('/');
+    const auto lf = _mm256_set1_epi8('\n');
+    for (; end - begin >= 33; begin += 32)
+    {
+        const auto chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+        const auto next = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin + 1));
+        const uint32_t newlines = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, lf));
+        const uint32_t closes = _mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(chunk, star), _mm256_cmpeq_epi8(next, slash)));
+        if (closes)
+        {
+            const int stop = __builtin_ctz(closes);
+            lines += CountBeforeAvx2(newlines, stop);
+            return begin + stop;
+        }
+        lines += _mm_popcnt_u32(newlines);
+    }
+    return FindCommentEndSse2(begin, end, lines);
+}
+
+#pragma GCC pop_options
+
+#endif
+
+static const SkipKernels c_scalar{"scalar", SkipSpacesScalar, FindQuoteScalar, FindCommentEndScalar};
+#if SKIP_X86
+static const SkipKernels c_sse2{"sse2", SkipSpacesSse2, FindQuoteSse2, FindCommentEndSse2};
+static const SkipKernels c_avx2{"avx2", SkipSpacesAvx2, FindQuoteAvx2, FindCommentEndAvx2};
+#endif
+
+static const SkipKernels* FindKernels(SkipKernel kernel)
+{
+#if SKIP_X86
+    __builtin_cpu_init();
+    const bool hasAvx2 = __builtin_cpu_supports("avx2")
+        && __builtin_cpu_supports("popcnt")
+        && __builtin_cpu_supports("bmi2");
+    switch (kernel)
+    {
+    case SkipKernel::Auto:
+        return hasAvx2 ? &c_avx2 : &c_sse2;
+    case SkipKernel::Avx2:
+        return hasAvx2 ? &c_avx2 : nullptr;
+    case SkipKernel::Sse2:
+        return &c_sse2;
+    case SkipKernel::Scalar:
+        return &c_scalar;
+    }
+    return nullptr;
+#else
+    return kernel == SkipKernel::Auto || kernel == SkipKernel::Scalar ? &c_scalar : nullptr;
+#endif
+}
+
+static const SkipKernels*& ActiveKernels()
+{
+    static const SkipKernels* kernels = FindKernels(SkipKernel::Auto);
+    return kernels;
+}
+
+const SkipKernels& GetSkipKernels()
+{
+    return *ActiveKernels();
+}
+
+bool SetSkipKernel(SkipKernel kernel)
+{
+    if (const auto kernels = FindKernels(kernel))
+    {
+        ActiveKernels() = kernels;
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+// Bulk scanning helpers for the buffered scanner. Each function looks at
+// [begin, end), adds the number of '\n' it steps over to `lines` and returns
+// the stop position, or `end` if there is none.
+struct SkipKernels
+{
+    const char* name;
+    // first byte that is not ' ', '\t', '\r' or '\n'
+    const char* (*skipSpaces)(const char* begin, const char* end, int& lines);
+    // first '"'
+    const char* (*findQuote)(const char* begin, const char* end, int& lines);
+    // first "*/", pointing at the '*'
+    const char* (*findCommentEnd)(const char* begin, const char* end, int& lines);
+};
+
+enum class SkipKernel
+{
+    Auto = 0,
+    Scalar,
+    Sse2,
+    Avx2,
+};
+
+// Kernels used by every Scanner. Picked from CPU features on first use.
+const SkipKernels& GetSkipKernels();
+// Forces a kernel (for benchmarks and tests); returns false if the CPU lacks it.
+bool SetSkipKernel(SkipKernel kernel);
@@ -0,0 +1,64 @@
+#include "source2.h"
+#include <stdexcept>
+#include <iterator>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+SourceBuffer::SourceBuffer(const char* path)
+{
+    const int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        throw std::runtime_error("cannot open source file");
+    }
+
+    struct stat st{};
+    if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        void* mapping = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED)
+        {
+            m_mapping = mapping;
+            m_size = st.st_size;
+            ::madvise(m_mapping, m_size, MADV_SEQUENTIAL);
+            ::close(fd);
+            return;
+        }
+    }
+
+    char chunk[1 << 16];
+    ssize_t count{};
+    while ((count = ::read(fd, chunk, sizeof(chunk))) > 0)
+    {
+        m_storage.append(chunk, count);
+    }
+    ::close(fd);
+    if (count < 0)
+    {
+        throw std::runtime_error("cannot read source file");
+    }
+}
+
+SourceBuffer::SourceBuffer(std::istream& input)
+{
+    m_storage.assign(std::istreambuf_iterator<char>{input}, std::istreambuf_iterator<char>{});
+}
+
+SourceBuffer::~SourceBuffer()
+{
+    if (m_mapping)
+    {
+        ::munmap(m_mapping, m_size);
+    }
+}
+
+std::string_view SourceBuffer::GetView() const
+{
+    if (m_mapping)
+    {
+        return {static_cast<const char*>(m_mapping), m_size};
+    }
+    return m_storage;
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <istream>
+
+// Whole program text as one contiguous buffer. Regular files are mapped
+// into memory, anything else (pipes, stdin) is read in one go.
+class SourceBuffer
+{
+public:
+    explicit SourceBuffer(const char* path);
+    explicit SourceBuffer(std::istream& input);
+    SourceBuffer(const SourceBuffer& rhs) = delete;
+    SourceBuffer& operator = (const SourceBuffer& rhs) = delete;
+    ~SourceBuffer();
+
+    std::string_view GetView() const;
+
+private:
+    void* m_mapping{};
+    size_t m_size{};
+    std::string m_storage;
+};
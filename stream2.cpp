@@ -0,0 +1,169 @@
+#include "stream2.h"
+#include "bytecode2.h"
+#include "interpreter2.h"
+#include "poliz2.h"
+#include "symbols2.h"
+#include "syntax2.h"
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+// tokens lexed at a time
+static constexpr size_t c_batch = 4096;
+// Code is handed over in chunks that start small, for an early start, and
+// grow, so that a fast interpreter does not wait on every statement.
+static constexpr size_t c_firstChunk = 64;
+static constexpr size_t c_lastChunk = 1 << 16;
+
+// Code on its way from the parser thread to the interpreter.
+class CodeStream
+{
+public:
+    // Parser side. Publish() hands over the program up to `end`, that is up
+    // to the end of the last whole statement, and returns false once the
+    // interpreter has stopped. Finish() hands over the rest.
+    void Declare(const std::vector<TaggedValue>& variables)
+    {
+        std::lock_guard lock{m_mutex};
+        m_variables = variables;
+        m_declared = true;
+        m_changed.notify_one();
+    }
+
+    bool Publish(const std::vector<Lexeme>& program, size_t end)
+    {
+        if (end - m_published >= m_chunk)
+        {
+            std::lock_guard lock{m_mutex};
+            Take(program, end);
+            m_chunk = std::min(m_chunk * 2, c_lastChunk);
+            return !m_stopped;
+        }
+        return true;
+    }
+
+    void Finish(const std::vector<Lexeme>& program, size_t end, std::exception_ptr error)
+    {
+        std::lock_guard lock{m_mutex};
+        Take(program, end);
+        m_error = error;
+        m_finished = true;
+        m_changed.notify_one();
+    }
+
+    // Interpreter side. Errors of the compile are thrown once there is no
+    // code before them left.
+    std::vector<TaggedValue> WaitVariables()
+    {
+        std::unique_lock lock{m_mutex};
+        m_changed.wait(lock, [this] { return m_declared || m_finished; });
+        if (!m_declared)
+        {
+            std::rethrow_exception(m_error);
+        }
+        return std::move(m_variables);
+    }
+
+    // Takes the next code, false at the end of the program.
+    bool Fetch(std::vector<Lexeme>& code)
+    {
+        std::unique_lock lock{m_mutex};
+        m_changed.wait(lock, [this] { return !m_code.empty() || m_finished; });
+        if (m_code.empty())
+        {
+            if (m_error)
+            {
+                std::rethrow_exception(m_error);
+            }
+            return false;
+        }
+        code.clear();
+        code.swap(m_code);
+        return true;
+    }
+
+    void Stop()
+    {
+        std::lock_guard lock{m_mutex};
+        m_stopped = true;
+    }
+
+private:
+    void Take(const std::vector<Lexeme>& program, size_t end)
+    {
+        m_code.insert(m_code.end(), program.begin() + m_published, program.begin() + end);
+        m_published = end;
+        m_changed.notify_one();
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable m_changed;
+    std::vector<TaggedValue> m_variables;
+    std::vector<Lexeme> m_code;
+    // parser side: code handed over so far and the size of the next chunk
+    size_t m_published{0};
+    size_t m_chunk{c_firstChunk};
+    std::exception_ptr m_error;
+    bool m_declared{false};
+    bool m_finished{false};
+    bool m_stopped{false};
+};
+
+static void CompileStatements(std::string_view source, CodeStream& stream)
+{
+    SymbolTable symbols;
+    Poliz poliz;
+    // end of the code of whole statements
+    size_t end{0};
+    try
+    {
+        Scanner scanner(source, symbols);
+        Parser parser(scanner, poliz, c_batch);
+        parser.AnalizeHeader();
+        stream.Declare(poliz.GetVariables());
+
+        while (parser.AnalizeStatement())
+        {
+            end = poliz.GetProgram().size();
+            if (!stream.Publish(poliz.GetProgram(), end))
+            {
+                return;
+            }
+        }
+        stream.Finish(poliz.GetProgram(), end, nullptr);
+    }
+    catch (...)
+    {
+        stream.Finish(poliz.GetProgram(), end, std::current_exception());
+    }
+}
+
+void RunStreaming(std::string_view source, std::istream& input, std::ostream& output, bool debug)
+{
+    CodeStream stream;
+    std::thread compiler{[source, &stream] { CompileStatements(source, stream); }};
+    try
+    {
+        std::vector<Lexeme> code;
+        Bytecode program;
+        Interpreter interpreter(program, stream.WaitVariables(), input, output);
+        while (stream.Fetch(code))
+        {
+            // encoded here, off the parser thread
+            for (const auto& lexeme: code)
+            {
+                program.Add(lexeme);
+            }
+            interpreter.Run(debug);
+        }
+    }
+    catch (...)
+    {
+        stream.Stop();
+        compiler.join();
+        throw;
+    }
+    compiler.join();
+}
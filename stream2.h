@@ -0,0 +1,12 @@
+#pragma once
+#include <iostream>
+#include <string_view>
+
+// Runs a program while it is still being compiled. A parser thread lexes
+// and parses the source a statement at a time and hands over the code of
+// each finished top-level statement; the interpreter runs up to the end of
+// the code it has and waits there for more. Top-level statements never
+// jump past their own end, so every jump it can take is already patched.
+// A compile error further down is thrown after all the code before it ran.
+void RunStreaming(std::string_view source, std::istream& input = std::cin,
+                  std::ostream& output = std::cout, bool debug = false);
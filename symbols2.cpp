@@ -0,0 +1,43 @@
+#include "symbols2.h"
+
+SymbolTable::SymbolTable(std::pmr::memory_resource* resource)
+    : m_names{resource}
+    , m_ids{resource}
+{
+}
+
+SymbolId SymbolTable::Intern(std::string_view name)
+{
+    if (const auto it = m_ids.find(name); it != m_ids.end())
+    {
+        return it->second;
+    }
+    const auto id = static_cast<SymbolId>(m_names.size());
+    m_names.emplace_back(name);
+    m_ids.insert({m_names.back(), id});
+    return id;
+}
+
+std::string_view SymbolTable::GetName(SymbolId id) const
+{
+    return m_names.at(id);
+}
+
+size_t SymbolTable::GetSize() const
+{
+    return m_names.size();
+}
+
+Lexeme SymbolTable::Restore(const Lexeme& lexeme) const
+{
+    if (lexeme.type != LexemeType::Identifier)
+    {
+        return lexeme;
+    }
+    return {LexemeType::Identifier, std::string{GetName(GetSymbol(lexeme))}};
+}
+
+SymbolId GetSymbol(const Lexeme& lexeme)
+{
+    return static_cast<SymbolId>(std::get<long long int>(lexeme.value));
+}
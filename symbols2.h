@@ -0,0 +1,33 @@
+#pragma once
+#include "lexical2.h"
+#include <cstdint>
+#include <deque>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+using SymbolId = uint32_t;
+
+// Identifier names of one program. Each name is stored once and identifier
+// lexemes carry its id (in the integral alternative of Value).
+class SymbolTable
+{
+public:
+    explicit SymbolTable(std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+    SymbolTable(const SymbolTable& rhs) = delete;
+    SymbolTable& operator = (const SymbolTable& rhs) = delete;
+
+    SymbolId Intern(std::string_view name);
+    std::string_view GetName(SymbolId id) const;
+    size_t GetSize() const;
+
+    // Identifier lexemes with the name in place of the id, for dumps and errors.
+    Lexeme Restore(const Lexeme& lexeme) const;
+
+private:
+    std::pmr::deque<std::pmr::string> m_names;
+    std::pmr::unordered_map<std::string_view, SymbolId> m_ids;
+};
+
+SymbolId GetSymbol(const Lexeme& lexeme);
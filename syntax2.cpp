@@ -1,8 +1,11 @@
 #include "syntax2.h"
 #include "poliz2.h"
+#include "symbols2.h"
 #include <sstream>
+#include <algorithm>
+#include <memory>
 
-#define THROW(msg, line, lex) throw syntax_exception((msg), (line), (lex))
+#define THROW(msg, line, lex) throw syntax_exception((msg), (line), m_symbols.Restore(lex))
 
 bool IsComparsionOperator(LexemeType op)
 {
@@ -30,50 +33,115 @@ bool IsMultiplyDivideOperator(LexemeType op)
 }
 
 Parser::Parser(Scanner& scanner, Poliz& poliz)
-    : m_scanner{scanner}
+    : Parser{Tokenize(scanner), scanner.GetSymbols(), poliz}
+{
+}
+
+Parser::Parser(Scanner& scanner, Poliz& poliz, size_t batch)
+    : Parser{TokenArray{}, scanner.GetSymbols(), poliz}
+{
+    m_scanner = &scanner;
+    m_batch = batch;
+}
+
+Parser::Parser(TokenArray tokens, SymbolTable& symbols, Poliz& poliz)
+    : m_tokens{std::move(tokens)}
+    , m_symbols{symbols}
     , m_poliz{poliz}
+    , m_breaks{m_tokens.tokens.get_allocator()}
+    , m_loopBlocks{m_tokens.tokens.get_allocator()}
+    , m_jumps{m_tokens.tokens.get_allocator()}
+    , m_expression{m_tokens.tokens.get_allocator()}
+    , m_types{m_tokens.tokens.get_allocator()}
 {
 }
 
 void Parser::Analize()
 {
-    if (const auto lex = GetLexeme(); lex.type != LexemeType::Program)
+    AnalizeHeader();
+    while (AnalizeStatement())
+    {
+    }
+}
+
+void Parser::AnalizeHeader()
+{
+    if (const auto& lex = GetLexeme(); lex.type != LexemeType::Program)
     {
-        THROW("'program' expected", m_scanner.GetCurrentLine(), lex);
+        THROW("'program' expected", GetCurrentLine(), lex);
     }
-    if (const auto lex = GetLexeme(); lex.type != LexemeType::LeftBrace)
+    if (const auto& lex = GetLexeme(); lex.type != LexemeType::LeftBrace)
     {
-        THROW("'{' expected", m_scanner.GetCurrentLine(), lex);
+        THROW("'{' expected", GetCurrentLine(), lex);
     }
-    AnalizeProgram(true);
+    AnalizeDefenitions();
+}
+
+bool Parser::AnalizeStatement()
+{
+    if (AnalizeOperator(true))
+    {
+        return true;
+    }
+    // the closing '}'
+    GetLexeme();
+    return false;
 }
 
 Lexeme Parser::GetLexeme()
 {
-    Lexeme lexeme;
-    if (m_saved.empty())
+    if (m_cursor == m_tokens.tokens.size() && m_scanner)
     {
-        lexeme = m_scanner.GetLexeme();
+        LexBatch();
     }
-    else
+    if (m_cursor == m_tokens.tokens.size())
     {
-        lexeme = std::move(m_saved.top());
-        m_saved.pop();
+        if (m_tokens.error)
+        {
+            std::rethrow_exception(m_tokens.error);
+        }
+        // the stream always ends with Eof, keep returning it
+        m_cursor -= 1;
     }
-    return lexeme;
+    m_cursor += 1;
+    m_fetched = std::max(m_fetched, m_cursor);
+    return m_tokens.Get(m_cursor - 1);
 }
 
-void Parser::SaveLexeme(Lexeme&& lexeme)
+void Parser::LexBatch()
 {
-    m_saved.push(std::move(lexeme));
+    try
+    {
+        for (size_t i = 0; i < m_batch; ++i)
+        {
+            auto lexeme = m_scanner->GetLexeme();
+            m_tokens.Add(std::move(lexeme), m_scanner->GetCurrentLine());
+            if (m_tokens.tokens.back().type == LexemeType::Eof)
+            {
+                m_scanner = nullptr;
+                return;
+            }
+        }
+    }
+    catch (const lexical_exception&)
+    {
+        m_tokens.error = std::current_exception();
+        m_scanner = nullptr;
+    }
 }
 
-void Parser::AnalizeProgram(bool defenitions)
+void Parser::UngetLexeme()
+{
+    m_cursor -= 1;
+}
+
+int Parser::GetCurrentLine() const
+{
+    return m_fetched ? m_tokens.tokens[m_fetched - 1].line : 1;
+}
+
+void Parser::AnalizeProgram()
 {
-    if (defenitions)
-    {
-        AnalizeDefenitions();
-    }
     AnalizeOperators();
     if (GetLexeme().type != LexemeType::RightBrace)
     {
@@ -91,7 +159,7 @@ void Parser::AnalizeDefenitions()
         AnalizeDefenition(lexeme.type);
         lexeme = GetLexeme();
     }
-    SaveLexeme(std::move(lexeme));
+    UngetLexeme();
 }
 
 void Parser::AnalizeDefenition(LexemeType type)
@@ -106,21 +174,21 @@ void Parser::AnalizeDefenition(LexemeType type)
 
     if (lexeme.type != LexemeType::Semicolon)
     {
-        THROW("';' expected", m_scanner.GetCurrentLine(), lexeme);
+        THROW("';' expected", GetCurrentLine(), lexeme);
     }
 }
 
 void Parser::AnalizeVariable(LexemeType type)
 {
-    auto var = GetLexeme();
+    const auto& var = GetLexeme();
     if (var.type != LexemeType::Identifier)
     {
-        THROW("identifier expected", m_scanner.GetCurrentLine(), var);
+        THROW("identifier expected", GetCurrentLine(), var);
     }
 
-    const auto identifier = std::get<std::string>(var.value);
+    const auto identifier = GetSymbol(var);
 
-    auto assign = GetLexeme();
+    const auto& assign = GetLexeme();
     if (assign.type != LexemeType::Assign)
     {
         Value defaultValue;
@@ -137,30 +205,72 @@ void Parser::AnalizeVariable(LexemeType type)
             defaultValue = false;
         }
         m_poliz.AddIdentifier(identifier, defaultValue);
-        SaveLexeme(std::move(assign));
+        UngetLexeme();
         return;
     }
 
-    auto value = GetLexeme();
+    const auto& value = GetLexeme();
     if (value.type != LexemeType::Literal)
     {
-        THROW("literal expected", m_scanner.GetCurrentLine(), value);
+        THROW("literal expected", GetCurrentLine(), value);
     }
     if (type == LexemeType::String && !std::get_if<std::string>(&value.value))
     {
-        THROW("string literal expected", m_scanner.GetCurrentLine(), value);
+        THROW("string literal expected", GetCurrentLine(), value);
     }
     if (type == LexemeType::Int && !std::get_if<long long int>(&value.value))
     {
-        THROW("integral literal expected", m_scanner.GetCurrentLine(), value);
+        THROW("integral literal expected", GetCurrentLine(), value);
     }
     if (type == LexemeType::Boolean && !std::get_if<bool>(&value.value))
     {
-        THROW("boolean literal expected", m_scanner.GetCurrentLine(), value);
+        THROW("boolean literal expected", GetCurrentLine(), value);
     }
     m_poliz.AddIdentifier(identifier, value.value);
 }
 
+void Parser::AnalizeFragment()
+{
+    while (GetLexeme().type != LexemeType::Eof)
+    {
+        UngetLexeme();
+        if (!AnalizeOperator(true))
+        {
+            THROW("operator expected", GetCurrentLine(), Lexeme{LexemeType::RightBrace});
+        }
+    }
+}
+
+void Parser::SetOutline(std::vector<StatementOutline>* outline)
+{
+    m_outline = outline;
+}
+
+void Parser::SetLazy(bool lazy)
+{
+    m_lazy = lazy;
+}
+
+void Parser::AnalizeBlock(size_t block)
+{
+    const auto [firstToken, breakLabel] = m_blocks[block];
+    m_cursor = firstToken;
+    m_fetched = firstToken;
+    m_loops = breakLabel >= 0;
+    AnalizeProgram();
+    for (const auto pos: m_breaks)
+    {
+        m_poliz.SetLabel(pos, breakLabel);
+    }
+    for (const auto nested: m_loopBlocks)
+    {
+        m_blocks[nested].breakLabel = breakLabel;
+    }
+    m_breaks.clear();
+    m_loopBlocks.clear();
+    m_loops = 0;
+}
+
 void Parser::AnalizeOperators()
 {
     bool isPresent{false};
@@ -171,12 +281,14 @@ void Parser::AnalizeOperators()
     while (isPresent);
 }
 
-bool Parser::AnalizeOperator()
+bool Parser::AnalizeOperator(bool topLevel)
 {
-    switch (auto lexeme = GetLexeme(); lexeme.type)
+    const auto firstToken = m_cursor;
+    const auto codeBegin = static_cast<size_t>(m_poliz.GetCurrentLabel());
+    switch (const auto& lexeme = GetLexeme(); lexeme.type)
     {
     case LexemeType::RightBrace:
-        SaveLexeme(std::move(lexeme));
+        UngetLexeme();
         return false;
 
     case LexemeType::If:
@@ -200,119 +312,146 @@ bool Parser::AnalizeOperator()
         break;
 
     case LexemeType::LeftBrace:
-        AnalizeProgram(false);
+        if (m_lazy)
+        {
+            SkipBlock();
+        }
+        else
+        {
+            AnalizeProgram();
+        }
         break;
 
     default:
-        SaveLexeme(std::move(lexeme));
+        UngetLexeme();
         AnalizeExpressionOperator();
         break;
     }
 
+    if (topLevel && m_outline)
+    {
+        m_outline->push_back({firstToken, m_cursor, codeBegin, static_cast<size_t>(m_poliz.GetCurrentLabel())});
+    }
     return true;
 }
 
 void Parser::AnalizeIf()
 {
-    if (const auto lex = GetLexeme(); lex.type != LexemeType::LeftParenthesis)
+    if (const auto& lex = GetLexeme(); lex.type != LexemeType::LeftParenthesis)
     {
-        THROW("'(' expected", m_scanner.GetCurrentLine(), lex);
+        THROW("'(' expected", GetCurrentLine(), lex);
+    }
+    if (AnalizeExpression() != ValueType::Bool)
+    {
+        THROW("boolean expected", GetCurrentLine(), Lexeme{LexemeType::If});
     }
-    AnalizeExpression();
     auto pos1 = m_poliz.AddConditionalGoto();
 
-    if (const auto lex = GetLexeme(); lex.type != LexemeType::RightParenthesis)
+    if (const auto& lex = GetLexeme(); lex.type != LexemeType::RightParenthesis)
     {
-        THROW("')' expected", m_scanner.GetCurrentLine(), lex);
+        THROW("')' expected", GetCurrentLine(), lex);
     }
 
     if (!AnalizeOperator())
     {
-        THROW("operator expected", m_scanner.GetCurrentLine(), Lexeme{});
+        THROW("operator expected", GetCurrentLine(), Lexeme{});
     }
 
-    if (auto lex = GetLexeme(); lex.type == LexemeType::Else)
+    if (const auto& lex = GetLexeme(); lex.type == LexemeType::Else)
     {
         auto pos2 = m_poliz.AddGoto();
 
         m_poliz.SetLabel(pos1);
         if (!AnalizeOperator())
         {
-            THROW("operator expected", m_scanner.GetCurrentLine(), Lexeme{});
+            THROW("operator expected", GetCurrentLine(), Lexeme{});
         }
         m_poliz.SetLabel(pos2);
     }
     else 
     {
-        SaveLexeme(std::move(lex));
+        UngetLexeme();
         m_poliz.SetLabel(pos1);
     }
 }
 
 void Parser::AnalizeWhile()
 {
-    if (const auto lex = GetLexeme(); lex.type != LexemeType::LeftParenthesis)
+    if (const auto& lex = GetLexeme(); lex.type != LexemeType::LeftParenthesis)
     {
-        THROW("'(' expected", m_scanner.GetCurrentLine(), lex);
+        THROW("'(' expected", GetCurrentLine(), lex);
     }
 
     const auto label = m_poliz.GetCurrentLabel();
-    AnalizeExpression();
-    if (const auto lex = GetLexeme(); lex.type != LexemeType::RightParenthesis)
+    const auto type = AnalizeExpression();
+    if (const auto& lex = GetLexeme(); lex.type != LexemeType::RightParenthesis)
     {
-        THROW("')' expected", m_scanner.GetCurrentLine(), lex);
+        THROW("')' expected", GetCurrentLine(), lex);
+    }
+    if (type != ValueType::Bool)
+    {
+        THROW("boolean expected", GetCurrentLine(), Lexeme{LexemeType::While});
     }
 
     auto exitPos = m_poliz.AddConditionalGoto();
 
-    m_breaks.push({});
+    const auto firstBreak = m_breaks.size();
+    const auto firstBlock = m_loopBlocks.size();
+    m_loops += 1;
     if (!AnalizeOperator())
     {
-        THROW("operator expected", m_scanner.GetCurrentLine(), Lexeme{});
+        THROW("operator expected", GetCurrentLine(), Lexeme{});
     }
+    m_loops -= 1;
     auto pos = m_poliz.AddGoto();
     m_poliz.SetLabel(pos, label);
     m_poliz.SetLabel(exitPos);
-    for (auto pos: m_breaks.top())
+    for (size_t i = firstBreak; i < m_breaks.size(); ++i)
     {
-        m_poliz.SetLabel(pos);
+        m_poliz.SetLabel(m_breaks[i]);
+    }
+    m_breaks.resize(firstBreak);
+    for (size_t i = firstBlock; i < m_loopBlocks.size(); ++i)
+    {
+        m_blocks[m_loopBlocks[i]].breakLabel = m_poliz.GetCurrentLabel();
     }
-    m_breaks.pop();
+    m_loopBlocks.resize(firstBlock);
 }
 
 void Parser::AnalizeRead()
 {
-    if (const auto lex = GetLexeme(); lex.type != LexemeType::LeftParenthesis)
+    if (const auto& lex = GetLexeme(); lex.type != LexemeType::LeftParenthesis)
     {
-        THROW("'(' expected", m_scanner.GetCurrentLine(), lex);
+        THROW("'(' expected", GetCurrentLine(), lex);
     }
-    auto identifier = GetLexeme();
+    const auto& identifier = GetLexeme();
     if (identifier.type != LexemeType::Identifier)
     {
-        THROW("identifier expected", m_scanner.GetCurrentLine(), identifier);
+        THROW("identifier expected", GetCurrentLine(), identifier);
     }
-    if (!m_poliz.HasIdentifier(std::get<std::string>(identifier.value)))
+    const auto slot = m_poliz.FindSlot(GetSymbol(identifier));
+    if (slot < 0)
     {
-        THROW("unknown identifier", m_scanner.GetCurrentLine(), identifier);
+        THROW("unknown identifier", GetCurrentLine(), identifier);
     }
-    if (const auto lex = GetLexeme(); lex.type != LexemeType::RightParenthesis)
+    if (const auto& lex = GetLexeme(); lex.type != LexemeType::RightParenthesis)
     {
-        THROW("')' expected", m_scanner.GetCurrentLine(), lex);
+        THROW("')' expected", GetCurrentLine(), lex);
     }
-    if (const auto lex = GetLexeme(); lex.type != LexemeType::Semicolon)
+    if (const auto& lex = GetLexeme(); lex.type != LexemeType::Semicolon)
     {
-        THROW("';' expected", m_scanner.GetCurrentLine(), lex);
+        THROW("';' expected", GetCurrentLine(), lex);
     }
 
-    m_poliz.AddLexeme(identifier);
+    m_poliz.AddLexeme({LexemeType::LoadSlot, slot});
     m_poliz.AddLexeme({LexemeType::Read, {}});
 }
 
 void Parser::AnalizeWrite()
 {
-    if (const auto lex = GetLexeme(); lex.type != LexemeType::LeftParenthesis)
+    if (const auto& lex = GetLexeme(); lex.type != LexemeType::LeftParenthesis)
     {
-        THROW("'(' expected", m_scanner.GetCurrentLine(), lex);
+        THROW("'(' expected", GetCurrentLine(), lex);
     }
 
     long long int counter{0};
@@ -326,224 +465,339 @@ void Parser::AnalizeWrite()
 
     if (lex.type != LexemeType::RightParenthesis)
     {
-        THROW("')' expected", m_scanner.GetCurrentLine(), lex);
+        THROW("')' expected", GetCurrentLine(), lex);
     }
-    if (const auto lex = GetLexeme(); lex.type != LexemeType::Semicolon)
+    if (const auto& lex = GetLexeme(); lex.type != LexemeType::Semicolon)
     {
-        THROW("';' expected", m_scanner.GetCurrentLine(), lex);
+        THROW("';' expected", GetCurrentLine(), lex);
     }
     m_poliz.AddLexeme({LexemeType::Write, counter});
 }
 
 void Parser::AnalizeBreak()
 {
-    if (m_breaks.empty())
+    if (m_loops == 0)
     {
-        THROW("break is out of any loop", m_scanner.GetCurrentLine(), Lexeme{LexemeType::Break});
+        THROW("break is out of any loop", GetCurrentLine(), Lexeme{LexemeType::Break});
     }
-    if (const auto lex = GetLexeme(); lex.type != LexemeType::Semicolon)
+    if (const auto& lex = GetLexeme(); lex.type != LexemeType::Semicolon)
     {
-        THROW("';' expected", m_scanner.GetCurrentLine(), lex);
+        THROW("';' expected", GetCurrentLine(), lex);
     }
-    m_breaks.top().push_back(m_poliz.AddGoto());
+    m_breaks.push_back(m_poliz.AddGoto());
+}
+
+void Parser::SkipBlock()
+{
+    const auto firstToken = m_cursor;
+    const auto& tokens = m_tokens.tokens;
+    for (size_t depth = 1; depth > 0; m_cursor += 1)
+    {
+        if (m_cursor == tokens.size() && m_scanner)
+        {
+            LexBatch();
+        }
+        if (m_cursor == tokens.size() || tokens[m_cursor].type == LexemeType::Eof)
+        {
+            // rethrows the lexical error that cut the tokens short, if any
+            const auto& lex = GetLexeme();
+            THROW("'}' expected", GetCurrentLine(), lex);
+        }
+        depth += tokens[m_cursor].type == LexemeType::LeftBrace;
+        depth -= tokens[m_cursor].type == LexemeType::RightBrace;
+    }
+    m_fetched = std::max(m_fetched, m_cursor);
+
+    if (m_loops > 0)
+    {
+        m_loopBlocks.push_back(m_blocks.size());
+    }
+    m_poliz.AddLexeme({LexemeType::Stub, static_cast<long long int>(m_blocks.size())});
+    m_blocks.push_back({firstToken, -1});
 }
 
 void Parser::AnalizeExpressionOperator()
 {
     AnalizeExpression();
-    if (const auto lex = GetLexeme(); lex.type != LexemeType::Semicolon)
+    if (const auto& lex = GetLexeme(); lex.type != LexemeType::Semicolon)
     {
-        THROW("';' expected", m_scanner.GetCurrentLine(), lex);
+        THROW("';' expected", GetCurrentLine(), lex);
     }
     m_poliz.AddLexeme({LexemeType::Clear, {}});
 }
 
-void Parser::AnalizeExpression()
+// Binding power of the binary operators, 0 for lexemes that end an operand.
+static int GetPrecedence(LexemeType op)
 {
-    AnalizeAssignment();
+    switch (op)
+    {
+    case LexemeType::Or:
+        return 1;
+    case LexemeType::And:
+        return 2;
+    case LexemeType::Less:
+    case LexemeType::Greater:
+    case LexemeType::NotLess:
+    case LexemeType::NotGreater:
+    case LexemeType::Equal:
+    case LexemeType::NotEqual:
+        return 3;
+    case LexemeType::Plus:
+    case LexemeType::Minus:
+        return 4;
+    case LexemeType::Multiply:
+    case LexemeType::Divide:
+        return 5;
+    default:
+        return 0;
+    }
 }
 
-void Parser::AnalizeAssignment()
+// Precedence climbing over m_expression instead of one native call per
+// grammar level, so nesting depth costs heap, not stack. Lexemes are read
+// and code is emitted in the same order as by a recursive descent parser.
+// m_types follows the stack the code builds, so every operator is checked
+// and specialized for the types of its operands as it is emitted.
+ValueType Parser::AnalizeExpression()
 {
-    auto identifier = GetLexeme();
-    if (identifier.type != LexemeType::Identifier)
+    m_expression.clear();
+    m_types.clear();
+    bool start{true};
+    while (true)
     {
-        SaveLexeme(std::move(identifier));
-        AnalizePlainExpression();
-        return;
-    }
+        auto lex = GetLexeme();
+        if (start && lex.type == LexemeType::Identifier)
+        {
+            if (GetLexeme().type == LexemeType::Assign)
+            {
+                // an undeclared name fails only when the assignment runs
+                const auto slot = m_poliz.FindSlot(GetSymbol(lex));
+                m_expression.push_back({ExpressionFrame::Assign, LexemeType::Assign, 0, slot});
+                continue;
+            }
+            UngetLexeme();
+        }
 
-    auto assignment = GetLexeme();
-    if (assignment.type != LexemeType::Assign)
-    {
-        SaveLexeme(std::move(assignment));
-        SaveLexeme(std::move(identifier));
-        AnalizePlainExpression();
-        return;
-    }
+        if (lex.type == LexemeType::Not || IsPlusMinusOperator(lex.type))
+        {
+            m_expression.push_back({ExpressionFrame::Prefix, lex.type});
+            lex = GetLexeme();
+        }
+        start = lex.type == LexemeType::LeftParenthesis;
+        if (start)
+        {
+            m_expression.push_back({ExpressionFrame::Group, lex.type});
+            continue;
+        }
+        AnalizeOperand(std::move(lex));
 
-    m_poliz.AddLexeme(identifier);
-    AnalizeAssignment();
-    m_poliz.AddLexeme(assignment);
+        while (true)
+        {
+            if (!m_expression.empty() && m_expression.back().kind == ExpressionFrame::Prefix)
+            {
+                const auto op = m_expression.back().op == LexemeType::Minus ? LexemeType::UnaryMinus
+                    : m_expression.back().op == LexemeType::Plus ? LexemeType::UnaryPlus
+                    : LexemeType::Not;
+                m_types.back() = EmitTyped(op, m_types.back());
+                m_expression.pop_back();
+            }
+
+            lex = GetLexeme();
+            if (PushOperator(lex.type))
+            {
+                break;
+            }
+
+            ReduceOperators(1);
+            while (!m_expression.empty() && m_expression.back().kind == ExpressionFrame::Assign)
+            {
+                // an unknown variable takes any value, the store fails
+                const auto slot = m_expression.back().slot;
+                if (slot >= 0 && m_poliz.GetVariables()[slot].GetType() != m_types.back())
+                {
+                    THROW("type mismatch", GetCurrentLine(), Lexeme{LexemeType::Assign});
+                }
+                m_poliz.AddLexeme({LexemeType::StoreSlot, slot});
+                m_expression.pop_back();
+            }
+            if (m_expression.empty())
+            {
+                UngetLexeme();
+                return m_types.back();
+            }
+            if (lex.type != LexemeType::RightParenthesis)
+            {
+                THROW("')' expected", GetCurrentLine(), lex);
+            }
+            m_expression.pop_back();
+        }
+    }
 }
 
-void Parser::AnalizePlainExpression()
+void Parser::AnalizeOperand(Lexeme&& lex)
 {
-    AnalizeOrOperand();
-
-    std::vector<size_t> successes;
-    auto lex = GetLexeme();
-    while (lex.type == LexemeType::Or)
+    if (lex.type == LexemeType::Literal)
     {
-        const auto pos = m_poliz.AddConditionalGoto();
-        m_poliz.AddLexeme({LexemeType::Literal, true});
-        successes.push_back(m_poliz.AddGoto());
-        m_poliz.SetLabel(pos);
-
-        AnalizeOrOperand();
-        lex = GetLexeme();
+        m_types.push_back(static_cast<ValueType>(lex.value.index()));
+        m_poliz.AddLexeme(std::move(lex));
     }
-    SaveLexeme(std::move(lex));
-
-    if (successes.empty())
+    else if (lex.type == LexemeType::Identifier)
     {
-        return;
+        const auto slot = m_poliz.FindSlot(GetSymbol(lex));
+        if (slot < 0)
+        {
+            THROW("unknown identifier", GetCurrentLine(), lex);
+        }
+        m_types.push_back(m_poliz.GetVariables()[slot].GetType());
+        m_poliz.AddLexeme({LexemeType::LoadSlot, slot});
     }
-
-    m_poliz.AddLexeme({LexemeType::Literal, false});
-    for (const auto pos: successes)
+    else
     {
-        m_poliz.SetLabel(pos);
+        THROW("unexpected lexeme", GetCurrentLine(), lex);
     }
 }
 
-void Parser::AnalizeOrOperand()
+// Returns false if `op` does not continue the expression. A comparison does
+// not take another comparison as its operand, so the second one ends it.
+bool Parser::PushOperator(LexemeType op)
 {
-    AnalizeAndOperand();
-
-    std::vector<size_t> failures;
-    auto lex = GetLexeme();
-    while (lex.type == LexemeType::And)
+    const auto precedence = GetPrecedence(op);
+    if (precedence == 0)
     {
-        failures.push_back(m_poliz.AddConditionalGoto());
-
-        AnalizeAndOperand();
-        lex = GetLexeme();
+        return false;
     }
-    SaveLexeme(std::move(lex));
 
-    if (failures.empty())
+    ReduceOperators(precedence + 1);
+    const bool chained = !m_expression.empty()
+        && m_expression.back().kind == ExpressionFrame::Operator
+        && GetPrecedence(m_expression.back().op) == precedence;
+    if (chained && IsComparsionOperator(op))
     {
-        return;
+        return false;
     }
-
-    m_poliz.AddLexeme({LexemeType::Literal, true});
-    const auto exitPos = m_poliz.AddGoto();
-    
-    for (const auto pos: failures)
+    // and/or chains stay open to collect jumps, others are left associative
+    if (!chained)
     {
-        m_poliz.SetLabel(pos);
+        m_expression.push_back({ExpressionFrame::Operator, op, m_jumps.size()});
     }
-
-    m_poliz.AddLexeme({LexemeType::Literal, false});
-    m_poliz.SetLabel(exitPos);
-}
-
-void Parser::AnalizeAndOperand()
-{
-    AnalizeComparsionOperand();
-
-    if (auto lex = GetLexeme(); IsComparsionOperator(lex.type))
+    else if (op != LexemeType::And && op != LexemeType::Or)
     {
-        AnalizeComparsionOperand();
-        m_poliz.AddLexeme(lex);
+        EmitOperator(m_expression.back());
+        m_expression.back().op = op;
     }
-    else
+
+    if (op == LexemeType::And)
     {
-        SaveLexeme(std::move(lex));
+        PopCondition(op);
+        m_jumps.push_back(m_poliz.AddConditionalGoto());
     }
-}
-
-void Parser::AnalizeComparsionOperand()
-{
-    AnalizePlusMinusOperand();
-
-    auto lex = GetLexeme();
-    while (IsPlusMinusOperator(lex.type))
+    else if (op == LexemeType::Or)
     {
-        AnalizePlusMinusOperand();
-        m_poliz.AddLexeme(lex);
-
-        lex = GetLexeme();
+        PopCondition(op);
+        const auto pos = m_poliz.AddConditionalGoto();
+        m_poliz.AddLexeme({LexemeType::Literal, true});
+        m_jumps.push_back(m_poliz.AddGoto());
+        m_poliz.SetLabel(pos);
     }
-    SaveLexeme(std::move(lex));
+    return true;
 }
 
-void Parser::AnalizePlusMinusOperand()
+void Parser::ReduceOperators(int precedence)
 {
-    AnalizeMultiplyDivideOperand();
-
-    auto lex = GetLexeme();
-    while (IsMultiplyDivideOperator(lex.type))
+    while (!m_expression.empty()
+        && m_expression.back().kind == ExpressionFrame::Operator
+        && GetPrecedence(m_expression.back().op) >= precedence)
     {
-        AnalizeMultiplyDivideOperand();
-        m_poliz.AddLexeme(lex);
-
-        lex = GetLexeme();
+        EmitOperator(m_expression.back());
+        m_expression.pop_back();
     }
-    SaveLexeme(std::move(lex));
 }
 
-void Parser::AnalizeMultiplyDivideOperand()
+void Parser::EmitOperator(const ExpressionFrame& frame)
 {
-    if (auto lex = GetLexeme(); lex.type == LexemeType::Not)
+    // The last operand of an and/or chain is its value when every operand
+    // before it was true (and) or false (or); the others jump out early.
+    if (frame.op == LexemeType::Or)
     {
-        AnalizeUnaryOperand();
-        m_poliz.AddLexeme(lex);
-    }
-    else if (lex.type == LexemeType::Minus)
-    {
-        AnalizeUnaryOperand();
-        m_poliz.AddLexeme({LexemeType::UnaryMinus, {}});
+        PopCondition(frame.op);
+        m_types.push_back(ValueType::Bool);
+        for (size_t i = frame.firstJump; i < m_jumps.size(); ++i)
+        {
+            m_poliz.SetLabel(m_jumps[i]);
+        }
+        m_jumps.resize(frame.firstJump);
     }
-    else if (lex.type == LexemeType::Plus)
+    else if (frame.op == LexemeType::And)
     {
-        AnalizeUnaryOperand();
-        m_poliz.AddLexeme({LexemeType::UnaryPlus, {}});
+        PopCondition(frame.op);
+        m_types.push_back(ValueType::Bool);
+        const auto exitPos = m_poliz.AddGoto();
+
+        for (size_t i = frame.firstJump; i < m_jumps.size(); ++i)
+        {
+            m_poliz.SetLabel(m_jumps[i]);
+        }
+        m_jumps.resize(frame.firstJump);
+
+        m_poliz.AddLexeme({LexemeType::Literal, false});
+        m_poliz.SetLabel(exitPos);
     }
     else
     {
-        SaveLexeme(std::move(lex));
-        AnalizeUnaryOperand();
+        const auto rhs = m_types.back();
+        m_types.pop_back();
+        if (m_types.back() != rhs)
+        {
+            THROW("type mismatch", GetCurrentLine(), Lexeme{frame.op});
+        }
+        m_types.back() = EmitTyped(frame.op, rhs);
     }
 }
 
-void Parser::AnalizeUnaryOperand()
+ValueType Parser::EmitTyped(LexemeType op, ValueType operands)
 {
-    if (auto lex = GetLexeme(); lex.type == LexemeType::Literal)
-    {
-        m_poliz.AddLexeme(lex);
-    }
-    else if (lex.type == LexemeType::Identifier)
+    Opcode code{};
+    if (!FindOperator(op, operands, code))
     {
-        if (!m_poliz.HasIdentifier(std::get<std::string>(lex.value)))
-        {
-            THROW("unknown identifier", m_scanner.GetCurrentLine(), lex);
-        }
-        m_poliz.AddLexeme(lex);
-    } 
-    else if (lex.type == LexemeType::LeftParenthesis)
-    {
-        AnalizeExpression();
-        if (const auto lex = GetLexeme(); lex.type != LexemeType::RightParenthesis)
-        {
-            THROW("')' expected", m_scanner.GetCurrentLine(), lex);
-        }
+        THROW("type mismatch", GetCurrentLine(), Lexeme{op});
     }
-    else
+    m_poliz.AddLexeme({op, static_cast<long long int>(operands)});
+    return IsComparsionOperator(op) ? ValueType::Bool : operands;
+}
+
+void Parser::PopCondition(LexemeType op)
+{
+    if (m_types.back() != ValueType::Bool)
     {
-        THROW("unexpected lexeme", m_scanner.GetCurrentLine(), lex);
+        THROW("type mismatch", GetCurrentLine(), Lexeme{op});
     }
+    m_types.pop_back();
+}
+
+void Compile(std::string_view source, Poliz& poliz)
+{
+    std::pmr::monotonic_buffer_resource arena;
+    SymbolTable symbols{&arena};
+    Scanner scanner(source, symbols);
+    Parser parser(Tokenize(scanner, &arena), symbols, poliz);
+    parser.Analize();
+}
+
+void CompileLazy(std::string_view source, Poliz& poliz, bool check)
+{
+    auto symbols = std::make_unique<SymbolTable>();
+    Scanner scanner(source, *symbols);
+    auto tokens = Tokenize(scanner);
+    if (check)
+    {
+        Poliz full;
+        Parser parser(tokens, *symbols, full);
+        parser.Analize();
+    }
+    auto parser = std::make_unique<Parser>(std::move(tokens), *symbols, poliz);
+    parser->SetLazy(true);
+    parser->Analize();
+    poliz.SetBlockCompiler(std::move(symbols), std::move(parser));
 }
 
 syntax_exception::syntax_exception(const char* msg, int line, Lexeme lexeme)
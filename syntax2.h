@@ -1,52 +1,144 @@
 #pragma once
 #include "lexical2.h"
+#include "tokens2.h"
+#include <memory_resource>
 #include <vector>
-#include <stack>
 
 class Poliz;
+class SymbolTable;
+
+// Tokens [firstToken, endToken) of a top-level statement and the code
+// [codeBegin, codeEnd) it compiled to.
+struct StatementOutline
+{
+    size_t firstToken;
+    size_t endToken;
+    size_t codeBegin;
+    size_t codeEnd;
+};
 
 class Parser
 {
 public:
+    // Reads the whole token stream from the scanner up front.
     Parser(Scanner& scanner, Poliz& poliz);
+    // Reads `batch` tokens at a time from the scanner as parsing gets to them.
+    Parser(Scanner& scanner, Poliz& poliz, size_t batch);
+    // Parser stacks are allocated from the memory resource of the tokens.
+    Parser(TokenArray tokens, SymbolTable& symbols, Poliz& poliz);
     Parser(const Parser& rhs) = delete;
     Parser& operator = (const Parser& rhs) = delete;
 
     void Analize();
+    // Analize() a step at a time: the header and declarations, then one
+    // top-level statement per call until the closing '}', for which it
+    // returns false.
+    void AnalizeHeader();
+    bool AnalizeStatement();
+    // Statements of a program body up to Eof, for recompiling part of a
+    // program. The variables must be in the Poliz already.
+    void AnalizeFragment();
+    // Top-level statements are appended to `outline` as they are parsed.
+    void SetOutline(std::vector<StatementOutline>* outline);
+    // Nested blocks are only brace matched and left as stubs.
+    void SetLazy(bool lazy);
+    // Appends the code of the block of a stub to the Poliz.
+    void AnalizeBlock(size_t block);
 
 private:
     Lexeme GetLexeme();
-    void SaveLexeme(Lexeme&& lexeme);
+    void LexBatch();
+    // Steps back over the last lexeme read, lookahead is a cursor move.
+    void UngetLexeme();
+    int GetCurrentLine() const;
 
-    void AnalizeProgram(bool defenitions);
+    void AnalizeProgram();
     void AnalizeDefenitions();
     void AnalizeDefenition(LexemeType type);
     void AnalizeVariable(LexemeType type);
     void AnalizeOperators();
-    bool AnalizeOperator();
+    bool AnalizeOperator(bool topLevel = false);
     void AnalizeIf();
     void AnalizeWhile();
     void AnalizeRead();
     void AnalizeWrite();
     void AnalizeBreak();
+    void SkipBlock();
     void AnalizeExpressionOperator();
-    void AnalizeExpression();
-    void AnalizeAssignment();
-    void AnalizePlainExpression();
-    void AnalizeOrOperand();
-    void AnalizeAndOperand();
-    void AnalizeComparsionOperand();
-    void AnalizePlusMinusOperand();
-    void AnalizeMultiplyDivideOperand();
-    void AnalizeUnaryOperand();
-
-    Scanner& m_scanner;
-    std::stack<Lexeme> m_saved;
+    // Returns the type of the expression.
+    ValueType AnalizeExpression();
+
+    // Part of an expression still waiting for operands, innermost last.
+    // An and/or chain owns m_jumps from `firstJump` on, the exits patched
+    // when it ends. An assignment stores to `slot`.
+    struct ExpressionFrame
+    {
+        enum Kind : uint8_t
+        {
+            Group,
+            Assign,
+            Prefix,
+            Operator,
+        };
+
+        Kind kind;
+        LexemeType op;
+        size_t firstJump{};
+        long long int slot{};
+    };
+
+    void AnalizeOperand(Lexeme&& lex);
+    bool PushOperator(LexemeType op);
+    void ReduceOperators(int precedence);
+    void EmitOperator(const ExpressionFrame& frame);
+    // Emits `op` on operands of type `operands`, an error if it does not
+    // take them. Returns the type of the result.
+    ValueType EmitTyped(LexemeType op, ValueType operands);
+    // Pops the type of a condition, which must be boolean.
+    void PopCondition(LexemeType op);
+
+    TokenArray m_tokens;
+    // lexes the rest of the tokens, if they are not all in m_tokens yet
+    Scanner* m_scanner{nullptr};
+    size_t m_batch{0};
+    size_t m_cursor{0};
+    size_t m_fetched{0};
+    SymbolTable& m_symbols;
 
     Poliz& m_poliz;
-    std::stack<std::vector<size_t>> m_breaks;
+    // breaks of all enclosing loops, the innermost loop's last
+    std::pmr::vector<size_t> m_breaks;
+    size_t m_loops{0};
+    std::vector<StatementOutline>* m_outline{nullptr};
+
+    // A block left as a stub, from the token after its '{'. Its breaks jump
+    // to `breakLabel`, or are errors if it is -1.
+    struct LazyBlock
+    {
+        size_t firstToken;
+        long long int breakLabel;
+    };
+
+    bool m_lazy{false};
+    std::vector<LazyBlock> m_blocks;
+    // blocks in the enclosing loops, whose break labels are not known yet
+    std::pmr::vector<size_t> m_loopBlocks;
+    std::pmr::vector<size_t> m_jumps;
+    std::pmr::vector<ExpressionFrame> m_expression;
+    // types of the operands the code of the expression leaves on the stack
+    std::pmr::vector<ValueType> m_types;
 };
 
+// Lexes and parses a whole program into `poliz`. Tokens, names and parser
+// stacks live in an arena that is gone by the time it returns.
+void Compile(std::string_view source, Poliz& poliz);
+
+// Compiles a program with each nested block left as a stub, compiled when
+// it first runs (see Poliz::CreateLazyInterpreter()), so blocks that never
+// run cost no more than brace matching. Errors in a block surface when it
+// runs, unless `check` has the whole program parsed once first.
+void CompileLazy(std::string_view source, Poliz& poliz, bool check = false);
+
 class syntax_exception
     : public std::runtime_error
 {
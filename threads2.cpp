@@ -0,0 +1,46 @@
+#include "threads2.h"
+
+ThreadPool::ThreadPool(size_t threads)
+{
+    for (size_t i = 0; i < std::max<size_t>(threads, 1); ++i)
+    {
+        m_threads.emplace_back([this] { Work(); });
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard lock{m_mutex};
+        m_stopping = true;
+    }
+    m_ready.notify_all();
+    for (auto& thread: m_threads)
+    {
+        thread.join();
+    }
+}
+
+size_t ThreadPool::GetSize() const
+{
+    return m_threads.size();
+}
+
+void ThreadPool::Work()
+{
+    while (true)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock lock{m_mutex};
+            m_ready.wait(lock, [this] { return m_stopping || !m_tasks.empty(); });
+            if (m_tasks.empty())
+            {
+                return;
+            }
+            task = std::move(m_tasks.front());
+            m_tasks.pop();
+        }
+        task();
+    }
+}
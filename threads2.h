@@ -0,0 +1,42 @@
+#pragma once
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+    explicit ThreadPool(size_t threads = std::thread::hardware_concurrency());
+    ThreadPool(const ThreadPool& rhs) = delete;
+    ThreadPool& operator = (const ThreadPool& rhs) = delete;
+    ~ThreadPool();
+
+    template <typename Task>
+    std::future<void> Submit(Task&& task)
+    {
+        auto packaged = std::make_shared<std::packaged_task<void()>>(std::forward<Task>(task));
+        auto result = packaged->get_future();
+        {
+            std::lock_guard lock{m_mutex};
+            m_tasks.push([packaged] { (*packaged)(); });
+        }
+        m_ready.notify_one();
+        return result;
+    }
+
+    size_t GetSize() const;
+
+private:
+    void Work();
+
+    std::vector<std::thread> m_threads;
+    std::queue<std::function<void()>> m_tasks;
+    std::mutex m_mutex;
+    std::condition_variable m_ready;
+    bool m_stopping{false};
+};
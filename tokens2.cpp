@@ -0,0 +1,277 @@
+#include "tokens2.h"
+#include "symbols2.h"
+#include "threads2.h"
+#include <algorithm>
+#include <future>
+#include <limits>
+
+TokenArray::TokenArray(std::pmr::memory_resource* resource)
+    : tokens{resource}
+    , strings{resource}
+{
+}
+
+void TokenArray::Add(Lexeme&& lexeme, int line)
+{
+    long long int value{};
+    if (auto text = std::get_if<std::string>(&lexeme.value))
+    {
+        value = strings.size();
+        strings.emplace_back(*text);
+    }
+    else if (auto number = std::get_if<long long int>(&lexeme.value))
+    {
+        value = *number;
+    }
+    else
+    {
+        value = std::get<bool>(lexeme.value);
+    }
+    tokens.push_back({lexeme.type, static_cast<uint8_t>(lexeme.value.index()), line, value});
+}
+
+Lexeme TokenArray::Get(size_t i) const
+{
+    const auto& token = tokens[i];
+    switch (token.index)
+    {
+    case 1:
+        return {token.type, token.value};
+    case 2:
+        return {token.type, std::string{strings[token.value]}};
+    default:
+        return {token.type, token.value != 0};
+    }
+}
+
+TokenArray Tokenize(Scanner& scanner, std::pmr::memory_resource* resource)
+{
+    TokenArray tokens{resource};
+    try
+    {
+        do
+        {
+            auto lexeme = scanner.GetLexeme();
+            tokens.Add(std::move(lexeme), scanner.GetCurrentLine());
+        }
+        while (tokens.tokens.back().type != LexemeType::Eof);
+    }
+    catch (const lexical_exception&)
+    {
+        tokens.error = std::current_exception();
+    }
+    return tokens;
+}
+
+// Lexemes of [begin, end) scanned as if a lexeme started at `begin`. Lines are
+// counted from 1 at `begin` and identifiers go to the chunk's own table.
+struct Chunk
+{
+    size_t begin{};
+    size_t end{};
+    SymbolTable symbols;
+    TokenArray tokens;
+    std::vector<size_t> ends;
+
+    bool failed{false};
+    std::string message;
+    int errorLine{};
+    char errorSymbol{};
+};
+
+static void LexChunk(std::string_view source, Chunk& chunk)
+{
+    Scanner scanner(source.substr(chunk.begin), chunk.symbols);
+    try
+    {
+        while (chunk.begin + scanner.GetPosition() < chunk.end)
+        {
+            auto lexeme = scanner.GetLexeme();
+            chunk.tokens.Add(std::move(lexeme), scanner.GetCurrentLine());
+            chunk.ends.push_back(chunk.begin + scanner.GetPosition());
+            if (chunk.tokens.tokens.back().type == LexemeType::Eof)
+            {
+                break;
+            }
+        }
+    }
+    catch (const lexical_exception& e)
+    {
+        chunk.failed = true;
+        chunk.message = e.what();
+        chunk.errorLine = e.GetLine();
+        chunk.errorSymbol = e.GetSymbol();
+    }
+}
+
+// Chunk boundaries go right after a newline where possible, so that few
+// chunks start inside a lexeme.
+static size_t FindBoundary(std::string_view source, size_t pos)
+{
+    const auto newline = source.find('\n', pos);
+    return newline == std::string_view::npos || newline - pos > 4096 ? pos : newline + 1;
+}
+
+// Joins chunk results in order. The true scanner state between two lexemes is
+// just a position, so once the true position equals a position at which a
+// chunk's speculative scan was between lexemes, the rest of that chunk is
+// exact. Until then (a chunk started inside a comment, a string or a lexeme)
+// lexemes are scanned again from the true position.
+class Stitcher
+{
+public:
+    Stitcher(std::string_view source, std::vector<Chunk>& chunks, SymbolTable& symbols,
+             std::pmr::memory_resource* resource)
+        : m_source{source}
+        , m_chunks{chunks}
+        , m_symbols{symbols}
+        , m_tokens{resource}
+    {
+    }
+
+    TokenArray Run()
+    {
+        size_t total{0};
+        for (const auto& chunk: m_chunks)
+        {
+            total += chunk.tokens.tokens.size();
+        }
+        m_tokens.tokens.reserve(total);
+
+        size_t current{0};
+        while (!m_done)
+        {
+            while (current + 1 < m_chunks.size() && m_chunks[current + 1].begin <= m_position)
+            {
+                current += 1;
+            }
+            if (!TakeChunk(m_chunks[current]))
+            {
+                ScanOne();
+            }
+        }
+        return std::move(m_tokens);
+    }
+
+private:
+    bool TakeChunk(Chunk& chunk)
+    {
+        size_t first{0};
+        int line{1};
+        if (m_position != chunk.begin)
+        {
+            const auto it = std::lower_bound(chunk.ends.begin(), chunk.ends.end(), m_position);
+            if (it == chunk.ends.end() || *it != m_position)
+            {
+                return false;
+            }
+            first = it - chunk.ends.begin() + 1;
+            line = chunk.tokens.tokens[first - 1].line;
+        }
+        if (first == chunk.tokens.tokens.size() && !chunk.failed)
+        {
+            return false;
+        }
+
+        const int delta = m_line - line;
+        std::vector<SymbolId> remap(chunk.symbols.GetSize(), c_unmapped);
+        for (size_t i = first; i < chunk.tokens.tokens.size(); ++i)
+        {
+            auto token = chunk.tokens.tokens[i];
+            if (token.type == LexemeType::Identifier)
+            {
+                auto& id = remap[token.value];
+                if (id == c_unmapped)
+                {
+                    id = m_symbols.Intern(chunk.symbols.GetName(token.value));
+                }
+                token.value = id;
+            }
+            else if (token.index == 2)
+            {
+                m_tokens.strings.push_back(std::move(chunk.tokens.strings[token.value]));
+                token.value = m_tokens.strings.size() - 1;
+            }
+            token.line += delta;
+            m_tokens.tokens.push_back(token);
+            Advance(chunk.ends[i]);
+        }
+        if (chunk.failed)
+        {
+            Fail(lexical_exception(chunk.message.c_str(), chunk.errorLine + delta, chunk.errorSymbol));
+        }
+        return true;
+    }
+
+    void ScanOne()
+    {
+        Scanner scanner(m_source.substr(m_position), m_symbols);
+        try
+        {
+            auto lexeme = scanner.GetLexeme();
+            m_tokens.Add(std::move(lexeme), m_line + scanner.GetCurrentLine() - 1);
+            Advance(m_position + scanner.GetPosition());
+        }
+        catch (const lexical_exception& e)
+        {
+            Fail(lexical_exception(e.what(), m_line + e.GetLine() - 1, e.GetSymbol()));
+        }
+    }
+
+    // Moves past the lexeme just added, which ends at `end`.
+    void Advance(size_t end)
+    {
+        m_done = m_tokens.tokens.back().type == LexemeType::Eof;
+        m_position = end;
+        m_line = m_tokens.tokens.back().line;
+    }
+
+    void Fail(const lexical_exception& e)
+    {
+        m_tokens.error = std::make_exception_ptr(e);
+        m_done = true;
+    }
+
+    static constexpr SymbolId c_unmapped = std::numeric_limits<SymbolId>::max();
+
+    std::string_view m_source;
+    std::vector<Chunk>& m_chunks;
+    SymbolTable& m_symbols;
+    TokenArray m_tokens;
+    size_t m_position{0};
+    int m_line{1};
+    bool m_done{false};
+};
+
+TokenArray TokenizeParallel(std::string_view source, SymbolTable& symbols,
+                            ThreadPool& pool, size_t minChunk,
+                            std::pmr::memory_resource* resource)
+{
+    const auto count = std::min(pool.GetSize(), source.size() / std::max<size_t>(minChunk, 1));
+    if (count < 2)
+    {
+        Scanner scanner(source, symbols);
+        return Tokenize(scanner, resource);
+    }
+
+    std::vector<Chunk> chunks(count);
+    for (size_t i = 1; i < count; ++i)
+    {
+        chunks[i].begin = std::max(FindBoundary(source, source.size() * i / count), chunks[i - 1].begin);
+        chunks[i - 1].end = chunks[i].begin;
+    }
+    // the last chunk runs to Eof, whatever is left after its last lexeme
+    chunks.back().end = std::numeric_limits<size_t>::max();
+
+    std::vector<std::future<void>> results;
+    for (auto& chunk: chunks)
+    {
+        results.push_back(pool.Submit([source, &chunk] { LexChunk(source, chunk); }));
+    }
+    for (auto& result: results)
+    {
+        result.get();
+    }
+
+    return Stitcher{source, chunks, symbols, resource}.Run();
+}
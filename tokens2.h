@@ -0,0 +1,46 @@
+#pragma once
+#include "lexical2.h"
+#include <exception>
+#include <memory_resource>
+#include <string_view>
+#include <vector>
+
+class ThreadPool;
+
+// Lexeme packed into 16 bytes. `index` is the alternative of Lexeme::value
+// and `value` holds the bool or integer (a symbol id for identifiers) or the
+// position of a string in TokenArray::strings. `line` is the scanner line
+// right after the lexeme was read, i.e. what Scanner::GetCurrentLine()
+// reported then.
+struct Token
+{
+    LexemeType type;
+    uint8_t index;
+    int line;
+    long long int value;
+};
+
+// Whole token stream of a program. A lexical error stops the stream and is
+// kept in `error` so that it surfaces only when a consumer reads past the
+// last good lexeme, as with the scanner.
+struct TokenArray
+{
+    explicit TokenArray(std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+    void Add(Lexeme&& lexeme, int line);
+    Lexeme Get(size_t i) const;
+
+    std::pmr::vector<Token> tokens;
+    std::pmr::vector<std::pmr::string> strings;
+    std::exception_ptr error;
+};
+
+TokenArray Tokenize(Scanner& scanner,
+                    std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+// Splits the buffer into one chunk per pool thread (at least `minChunk` bytes
+// each), lexes the chunks speculatively and stitches the results so that the
+// outcome, symbol ids included, is the same as Tokenize() over the buffer.
+TokenArray TokenizeParallel(std::string_view source, SymbolTable& symbols,
+                            ThreadPool& pool, size_t minChunk = 1 << 18,
+                            std::pmr::memory_resource* resource = std::pmr::get_default_resource());
@@ -0,0 +1,77 @@
+#include "value2.h"
+#include <cstring>
+#include <new>
+
+TaggedValue::TaggedValue(std::string_view text)
+    : m_string{Allocate(text.size())}
+    , m_type{Type::String}
+{
+    std::memcpy(m_string->Data(), text.data(), text.size());
+}
+
+TaggedValue::TaggedValue(const Value& value)
+    : TaggedValue{}
+{
+    if (const auto text = std::get_if<std::string>(&value))
+    {
+        *this = TaggedValue{std::string_view{*text}};
+    }
+    else if (const auto number = std::get_if<long long int>(&value))
+    {
+        *this = TaggedValue{*number};
+    }
+    else
+    {
+        *this = TaggedValue{std::get<bool>(value)};
+    }
+}
+
+Value TaggedValue::ToValue() const
+{
+    switch (m_type)
+    {
+    case Type::String:
+        return std::string{GetString()};
+    case Type::Int:
+        return m_int;
+    default:
+        return m_bool;
+    }
+}
+
+TaggedValue TaggedValue::Concatenate(std::string_view lhs, std::string_view rhs)
+{
+    TaggedValue result;
+    result.m_string = Allocate(lhs.size() + rhs.size());
+    result.m_type = Type::String;
+    std::memcpy(result.m_string->Data(), lhs.data(), lhs.size());
+    std::memcpy(result.m_string->Data() + lhs.size(), rhs.data(), rhs.size());
+    return result;
+}
+
+TaggedValue::Buffer* TaggedValue::Allocate(size_t size)
+{
+    const auto buffer = new (::operator new(sizeof(Buffer) + size)) Buffer;
+    buffer->refs.store(1, std::memory_order_relaxed);
+    buffer->size = size;
+    return buffer;
+}
+
+void TaggedValue::Free(Buffer* buffer)
+{
+    buffer->~Buffer();
+    ::operator delete(buffer);
+}
+
+std::ostream& operator << (std::ostream& os, const TaggedValue& value)
+{
+    switch (value.GetType())
+    {
+    case TaggedValue::Type::String:
+        return os << value.GetString();
+    case TaggedValue::Type::Int:
+        return os << value.GetInt();
+    default:
+        return os << (value.GetBool() ? "true" : "false");
+    }
+}
@@ -0,0 +1,157 @@
+#pragma once
+#include "lexical2.h"
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <string_view>
+
+// Value as the interpreter keeps it, in 16 bytes: a type tag next to a bool,
+// an integer or a pointer to a string. Strings are immutable and shared by
+// reference count, so copying a value never copies text. The count is
+// atomic since the constants of a cached program are shared by the
+// interpreters of several threads.
+class TaggedValue
+{
+public:
+    using Type = ValueType;
+
+    // false, as Value{}
+    TaggedValue() noexcept
+        : m_int{0}
+        , m_type{Type::Bool}
+    {
+    }
+    TaggedValue(bool value) noexcept
+        : m_int{0}
+        , m_type{Type::Bool}
+    {
+        m_bool = value;
+    }
+    TaggedValue(long long int value) noexcept
+        : m_int{value}
+        , m_type{Type::Int}
+    {
+    }
+    explicit TaggedValue(std::string_view text);
+    // Lexemes and the rest of the compiler hold Value, the interpreter
+    // converts at the boundary.
+    explicit TaggedValue(const Value& value);
+
+    TaggedValue(const TaggedValue& rhs) noexcept
+        : m_int{rhs.m_int}
+        , m_type{rhs.m_type}
+    {
+        Retain();
+    }
+    TaggedValue(TaggedValue&& rhs) noexcept
+        : m_int{rhs.m_int}
+        , m_type{rhs.m_type}
+    {
+        rhs.m_type = Type::Bool;
+    }
+    TaggedValue& operator = (const TaggedValue& rhs) noexcept
+    {
+        if (this != &rhs)
+        {
+            rhs.Retain();
+            Release();
+            m_int = rhs.m_int;
+            m_type = rhs.m_type;
+        }
+        return *this;
+    }
+    TaggedValue& operator = (TaggedValue&& rhs) noexcept
+    {
+        if (this != &rhs)
+        {
+            Release();
+            m_int = rhs.m_int;
+            m_type = rhs.m_type;
+            rhs.m_type = Type::Bool;
+        }
+        return *this;
+    }
+    ~TaggedValue()
+    {
+        Release();
+    }
+
+    Type GetType() const
+    {
+        return m_type;
+    }
+    bool IsBool() const
+    {
+        return m_type == Type::Bool;
+    }
+    bool IsInt() const
+    {
+        return m_type == Type::Int;
+    }
+    bool IsString() const
+    {
+        return m_type == Type::String;
+    }
+
+    // The getters expect the value to be of their type.
+    bool GetBool() const
+    {
+        return m_bool;
+    }
+    long long int GetInt() const
+    {
+        return m_int;
+    }
+    std::string_view GetString() const
+    {
+        return {m_string->Data(), m_string->size};
+    }
+
+    Value ToValue() const;
+    // Concatenation of two strings.
+    static TaggedValue Concatenate(std::string_view lhs, std::string_view rhs);
+
+private:
+    // Header of a string, the text follows it in the same allocation.
+    struct Buffer
+    {
+        mutable std::atomic<size_t> refs;
+        size_t size;
+
+        char* Data()
+        {
+            return reinterpret_cast<char*>(this + 1);
+        }
+    };
+
+    static Buffer* Allocate(size_t size);
+    static void Free(Buffer* buffer);
+
+    void Retain() const
+    {
+        if (m_type == Type::String)
+        {
+            m_string->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    void Release()
+    {
+        if (m_type == Type::String && m_string->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            Free(m_string);
+        }
+    }
+
+    union
+    {
+        bool m_bool;
+        long long int m_int;
+        Buffer* m_string;
+    };
+    Type m_type;
+};
+
+static_assert(sizeof(TaggedValue) == 16, "a tagged value takes 16 bytes");
+
+// Bools print as true/false, strings without quotes, as write() does.
+std::ostream& operator << (std::ostream& os, const TaggedValue& value);